@@ -25,6 +25,7 @@
 
 #include <libfm/fm-gtk.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "app-config.h"
 
@@ -50,6 +51,11 @@ static void fm_app_config_finalize(GObject *object)
 
     cfg = FM_APP_CONFIG(object);
     g_free(cfg->wallpaper);
+    g_strfreev(cfg->wallpaper_monitors);
+    g_strfreev(cfg->wallpapers);
+    g_free(cfg->wallpaper_modes);
+    g_free(cfg->slideshow_dir);
+    g_strfreev(cfg->desktop_modules);
 
     G_OBJECT_CLASS(fm_app_config_parent_class)->finalize(object);
 }
@@ -67,6 +73,7 @@ static void fm_app_config_init(FmAppConfig *cfg)
     cfg->autorun = TRUE;
 
     cfg->desktop_fg.red = cfg->desktop_fg.green = cfg->desktop_fg.blue = 65535;
+    cfg->slideshow_interval = 10;
     cfg->win_width = 640;
     cfg->win_height = 480;
     cfg->splitter_pos = 150;
@@ -86,6 +93,32 @@ FmConfig *fm_app_config_new(void)
     return (FmConfig*)g_object_new(FM_APP_CONFIG_TYPE, NULL);
 }
 
+/* make the lists of the wallpapers of the monitors the same length.
+ * the monitors saved without names are found by their numbers. */
+static void fix_monitor_wallpapers(FmAppConfig* cfg)
+{
+    guint n_files = cfg->wallpapers ? g_strv_length(cfg->wallpapers) : 0;
+    guint n_names = cfg->wallpaper_monitors ? g_strv_length(cfg->wallpaper_monitors) : 0;
+    guint i, n = MAX(n_files, (guint)cfg->n_wallpaper_modes);
+
+    cfg->wallpapers = g_renew(char*, cfg->wallpapers, n + 1);
+    for(i = n_files; i < n; ++i)
+        cfg->wallpapers[i] = g_strdup("");
+    cfg->wallpapers[n] = NULL;
+
+    for(i = n; i < n_names; ++i)
+        g_free(cfg->wallpaper_monitors[i]);
+    cfg->wallpaper_monitors = g_renew(char*, cfg->wallpaper_monitors, n + 1);
+    for(i = n_names; i < n; ++i)
+        cfg->wallpaper_monitors[i] = g_strdup_printf("#%u", i);
+    cfg->wallpaper_monitors[n] = NULL;
+
+    cfg->wallpaper_modes = g_renew(int, cfg->wallpaper_modes, n);
+    for(i = cfg->n_wallpaper_modes; i < n; ++i)
+        cfg->wallpaper_modes[i] = -1;
+    cfg->n_wallpaper_modes = n;
+}
+
 void fm_app_config_load_from_key_file(FmAppConfig* cfg, GKeyFile* kf)
 {
     char* tmp;
@@ -105,6 +138,23 @@ void fm_app_config_load_from_key_file(FmAppConfig* cfg, GKeyFile* kf)
     g_free(cfg->wallpaper);
     cfg->wallpaper = tmp;
 
+    g_strfreev(cfg->wallpapers);
+    cfg->wallpapers = g_key_file_get_string_list(kf, "desktop", "wallpapers", NULL, NULL);
+    g_free(cfg->wallpaper_modes);
+    cfg->wallpaper_modes = g_key_file_get_integer_list(kf, "desktop", "wallpaper_modes",
+                                                       &cfg->n_wallpaper_modes, NULL);
+    if(!cfg->wallpaper_modes)
+        cfg->n_wallpaper_modes = 0;
+    g_strfreev(cfg->wallpaper_monitors);
+    cfg->wallpaper_monitors = g_key_file_get_string_list(kf, "desktop", "wallpaper_monitors", NULL, NULL);
+    fix_monitor_wallpapers(cfg);
+
+    fm_key_file_get_bool(kf, "desktop", "slideshow", &cfg->slideshow);
+    tmp = g_key_file_get_string(kf, "desktop", "slideshow_dir", NULL);
+    g_free(cfg->slideshow_dir);
+    cfg->slideshow_dir = tmp;
+    fm_key_file_get_int(kf, "desktop", "slideshow_interval", &cfg->slideshow_interval);
+
     tmp = g_key_file_get_string(kf, "desktop", "desktop_bg", NULL);
     if(tmp)
     {
@@ -129,6 +179,9 @@ void fm_app_config_load_from_key_file(FmAppConfig* cfg, GKeyFile* kf)
     cfg->desktop_font = tmp;
 
     fm_key_file_get_bool(kf, "desktop", "show_wm_menu", &cfg->show_wm_menu);
+    fm_key_file_get_int(kf, "desktop", "desktop_stacks", &cfg->desktop_stacks);
+    g_strfreev(cfg->desktop_modules);
+    cfg->desktop_modules = g_key_file_get_string_list(kf, "desktop", "modules", NULL, NULL);
 
     /* ui */
     fm_key_file_get_int(kf, "ui", "always_show_tabs", &cfg->always_show_tabs);
@@ -247,12 +300,40 @@ void fm_app_config_save_profile(FmAppConfig* cfg, const char* name)
         g_string_append(buf, "\n[desktop]\n");
         g_string_append_printf(buf, "wallpaper_mode=%d\n", cfg->wallpaper_mode);
         g_string_append_printf(buf, "wallpaper=%s\n", cfg->wallpaper ? cfg->wallpaper : "");
+        if(cfg->wallpapers && *cfg->wallpapers)
+        {
+            char* wallpapers = g_strjoinv(";", cfg->wallpapers);
+            g_string_append_printf(buf, "wallpapers=%s\n", wallpapers);
+            g_free(wallpapers);
+            wallpapers = g_strjoinv(";", cfg->wallpaper_monitors);
+            g_string_append_printf(buf, "wallpaper_monitors=%s\n", wallpapers);
+            g_free(wallpapers);
+        }
+        if(cfg->n_wallpaper_modes > 0)
+        {
+            gsize i;
+            g_string_append(buf, "wallpaper_modes=");
+            for(i = 0; i < cfg->n_wallpaper_modes; ++i)
+                g_string_append_printf(buf, "%d;", cfg->wallpaper_modes[i]);
+            g_string_append_c(buf, '\n');
+        }
+        g_string_append_printf(buf, "slideshow=%d\n", cfg->slideshow);
+        if(cfg->slideshow_dir && *cfg->slideshow_dir)
+            g_string_append_printf(buf, "slideshow_dir=%s\n", cfg->slideshow_dir);
+        g_string_append_printf(buf, "slideshow_interval=%d\n", cfg->slideshow_interval);
         g_string_append_printf(buf, "desktop_bg=#%02x%02x%02x\n", cfg->desktop_bg.red/257, cfg->desktop_bg.green/257, cfg->desktop_bg.blue/257);
         g_string_append_printf(buf, "desktop_fg=#%02x%02x%02x\n", cfg->desktop_fg.red/257, cfg->desktop_fg.green/257, cfg->desktop_fg.blue/257);
         g_string_append_printf(buf, "desktop_shadow=#%02x%02x%02x\n", cfg->desktop_shadow.red/257, cfg->desktop_shadow.green/257, cfg->desktop_shadow.blue/257);
         if(cfg->desktop_font && *cfg->desktop_font)
             g_string_append_printf(buf, "desktop_font=%s\n", cfg->desktop_font);
         g_string_append_printf(buf, "show_wm_menu=%d\n", cfg->show_wm_menu);
+        g_string_append_printf(buf, "desktop_stacks=%d\n", cfg->desktop_stacks);
+        if(cfg->desktop_modules && *cfg->desktop_modules)
+        {
+            char* modules = g_strjoinv(";", cfg->desktop_modules);
+            g_string_append_printf(buf, "modules=%s\n", modules);
+            g_free(modules);
+        }
 
         g_string_append(buf, "\n[ui]\n");
         g_string_append_printf(buf, "always_show_tabs=%d\n", cfg->always_show_tabs);
@@ -277,3 +358,101 @@ void fm_app_config_save_profile(FmAppConfig* cfg, const char* name)
     g_free(dir_path);
 }
 
+/* get the entry of the monitor in the lists of the wallpapers */
+static int find_monitor_wallpaper(FmAppConfig* cfg, const char* key)
+{
+    int i;
+    for(i = 0; cfg->wallpaper_monitors && cfg->wallpaper_monitors[i]; ++i)
+        if(strcmp(cfg->wallpaper_monitors[i], key) == 0)
+            return i;
+    return -1;
+}
+
+static void remove_monitor_wallpaper(FmAppConfig* cfg, int i)
+{
+    int n = (int)cfg->n_wallpaper_modes;
+    g_free(cfg->wallpaper_monitors[i]);
+    g_free(cfg->wallpapers[i]);
+    /* the lists are terminated by NULL, which is moved too */
+    memmove(cfg->wallpaper_monitors + i, cfg->wallpaper_monitors + i + 1, (n - i) * sizeof(char*));
+    memmove(cfg->wallpapers + i, cfg->wallpapers + i + 1, (n - i) * sizeof(char*));
+    memmove(cfg->wallpaper_modes + i, cfg->wallpaper_modes + i + 1, (n - i - 1) * sizeof(int));
+    --cfg->n_wallpaper_modes;
+}
+
+void fm_app_config_get_monitor_wallpaper(FmAppConfig* cfg, int monitor, const char* name,
+                                         const char** file, FmWallpaperMode* mode)
+{
+    char key[16];
+    int i = -1;
+
+    *file = cfg->wallpaper;
+    *mode = cfg->wallpaper_mode;
+    if(monitor < 0)
+        return;
+    if(name)
+        i = find_monitor_wallpaper(cfg, name);
+    if(i < 0)
+    {
+        g_snprintf(key, sizeof(key), "#%d", monitor);
+        i = find_monitor_wallpaper(cfg, key);
+        if(i < 0)
+            return;
+    }
+    /* empty strings and negative modes are not set for the monitor */
+    if(*cfg->wallpapers[i])
+        *file = cfg->wallpapers[i];
+    if(cfg->wallpaper_modes[i] >= 0)
+        *mode = cfg->wallpaper_modes[i];
+}
+
+void fm_app_config_set_monitor_wallpaper(FmAppConfig* cfg, int monitor, const char* name,
+                                         const char* file, FmWallpaperMode mode)
+{
+    char key[16];
+    int i, m = mode;
+
+    if(monitor < 0)
+    {
+        g_free(cfg->wallpaper);
+        cfg->wallpaper = g_strdup(file);
+        cfg->wallpaper_mode = mode;
+        return;
+    }
+
+    g_snprintf(key, sizeof(key), "#%d", monitor);
+    /* the entry set by number is replaced by the one set by name */
+    if(name && (i = find_monitor_wallpaper(cfg, key)) >= 0)
+        remove_monitor_wallpaper(cfg, i);
+    if(!name)
+        name = key;
+    i = find_monitor_wallpaper(cfg, name);
+
+    /* the ones the same as those of all monitors follow them */
+    if(!file || g_strcmp0(file, cfg->wallpaper) == 0)
+        file = "";
+    if(mode == cfg->wallpaper_mode)
+        m = -1;
+    if(!*file && m < 0)
+    {
+        if(i >= 0)
+            remove_monitor_wallpaper(cfg, i);
+        return;
+    }
+
+    if(i < 0)
+    {
+        i = (int)cfg->n_wallpaper_modes;
+        cfg->wallpaper_monitors = g_renew(char*, cfg->wallpaper_monitors, i + 2);
+        cfg->wallpaper_monitors[i] = g_strdup(name);
+        cfg->wallpaper_monitors[i + 1] = NULL;
+        cfg->wallpapers = g_renew(char*, cfg->wallpapers, i + 2);
+        cfg->wallpapers[i] = NULL;
+        cfg->wallpapers[i + 1] = NULL;
+        cfg->wallpaper_modes = g_renew(int, cfg->wallpaper_modes, i + 1);
+        ++cfg->n_wallpaper_modes;
+    }
+    g_free(cfg->wallpapers[i]);
+    cfg->wallpapers[i] = g_strdup(file);
+    cfg->wallpaper_modes[i] = m;
+}
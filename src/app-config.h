@@ -58,6 +58,13 @@ typedef enum
     FM_OPEN_IN_LAST_ACTIVE_WINDOW,
 }FmOpenMethod;
 
+typedef enum
+{
+    FM_STACK_NONE,
+    FM_STACK_BY_TYPE,
+    FM_STACK_BY_DATE
+}FmStackMode;
+
 typedef struct _FmAppConfig         FmAppConfig;
 typedef struct _FmAppConfigClass        FmAppConfigClass;
 
@@ -94,6 +101,17 @@ struct _FmAppConfig
     /* emit "changed::wallpaper" */
     FmWallpaperMode wallpaper_mode;
     char* wallpaper;
+    /* wallpapers of the monitors, see fm_app_config_get_monitor_wallpaper().
+     * the lists have the same length, wallpaper_monitors has the names of
+     * the outputs, or "#N" for the N-th monitor if the name is unknown. */
+    char** wallpaper_monitors;
+    char** wallpapers;
+    int* wallpaper_modes;
+    gsize n_wallpaper_modes;
+    /* emit "changed::slideshow" */
+    gboolean slideshow; /* show the images in slideshow_dir instead of wallpaper */
+    char* slideshow_dir;
+    int slideshow_interval; /* in minutes */
     GdkColor desktop_bg;
     /* emit "changed::desktop_text" */
     GdkColor desktop_fg;
@@ -102,6 +120,9 @@ struct _FmAppConfig
     char* desktop_font;
 
     gboolean show_wm_menu;
+    /* emit "changed::desktop_stacks" */
+    FmStackMode desktop_stacks;
+    char** desktop_modules; /* names of desktop painting modules, see desktop-module.h */
 
     char* su_cmd;
 };
@@ -120,6 +141,21 @@ void fm_app_config_load_from_key_file(FmAppConfig* cfg, GKeyFile* kf);
 
 void fm_app_config_save_profile(FmAppConfig* cfg, const char* name);
 
+/* Get the wallpaper of a monitor. file is cfg->wallpaper unless the
+ * monitor has its own, and it can be NULL. The monitor is found by name,
+ * the name of its output, since the numbers of the monitors are changed
+ * when one is plugged. monitor is only used if name is NULL, or if the
+ * monitor was set before its name was known. */
+void fm_app_config_get_monitor_wallpaper(FmAppConfig* cfg, int monitor, const char* name,
+                                         const char** file, FmWallpaperMode* mode);
+
+/* Set the wallpaper of a monitor, or of all monitors if monitor is -1.
+ * The wallpaper of all monitors is used by the monitors which don't have
+ * their own. A monitor set to the same file or mode uses the one of all
+ * monitors again. */
+void fm_app_config_set_monitor_wallpaper(FmAppConfig* cfg, int monitor, const char* name,
+                                         const char* file, FmWallpaperMode mode);
+
 
 G_END_DECLS
 
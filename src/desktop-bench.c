@@ -0,0 +1,790 @@
+/*
+ *      desktop-bench.c
+ *
+ *      Copyright 2010 Hong Jen Yee (PCMan) <pcman.tw@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+/* Benchmark of the desktop, run with a generated desktop folder.
+ *
+ * desktop.c is included, so the internal functions of the desktop can be
+ * called directly. pcmanfm.c is not linked, see the stubs below.
+ *
+ * It needs an X server, Xvfb is enough:
+ *   xvfb-run -s "-screen 0 1280x1024x24" ./desktop-bench --sizes=100,10000
+ *
+ * A temporary home folder is used, so the settings of the user don't
+ * change the results and nothing is written to the real desktop. */
+
+#include "desktop.c"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <utime.h>
+#include <sys/resource.h>
+
+typedef struct _Scenario Scenario;
+struct _Scenario
+{
+    const char* name;
+    /* run the scenario once and return the time it took in seconds */
+    gdouble (*run)(FmDesktop* desktop, GRand* rand, int round);
+};
+
+static char* sizes_arg = NULL;
+static int n_rounds = 50;
+static int seed = 1;
+static char* dump_dir = NULL;
+
+static GOptionEntry opt_entries[] =
+{
+    { "sizes", 0, 0, G_OPTION_ARG_STRING, &sizes_arg, "Numbers of files on the desktop (default: 100,1000,10000,50000)", "N,N,..." },
+    { "rounds", 0, 0, G_OPTION_ARG_INT, &n_rounds, "Number of times each scenario is run (default: 50)", "N" },
+    { "seed", 0, 0, G_OPTION_ARG_INT, &seed, "Seed of the generated file names (default: 1)", "N" },
+    { "dump", 0, 0, G_OPTION_ARG_FILENAME, &dump_dir, "Save the last frame of each scenario as PNG in DIR", "DIR" },
+    { NULL }
+};
+
+static char* home_dir = NULL;
+static char* desktop_dir = NULL;
+static char* wallpaper_file = NULL;
+static GdkPixbuf* upload_pix = NULL;
+static volatile int n_hits = 0; /* so the hit tests are not optimized out */
+static int n_errors = 0; /* the scenarios checking the results failed */
+
+/* the functions of pcmanfm.c used by the desktop */
+void pcmanfm_ref()
+{
+}
+
+void pcmanfm_unref()
+{
+}
+
+gboolean pcmanfm_open_folder(GAppLaunchContext* ctx, GList* folder_infos, gpointer user_data, GError** err)
+{
+    return TRUE;
+}
+
+char* pcmanfm_get_profile_dir(gboolean create)
+{
+    char* dir = g_build_filename(g_get_user_config_dir(), "pcmanfm", "default", NULL);
+    if(create)
+        g_mkdir_with_parents(dir, 0700);
+    return dir;
+}
+
+void pcmanfm_save_config(gboolean immediate)
+{
+}
+
+void pcmanfm_open_folder_in_terminal(GtkWindow* parent, FmPath* dir)
+{
+}
+
+void pcmanfm_create_new(GtkWindow* parent, FmPath* cwd, const char* templ, const char* name_templ)
+{
+}
+
+/* this has to be done before GLib reads the user dirs */
+static gboolean setup_home()
+{
+    char* path;
+    char* data;
+
+    home_dir = g_strdup("/tmp/desktop-bench-XXXXXX");
+    if(!mkdtemp(home_dir))
+        return FALSE;
+    g_setenv("HOME", home_dir, TRUE);
+
+    path = g_build_filename(home_dir, ".cache", NULL);
+    g_setenv("XDG_CACHE_HOME", path, TRUE);
+    g_free(path);
+
+    path = g_build_filename(home_dir, ".config", NULL);
+    g_mkdir_with_parents(path, 0700);
+    g_setenv("XDG_CONFIG_HOME", path, TRUE);
+    g_free(path);
+
+    desktop_dir = g_build_filename(home_dir, "Desktop", NULL);
+    path = g_build_filename(home_dir, ".config", "user-dirs.dirs", NULL);
+    data = g_strdup_printf("XDG_DESKTOP_DIR=\"%s\"\n", desktop_dir);
+    g_file_set_contents(path, data, -1, NULL);
+    g_free(data);
+    g_free(path);
+    return TRUE;
+}
+
+static void remove_dir(const char* path, gboolean remove_self)
+{
+    GDir* dir = g_dir_open(path, 0, NULL);
+    if(dir)
+    {
+        const char* name;
+        while((name = g_dir_read_name(dir)))
+        {
+            char* file = g_build_filename(path, name, NULL);
+            if(g_file_test(file, G_FILE_TEST_IS_DIR) && !g_file_test(file, G_FILE_TEST_IS_SYMLINK))
+                remove_dir(file, TRUE);
+            else
+                g_unlink(file);
+            g_free(file);
+        }
+        g_dir_close(dir);
+    }
+    if(remove_self)
+        g_rmdir(path);
+}
+
+/* generate n files with names of 1 to 48 characters and various types.
+ * the results are the same for the same seed. */
+static void populate_desktop(int n)
+{
+    static const char* const parts[] =
+    {
+        "a", "e", "i", "o", "u", "n", "r", "s", "t", "l",
+        "Report", "final", "copy", "IMG", "2011", "_", "-", " ",
+        "\xc3\xa4", "\xc3\xb6", "\xc3\xa9", /* äöé */
+        "\xe6\x97\xa5\xe6\x9c\xac", /* 日本 */
+        "\xd0\xbf\xd1\x80\xd0\xb8" /* при */
+    };
+    static const char* const exts[] =
+    {
+        "", ".txt", ".png", ".jpg", ".mp3", ".ogg", ".avi",
+        ".pdf", ".odt", ".sh", ".desktop", ".tar.gz"
+    };
+    GRand* rand = g_rand_new_with_seed(seed);
+    GString* name = g_string_sized_new(128);
+    time_t now = time(NULL);
+    int i;
+
+    remove_dir(desktop_dir, FALSE);
+    g_mkdir_with_parents(desktop_dir, 0700);
+    for( i = 0; i < n; ++i )
+    {
+        int len = g_rand_int_range(rand, 1, 49);
+        /* about one in twenty is a folder */
+        gboolean is_dir = (g_rand_int_range(rand, 0, 20) == 0);
+        char* path;
+        struct utimbuf times;
+
+        g_string_truncate(name, 0);
+        while(g_utf8_strlen(name->str, -1) < len)
+            g_string_append(name, parts[g_rand_int_range(rand, 0, G_N_ELEMENTS(parts))]);
+        /* the names have to be unique */
+        g_string_append_printf(name, "~%d", i);
+        if(!is_dir)
+            g_string_append(name, exts[g_rand_int_range(rand, 0, G_N_ELEMENTS(exts))]);
+
+        path = g_build_filename(desktop_dir, name->str, NULL);
+        if(is_dir)
+            g_mkdir(path, 0700);
+        else
+            g_file_set_contents(path, "", 0, NULL);
+        /* spread over the last 60 days, for sorting and stacks by date */
+        times.actime = times.modtime = now - g_rand_int_range(rand, 0, 60 * 24 * 3600);
+        utime(path, &times);
+        g_free(path);
+    }
+    g_string_free(name, TRUE);
+    g_rand_free(rand);
+}
+
+static gboolean has_render_jobs(FmDesktop* desktop)
+{
+    guint i;
+    int state;
+    for( i = 0; i < desktop->items->len; ++i )
+    {
+        FmDesktopItem* item = get_item(desktop, i);
+        for( state = 0; state < N_ITEM_STATES; ++state )
+            if(item->render_jobs[state])
+                return TRUE;
+    }
+    return FALSE;
+}
+
+static gboolean is_loading_wallpaper(FmDesktop* desktop)
+{
+    guint i;
+    for(i = 0; i < desktop->monitors->len; ++i)
+    {
+        FmDesktopMonitor* mon = (FmDesktopMonitor*)g_ptr_array_index(desktop->monitors, i);
+        if(mon->wallpaper_req || mon->next_req)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* run the main loop until the desktop has nothing more to do */
+static void wait_idle(FmDesktop* desktop)
+{
+    for(;;)
+    {
+        while(gtk_events_pending())
+            gtk_main_iteration();
+        if(!has_render_jobs(desktop) && !is_loading_wallpaper(desktop))
+            break;
+        /* wait for the workers */
+        gtk_main_iteration();
+    }
+}
+
+/* do what on_expose() does for an exposure by the X server. the
+ * damage queued before is repainted, and rect is copied to the window. */
+static void expose(FmDesktop* desktop, const GdkRectangle* rect)
+{
+    GtkWidget* widget = (GtkWidget*)desktop;
+    GdkEventExpose evt;
+
+    memset(&evt, 0, sizeof(evt));
+    evt.type = GDK_EXPOSE;
+    evt.window = gtk_widget_get_window(widget);
+    evt.send_event = TRUE;
+    if(rect)
+    {
+        evt.area = *rect;
+        evt.region = gdk_region_rectangle(rect);
+    }
+    else
+        evt.region = gdk_region_new();
+    on_expose(widget, &evt);
+    gdk_region_destroy(evt.region);
+    /* wait for the X server to draw it */
+    gdk_display_sync(gtk_widget_get_display(widget));
+}
+
+static inline void paint_damage(FmDesktop* desktop)
+{
+    expose(desktop, NULL);
+}
+
+static void random_point(FmDesktop* desktop, GRand* rand, int* x, int* y)
+{
+    GdkRectangle* area = &desktop->working_area;
+    *x = area->x + g_rand_int_range(rand, 0, MAX(area->width, 1));
+    *y = area->y + g_rand_int_range(rand, 0, MAX(area->height, 1));
+}
+
+static gdouble bench_layout(FmDesktop* desktop, GRand* rand, int round)
+{
+    GTimer* timer = g_timer_new();
+    gdouble elapsed;
+    layout_items(desktop);
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+    paint_damage(desktop);
+    wait_idle(desktop);
+    return elapsed;
+}
+
+/* repaint the whole desktop with the images of the items already rendered */
+static gdouble bench_expose_full(FmDesktop* desktop, GRand* rand, int round)
+{
+    GTimer* timer = g_timer_new();
+    gdouble elapsed;
+    queue_redraw(desktop, NULL);
+    paint_damage(desktop);
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+    return elapsed;
+}
+
+/* repaint the whole desktop after all the items need to be rendered
+ * again, e.g. when the font is changed. includes the workers. */
+static gdouble bench_expose_cold(FmDesktop* desktop, GRand* rand, int round)
+{
+    GTimer* timer = g_timer_new();
+    gdouble elapsed;
+    ++desktop->surface_stamp;
+    queue_redraw(desktop, NULL);
+    paint_damage(desktop);
+    wait_idle(desktop);
+    paint_damage(desktop);
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+    return elapsed;
+}
+
+/* repaint some random areas of the size of an item */
+static gdouble bench_expose_partial(FmDesktop* desktop, GRand* rand, int round)
+{
+    GTimer* timer;
+    gdouble elapsed;
+    GdkRectangle rects[8];
+    int i;
+
+    for( i = 0; i < (int)G_N_ELEMENTS(rects); ++i )
+    {
+        random_point(desktop, rand, &rects[i].x, &rects[i].y);
+        rects[i].width = desktop->cell_w;
+        rects[i].height = desktop->cell_h;
+    }
+    timer = g_timer_new();
+    for( i = 0; i < (int)G_N_ELEMENTS(rects); ++i )
+        queue_redraw(desktop, &rects[i]);
+    paint_damage(desktop);
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+    return elapsed;
+}
+
+/* 1000 random points */
+static gdouble bench_hit_test(FmDesktop* desktop, GRand* rand, int round)
+{
+    GTimer* timer;
+    gdouble elapsed;
+    int xs[1000], ys[1000];
+    int i;
+
+    for( i = 0; i < 1000; ++i )
+        random_point(desktop, rand, &xs[i], &ys[i]);
+    timer = g_timer_new();
+    for( i = 0; i < 1000; ++i )
+        if(hit_test(desktop, xs[i], ys[i]))
+            ++n_hits;
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+    return elapsed;
+}
+
+/* drag a rubber band between two random points in 20 steps, each of
+ * them painted as it would be on motion events. */
+static gdouble bench_rubber_band(FmDesktop* desktop, GRand* rand, int round)
+{
+    GTimer* timer;
+    gdouble elapsed;
+    int x0, y0, x1, y1, i;
+
+    random_point(desktop, rand, &x0, &y0);
+    random_point(desktop, rand, &x1, &y1);
+    timer = g_timer_new();
+    desktop->drag_start_x = desktop->rubber_bending_x = x0;
+    desktop->drag_start_y = desktop->rubber_bending_y = y0;
+    desktop->rubber_bending = TRUE;
+    for( i = 1; i <= 20; ++i )
+    {
+        update_rubberbanding(desktop, x0 + (x1 - x0) * i / 20, y0 + (y1 - y0) * i / 20);
+        paint_damage(desktop);
+    }
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+
+    /* the frame is dumped with the rubber band */
+    if(round < n_rounds - 1)
+    {
+        update_rubberbanding(desktop, x0, y0);
+        desktop->rubber_bending = FALSE;
+        deselect_all(desktop);
+        paint_damage(desktop);
+    }
+    return elapsed;
+}
+
+/* change the sorting between by name and by time */
+static gdouble bench_sort(FmDesktop* desktop, GRand* rand, int round)
+{
+    GTimer* timer = g_timer_new();
+    gdouble elapsed;
+    gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(model),
+                                         (round % 2) ? COL_FILE_MTIME : COL_FILE_NAME,
+                                         GTK_SORT_ASCENDING);
+    layout_items(desktop);
+    paint_damage(desktop);
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+    wait_idle(desktop);
+    return elapsed;
+}
+
+static gdouble load_wallpaper(FmDesktop* desktop, int round)
+{
+    GTimer* timer = g_timer_new();
+    gdouble elapsed;
+    app_config->wallpaper_mode = (round % 2) ? FM_WP_FIT : FM_WP_STRETCH;
+    update_background(desktop);
+    wait_idle(desktop);
+    paint_damage(desktop);
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+    return elapsed;
+}
+
+/* the scaled image is loaded from the disk cache */
+static gdouble bench_wallpaper(FmDesktop* desktop, GRand* rand, int round)
+{
+    /* fill the cache for both of the modes first */
+    if(round == 0)
+    {
+        load_wallpaper(desktop, 0);
+        load_wallpaper(desktop, 1);
+    }
+    return load_wallpaper(desktop, round);
+}
+
+/* the image is decoded and scaled again */
+static gdouble bench_wallpaper_cold(FmDesktop* desktop, GRand* rand, int round)
+{
+    char* profile_dir = pcmanfm_get_profile_dir(FALSE);
+    char* cache_dir = g_build_filename(profile_dir, "wallpaper-cache", NULL);
+    remove_dir(cache_dir, TRUE);
+    g_free(cache_dir);
+    g_free(profile_dir);
+    return load_wallpaper(desktop, round);
+}
+
+/* upload the wallpaper to a pixmap like draw_pixbuf_centered() does, with
+ * MIT-SHM or with gdk_draw_pixbuf() used before it. gdk_flush() waits for
+ * the X server, so the time it takes is included. */
+static gdouble upload_wallpaper(FmDesktop* desktop, int round, gboolean use_shm)
+{
+    GdkWindow* window = gtk_widget_get_window(GTK_WIDGET(desktop));
+    GdkPixmap* pixmap;
+    GTimer* timer;
+    gdouble elapsed;
+    gboolean done = FALSE;
+
+    if(!upload_pix)
+        upload_pix = gdk_pixbuf_new_from_file(wallpaper_file, NULL);
+    pixmap = gdk_pixmap_new(window, gdk_pixbuf_get_width(upload_pix),
+                            gdk_pixbuf_get_height(upload_pix), -1);
+    timer = g_timer_new();
+#ifdef HAVE_XSHM
+    if(use_shm)
+        done = upload_pixbuf_shm(pixmap, desktop->gc, upload_pix, 0, 0);
+#endif
+    if(!done)
+    {
+        if(use_shm && round == 0)
+            g_printerr("warning: MIT-SHM cannot be used, gdk_draw_pixbuf() is timed instead\n");
+        gdk_draw_pixbuf(pixmap, desktop->gc, upload_pix, 0, 0, 0, 0, -1, -1,
+                        GDK_RGB_DITHER_NORMAL, 0, 0);
+    }
+    gdk_flush();
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+    g_object_unref(pixmap);
+    return elapsed;
+}
+
+static gdouble bench_upload_gdk(FmDesktop* desktop, GRand* rand, int round)
+{
+    return upload_wallpaper(desktop, round, FALSE);
+}
+
+static gdouble bench_upload_shm(FmDesktop* desktop, GRand* rand, int round)
+{
+    return upload_wallpaper(desktop, round, TRUE);
+}
+
+/* the images of the slideshow are copies of the wallpaper, which are
+ * decoded separately since their names are different. */
+static void start_slideshow(FmDesktop* desktop)
+{
+    char* dir = g_build_filename(home_dir, "slideshow", NULL);
+    char* data;
+    gsize len;
+    int i;
+
+    g_mkdir_with_parents(dir, 0700);
+    if(g_file_get_contents(wallpaper_file, &data, &len, NULL))
+    {
+        for(i = 0; i < 3; ++i)
+        {
+            char* name = g_strdup_printf("%d.png", i);
+            char* file = g_build_filename(dir, name, NULL);
+            g_file_set_contents(file, data, len, NULL);
+            g_free(file);
+            g_free(name);
+        }
+        g_free(data);
+    }
+    g_free(app_config->slideshow_dir);
+    app_config->slideshow_dir = dir;
+    app_config->slideshow = TRUE;
+    app_config->wallpaper_mode = FM_WP_FIT;
+    update_slideshow();
+    update_background(desktop);
+    wait_idle(desktop);
+}
+
+/* go to the next image of the slideshow twice in a row, so the second
+ * one is still being preloaded when it's wanted. the image shown is
+ * checked, since use_preloaded_wallpaper() once showed the image after
+ * it and freed the request of the monitor while it was still used. */
+static gdouble bench_slideshow(FmDesktop* desktop, GRand* rand, int round)
+{
+    FmDesktopMonitor* mon;
+    GTimer* timer;
+    gdouble elapsed;
+    int i;
+
+    if(round == 0)
+        start_slideshow(desktop);
+    timer = g_timer_new();
+    for(i = 0; i < 2; ++i)
+    {
+        slideshow_pos = (slideshow_pos + 1) % n_slideshow_files;
+        update_background(desktop);
+    }
+    wait_idle(desktop);
+    paint_damage(desktop);
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+
+    mon = (FmDesktopMonitor*)g_ptr_array_index(desktop->monitors, 0);
+    if(n_slideshow_files < 3 || g_strcmp0(mon->wallpaper, slideshow_files[slideshow_pos]) != 0
+       || !mon->wallpaper_pix)
+    {
+        g_printerr("error: %s is shown instead of image %u of the slideshow\n",
+                   mon->wallpaper, slideshow_pos);
+        ++n_errors;
+    }
+    return elapsed;
+}
+
+static const Scenario scenarios[] =
+{
+    { "layout", bench_layout },
+    { "expose-full", bench_expose_full },
+    { "expose-cold", bench_expose_cold },
+    { "expose-partial", bench_expose_partial },
+    { "hit-test-x1000", bench_hit_test },
+    { "rubber-band", bench_rubber_band },
+    { "sort", bench_sort },
+    { "wallpaper", bench_wallpaper },
+    { "wallpaper-cold", bench_wallpaper_cold },
+    { "upload-gdk", bench_upload_gdk },
+    { "upload-shm", bench_upload_shm },
+    { "slideshow", bench_slideshow }
+};
+
+/* a gradient, so the image is not trivial to decode and scale */
+static gboolean create_wallpaper()
+{
+    GdkPixbuf* pix = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, 1920, 1080);
+    guchar* pixels = gdk_pixbuf_get_pixels(pix);
+    int rowstride = gdk_pixbuf_get_rowstride(pix);
+    gboolean ret;
+    int x, y;
+
+    for( y = 0; y < 1080; ++y )
+    {
+        guchar* p = pixels + y * rowstride;
+        for( x = 0; x < 1920; ++x, p += 3 )
+        {
+            p[0] = x * 255 / 1919;
+            p[1] = y * 255 / 1079;
+            p[2] = (x ^ y) & 0xff;
+        }
+    }
+    wallpaper_file = g_build_filename(home_dir, "wallpaper.png", NULL);
+    ret = gdk_pixbuf_save(pix, wallpaper_file, "png", NULL, NULL);
+    g_object_unref(pix);
+    return ret;
+}
+
+/* reset the peak RSS if the kernel supports it (Linux 4.0 and later).
+ * otherwise the peak of the whole process is reported. */
+static void reset_peak_rss()
+{
+    FILE* f = fopen("/proc/self/clear_refs", "w");
+    if(f)
+    {
+        fputs("5", f);
+        fclose(f);
+    }
+}
+
+/* in kB */
+static long get_peak_rss()
+{
+    struct rusage usage;
+    FILE* f = fopen("/proc/self/status", "r");
+    if(f)
+    {
+        char line[256];
+        long kb = -1;
+        while(fgets(line, sizeof(line), f))
+        {
+            if(sscanf(line, "VmHWM: %ld kB", &kb) == 1)
+                break;
+        }
+        fclose(f);
+        if(kb >= 0)
+            return kb;
+    }
+    if(getrusage(RUSAGE_SELF, &usage) == 0)
+        return usage.ru_maxrss;
+    return -1;
+}
+
+static void dump_frame(FmDesktop* desktop, int n_files, const char* scenario)
+{
+    GdkPixbuf* pix;
+    int width, height;
+    char* file;
+    char* name;
+    GError* err = NULL;
+
+    if(!desktop->backbuffer)
+        return;
+    gdk_drawable_get_size(desktop->backbuffer, &width, &height);
+    pix = gdk_pixbuf_get_from_drawable(NULL, desktop->backbuffer, NULL,
+                                       0, 0, 0, 0, width, height);
+    if(!pix)
+        return;
+    name = g_strdup_printf("%d-%s.png", n_files, scenario);
+    file = g_build_filename(dump_dir, name, NULL);
+    if(!gdk_pixbuf_save(pix, file, "png", &err, NULL))
+    {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+    }
+    g_free(file);
+    g_free(name);
+    g_object_unref(pix);
+}
+
+static int compare_doubles(gconstpointer a, gconstpointer b)
+{
+    gdouble x = *(const gdouble*)a, y = *(const gdouble*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void print_time(gdouble t)
+{
+    if(t < 0.001)
+        g_print(" %9.1f us", t * 1e6);
+    else
+        g_print(" %9.2f ms", t * 1e3);
+}
+
+static void print_result(int n_files, const char* name, gdouble* samples, int n, long peak_rss)
+{
+    int p99 = (n * 99 + 99) / 100 - 1;
+    qsort(samples, n, sizeof(gdouble), compare_doubles);
+    g_print("%8d  %-16s", n_files, name);
+    print_time(samples[(n - 1) / 2]);
+    print_time(samples[MIN(p99, n - 1)]);
+    g_print(" %10ld kB\n", peak_rss);
+}
+
+static void run_benchmark(int n_files)
+{
+    FmDesktop* desktop;
+    gdouble* samples = g_new(gdouble, n_rounds);
+    guint i;
+
+    populate_desktop(n_files);
+    fm_desktop_manager_init();
+    while(!fm_folder_model_get_is_loaded(model))
+        gtk_main_iteration();
+    desktop = FM_DESKTOP(desktops[0]);
+    wait_idle(desktop);
+    paint_damage(desktop);
+    wait_idle(desktop);
+
+    if(desktop->items->len != (guint)n_files)
+        g_printerr("warning: %u of %d files are on the desktop\n", desktop->items->len, n_files);
+
+    for( i = 0; i < G_N_ELEMENTS(scenarios); ++i )
+    {
+        GRand* rand = g_rand_new_with_seed(seed);
+        int round;
+        reset_peak_rss();
+        for( round = 0; round < n_rounds; ++round )
+            samples[round] = scenarios[i].run(desktop, rand, round);
+        print_result(n_files, scenarios[i].name, samples, n_rounds, get_peak_rss());
+        if(dump_dir)
+            dump_frame(desktop, n_files, scenarios[i].name);
+        g_rand_free(rand);
+    }
+
+    /* restore the settings changed by the scenarios for the next size */
+    app_config->wallpaper_mode = FM_WP_COLOR;
+    app_config->slideshow = FALSE;
+    update_slideshow();
+    fm_desktop_manager_finalize();
+    while(gtk_events_pending())
+        gtk_main_iteration();
+    g_free(samples);
+}
+
+int main(int argc, char** argv)
+{
+    FmConfig* config;
+    GError* err = NULL;
+    char** sizes;
+    int i;
+
+    if(!setup_home())
+    {
+        g_printerr("cannot create a temporary folder\n");
+        return 1;
+    }
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    if(!g_thread_supported())
+        g_thread_init(NULL);
+#endif
+    if(!gtk_init_with_args(&argc, &argv, "- benchmark of the desktop", opt_entries, NULL, &err))
+    {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        return 1;
+    }
+    if(n_rounds < 1)
+        n_rounds = 1;
+    if(dump_dir)
+        g_mkdir_with_parents(dump_dir, 0755);
+
+    config = fm_app_config_new();
+    fm_gtk_init(config);
+
+    if(!create_wallpaper())
+    {
+        g_printerr("cannot create the wallpaper\n");
+        return 1;
+    }
+    app_config->wallpaper = g_strdup(wallpaper_file);
+    app_config->wallpaper_mode = FM_WP_COLOR;
+
+    g_print("   files  scenario                 p50          p99     peak RSS\n");
+    sizes = g_strsplit(sizes_arg ? sizes_arg : "100,1000,10000,50000", ",", 0);
+    for( i = 0; sizes[i]; ++i )
+    {
+        int n_files = atoi(sizes[i]);
+        if(n_files > 0)
+            run_benchmark(n_files);
+    }
+    g_strfreev(sizes);
+
+    fm_gtk_finalize();
+    g_object_unref(config);
+
+    remove_dir(home_dir, TRUE);
+    g_free(home_dir);
+    g_free(desktop_dir);
+    g_free(wallpaper_file);
+    if(upload_pix)
+        g_object_unref(upload_pix);
+    return n_errors > 0 ? 1 : 0;
+}
@@ -0,0 +1,120 @@
+/*
+ *      desktop-clock.c
+ *
+ *      Copyright 2010 Hong Jen Yee (PCMan) <pcman.tw@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+/* A desktop module showing the time at the top right corner of the screen */
+
+#include "desktop-module.h"
+
+#include <gmodule.h>
+#include <string.h>
+#include <time.h>
+
+#define CLOCK_FONT      "Sans Bold 28"
+#define CLOCK_MARGIN    24
+
+typedef struct _Clock Clock;
+struct _Clock
+{
+    FmDesktopLayer* layer;
+    PangoLayout* pl;
+    char text[16];
+};
+
+static gboolean format_time(Clock* clock)
+{
+    char text[16];
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    strftime(text, sizeof(text), "%H:%M", &tm);
+    if(strcmp(text, clock->text) == 0)
+        return FALSE;
+    strcpy(clock->text, text);
+    return TRUE;
+}
+
+static void update_geometry(Clock* clock)
+{
+    GtkWidget* desktop = fm_desktop_layer_get_desktop(clock->layer);
+    GdkScreen* screen = gtk_widget_get_screen(desktop);
+    GdkRectangle rect;
+    PangoRectangle rc;
+
+    pango_layout_set_text(clock->pl, clock->text, -1);
+    pango_layout_get_pixel_extents(clock->pl, NULL, &rc);
+    /* 2 pixels for the shadow */
+    rect.width = rc.width + 2;
+    rect.height = rc.height + 2;
+    rect.x = gdk_screen_get_width(screen) - rect.width - CLOCK_MARGIN;
+    rect.y = CLOCK_MARGIN;
+    fm_desktop_layer_set_geometry(clock->layer, &rect);
+}
+
+static gpointer clock_new(FmDesktopLayer* layer)
+{
+    Clock* clock = g_slice_new0(Clock);
+    PangoFontDescription* font;
+
+    clock->layer = layer;
+    clock->pl = gtk_widget_create_pango_layout(fm_desktop_layer_get_desktop(layer), NULL);
+    font = pango_font_description_from_string(CLOCK_FONT);
+    pango_layout_set_font_description(clock->pl, font);
+    pango_font_description_free(font);
+    format_time(clock);
+    update_geometry(clock);
+    return clock;
+}
+
+static void clock_free(gpointer data)
+{
+    Clock* clock = (Clock*)data;
+    g_object_unref(clock->pl);
+    g_slice_free(Clock, clock);
+}
+
+static void clock_paint(gpointer data, cairo_t* cr, const GdkRectangle* area)
+{
+    Clock* clock = (Clock*)data;
+    cairo_set_source_rgba(cr, 0, 0, 0, 0.6);
+    cairo_move_to(cr, 2, 2);
+    pango_cairo_show_layout(cr, clock->pl);
+    cairo_set_source_rgb(cr, 1, 1, 1);
+    cairo_move_to(cr, 0, 0);
+    pango_cairo_show_layout(cr, clock->pl);
+}
+
+static void clock_update(gpointer data)
+{
+    Clock* clock = (Clock*)data;
+    /* the layer is only painted again when the minute is changed */
+    if(format_time(clock))
+        update_geometry(clock);
+}
+
+G_MODULE_EXPORT FmDesktopModuleInfo fm_desktop_module_info =
+{
+    FM_DESKTOP_MODULE_VERSION,
+    clock_new,
+    clock_free,
+    clock_paint,
+    clock_update,
+    1000
+};
@@ -0,0 +1,341 @@
+/*
+ *      desktop-module.c
+ *
+ *      Copyright 2010 Hong Jen Yee (PCMan) <pcman.tw@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "desktop-module.h"
+
+#include <gmodule.h>
+#include <string.h>
+
+/*
+ * The layers are painted in an idle handler run right before the
+ * desktop is repainted, so the changes of the layers get to the screen
+ * in the same frame. The painting of every layer is timed, and if a
+ * module takes longer than its budget for a frame, the layer is not
+ * painted again until some multiple of that time has passed, so a slow
+ * module gets a bounded share of the main loop. Input events have higher
+ * priority than the idle handler, but paint() runs in the main thread and
+ * cannot be interrupted, so an event arriving during a paint waits for it.
+ * To bound that wait, a layer whose paint takes longer than MAX_PAINT_TIME
+ * even once is not painted any more. It keeps showing its last content
+ * until its geometry is changed, and is empty after that.
+ */
+
+#define FRAME_BUDGET        0.004 /* seconds a layer may take per frame */
+#define THROTTLE_FACTOR     4 /* a slow layer gets at most 1/4 of the time */
+#define MAX_PAINT_TIME      0.1 /* seconds, a slower layer is disabled */
+#define PAINT_PRIORITY      (GDK_PRIORITY_REDRAW - 15) /* before the desktop */
+
+typedef struct _FmDesktopModule FmDesktopModule;
+struct _FmDesktopModule
+{
+    char* name;
+    GModule* gmod;
+    FmDesktopModuleInfo* info;
+};
+
+struct _FmDesktopLayer
+{
+    FmDesktopModule* module;
+    gpointer data; /* returned by module->info->new_widget() */
+    GtkWidget* desktop;
+    FmDesktopRedrawFunc redraw;
+    GdkRectangle geometry;
+    cairo_surface_t* surface; /* content of the layer painted last time */
+    GdkRegion* damage; /* area to be painted, NULL if none */
+    guint update_timeout;
+    double not_before; /* the layer is throttled until this time */
+    gboolean warned : 1; /* the module is reported to be slow */
+    gboolean disabled : 1; /* too slow, the layer is not painted any more */
+};
+
+static GSList* modules = NULL;
+static GSList* all_layers = NULL;
+static guint paint_idle = 0;
+static guint paint_timeout = 0;
+static GTimer* layer_timer = NULL;
+
+void fm_desktop_modules_load(char** names)
+{
+    char* dir;
+    if(!names || !g_module_supported())
+        return;
+    dir = g_build_filename(PACKAGE_LIB_DIR, "desktop", NULL);
+    for(; *names; ++names)
+    {
+        FmDesktopModule* module;
+        FmDesktopModuleInfo* info;
+        GModule* gmod;
+        char* path;
+
+        if(!**names || strchr(*names, '/'))
+            continue;
+        path = g_build_filename(dir, *names, NULL);
+        gmod = g_module_open(path, G_MODULE_BIND_LAZY | G_MODULE_BIND_LOCAL);
+        g_free(path);
+        if(!gmod)
+        {
+            g_warning("failed to load desktop module %s: %s", *names, g_module_error());
+            continue;
+        }
+        if(!g_module_symbol(gmod, FM_DESKTOP_MODULE_INFO_SYMBOL, (gpointer*)&info)
+           || !info || info->version != FM_DESKTOP_MODULE_VERSION)
+        {
+            g_warning("%s is not a desktop module of version %d", *names, FM_DESKTOP_MODULE_VERSION);
+            g_module_close(gmod);
+            continue;
+        }
+        module = g_slice_new(FmDesktopModule);
+        module->name = g_strdup(*names);
+        module->gmod = gmod;
+        module->info = info;
+        modules = g_slist_append(modules, module);
+    }
+    g_free(dir);
+}
+
+void fm_desktop_modules_unload(void)
+{
+    GSList* l;
+    /* the layers are freed by the desktops before this */
+    for(l = modules; l; l = l->next)
+    {
+        FmDesktopModule* module = (FmDesktopModule*)l->data;
+        g_module_close(module->gmod);
+        g_free(module->name);
+        g_slice_free(FmDesktopModule, module);
+    }
+    g_slist_free(modules);
+    modules = NULL;
+    if(layer_timer)
+    {
+        g_timer_destroy(layer_timer);
+        layer_timer = NULL;
+    }
+}
+
+static gboolean on_update_timeout(FmDesktopLayer* layer)
+{
+    layer->module->info->update(layer->data);
+    return TRUE;
+}
+
+GSList* fm_desktop_layers_new(GtkWidget* desktop, FmDesktopRedrawFunc redraw)
+{
+    GSList* layers = NULL, *l;
+    for(l = modules; l; l = l->next)
+    {
+        FmDesktopModule* module = (FmDesktopModule*)l->data;
+        FmDesktopLayer* layer = g_slice_new0(FmDesktopLayer);
+        layer->module = module;
+        layer->desktop = desktop;
+        layer->redraw = redraw;
+        layer->data = module->info->new_widget(layer);
+        if(module->info->update && module->info->update_interval)
+            layer->update_timeout = g_timeout_add(module->info->update_interval,
+                                                  (GSourceFunc)on_update_timeout, layer);
+        layers = g_slist_append(layers, layer);
+        all_layers = g_slist_prepend(all_layers, layer);
+    }
+    return layers;
+}
+
+void fm_desktop_layers_free(GSList* layers)
+{
+    GSList* l;
+    for(l = layers; l; l = l->next)
+    {
+        FmDesktopLayer* layer = (FmDesktopLayer*)l->data;
+        if(layer->update_timeout)
+            g_source_remove(layer->update_timeout);
+        if(layer->module->info->free_widget)
+            layer->module->info->free_widget(layer->data);
+        if(layer->surface)
+            cairo_surface_destroy(layer->surface);
+        if(layer->damage)
+            gdk_region_destroy(layer->damage);
+        all_layers = g_slist_remove(all_layers, layer);
+        g_slice_free(FmDesktopLayer, layer);
+    }
+    g_slist_free(layers);
+    if(!all_layers)
+    {
+        if(paint_idle)
+        {
+            g_source_remove(paint_idle);
+            paint_idle = 0;
+        }
+        if(paint_timeout)
+        {
+            g_source_remove(paint_timeout);
+            paint_timeout = 0;
+        }
+    }
+}
+
+void fm_desktop_layers_paint(GSList* layers, cairo_t* cr, const GdkRectangle* area)
+{
+    for(; layers; layers = layers->next)
+    {
+        FmDesktopLayer* layer = (FmDesktopLayer*)layers->data;
+        if(!layer->surface || !gdk_rectangle_intersect(area, &layer->geometry, NULL))
+            continue;
+        cairo_save(cr);
+        cairo_set_source_surface(cr, layer->surface, layer->geometry.x, layer->geometry.y);
+        gdk_cairo_rectangle(cr, &layer->geometry);
+        cairo_fill(cr);
+        cairo_restore(cr);
+    }
+}
+
+/* paint the damaged area of the layer, returns the time it takes */
+static double paint_layer(FmDesktopLayer* layer)
+{
+    GdkRegion* damage = layer->damage;
+    GdkRectangle area;
+    cairo_t* cr;
+    double start = g_timer_elapsed(layer_timer, NULL);
+
+    layer->damage = NULL;
+    gdk_region_get_clipbox(damage, &area);
+    cr = cairo_create(layer->surface);
+    gdk_cairo_region(cr, damage);
+    cairo_clip(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+    cairo_paint(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+    layer->module->info->paint(layer->data, cr, &area);
+    cairo_destroy(cr);
+    gdk_region_destroy(damage);
+
+    area.x += layer->geometry.x;
+    area.y += layer->geometry.y;
+    layer->redraw(layer->desktop, &area);
+    return g_timer_elapsed(layer_timer, NULL) - start;
+}
+
+static void queue_paint(void);
+
+static gboolean on_paint_timeout(gpointer user_data)
+{
+    paint_timeout = 0;
+    queue_paint();
+    return FALSE;
+}
+
+static gboolean on_paint_idle(gpointer user_data)
+{
+    GSList* l;
+    double wait = -1;
+
+    paint_idle = 0;
+    for(l = all_layers; l; l = l->next)
+    {
+        FmDesktopLayer* layer = (FmDesktopLayer*)l->data;
+        double now, elapsed;
+        if(!layer->damage)
+            continue;
+        now = g_timer_elapsed(layer_timer, NULL);
+        if(layer->not_before > now)
+        {
+            if(wait < 0 || layer->not_before - now < wait)
+                wait = layer->not_before - now;
+            continue;
+        }
+        elapsed = paint_layer(layer);
+        if(elapsed > MAX_PAINT_TIME)
+        {
+            g_warning("desktop module %s takes %.1f ms to paint, it's disabled",
+                      layer->module->name, elapsed * 1000);
+            layer->disabled = TRUE;
+        }
+        else if(elapsed > FRAME_BUDGET)
+        {
+            layer->not_before = now + elapsed * THROTTLE_FACTOR;
+            if(!layer->warned)
+            {
+                g_warning("desktop module %s takes %.1f ms to paint, it's throttled",
+                          layer->module->name, elapsed * 1000);
+                layer->warned = TRUE;
+            }
+        }
+    }
+    /* paint the throttled layers later */
+    if(wait >= 0 && !paint_timeout)
+        paint_timeout = g_timeout_add((guint)(wait * 1000) + 1, on_paint_timeout, NULL);
+    return FALSE;
+}
+
+static void queue_paint(void)
+{
+    if(!paint_idle)
+        paint_idle = g_idle_add_full(PAINT_PRIORITY, on_paint_idle, NULL, NULL);
+}
+
+GtkWidget* fm_desktop_layer_get_desktop(FmDesktopLayer* layer)
+{
+    return layer->desktop;
+}
+
+void fm_desktop_layer_set_geometry(FmDesktopLayer* layer, const GdkRectangle* rect)
+{
+    if(layer->surface)
+    {
+        layer->redraw(layer->desktop, &layer->geometry);
+        cairo_surface_destroy(layer->surface);
+        layer->surface = NULL;
+    }
+    if(layer->damage)
+    {
+        gdk_region_destroy(layer->damage);
+        layer->damage = NULL;
+    }
+    layer->geometry = *rect;
+    if(rect->width > 0 && rect->height > 0)
+    {
+        layer->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, rect->width, rect->height);
+        fm_desktop_layer_invalidate(layer, NULL);
+    }
+}
+
+void fm_desktop_layer_get_geometry(FmDesktopLayer* layer, GdkRectangle* rect)
+{
+    *rect = layer->geometry;
+}
+
+void fm_desktop_layer_invalidate(FmDesktopLayer* layer, const GdkRectangle* rect)
+{
+    GdkRectangle area = {0, 0, layer->geometry.width, layer->geometry.height};
+    if(!layer->surface || layer->disabled)
+        return;
+    if(rect && !gdk_rectangle_intersect(&area, rect, &area))
+        return;
+    if(layer->damage)
+        gdk_region_union_with_rect(layer->damage, &area);
+    else
+        layer->damage = gdk_region_rectangle(&area);
+    if(G_UNLIKELY(!layer_timer))
+        layer_timer = g_timer_new();
+    queue_paint();
+}
@@ -0,0 +1,95 @@
+/*
+ *      desktop-module.h
+ *
+ *      Copyright 2010 Hong Jen Yee (PCMan) <pcman.tw@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __DESKTOP_MODULE_H__
+#define __DESKTOP_MODULE_H__
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Desktop painting modules.
+ * A module is a shared object in PACKAGE_LIB_DIR/desktop which exports
+ * an FmDesktopModuleInfo named fm_desktop_module_info. It's only loaded
+ * if its name is listed in the "modules" key of the [desktop] section of
+ * the config file. The module draws a widget, such as a clock, on a layer
+ * of every desktop. The layers are painted in the main loop apart from
+ * the desktop icons, and a module painting too slowly is throttled.
+ * paint() is called in the main thread, so it should be fast: a module
+ * whose paint takes more than 100 ms is disabled.
+ */
+
+#define FM_DESKTOP_MODULE_VERSION       1
+#define FM_DESKTOP_MODULE_INFO_SYMBOL   "fm_desktop_module_info"
+
+typedef struct _FmDesktopLayer      FmDesktopLayer;
+typedef struct _FmDesktopModuleInfo FmDesktopModuleInfo;
+
+struct _FmDesktopModuleInfo
+{
+    int version; /* FM_DESKTOP_MODULE_VERSION */
+    /* create the widget shown on the layer, returns the data passed
+     * to the other functions. */
+    gpointer (*new_widget)(FmDesktopLayer* layer);
+    void (*free_widget)(gpointer data);
+    /* paint the damaged area of the layer. cr is in the coordinates of
+     * the layer, clipped to the damage, which is cleared already. */
+    void (*paint)(gpointer data, cairo_t* cr, const GdkRectangle* area);
+    /* called every update_interval milliseconds if it's not 0 */
+    void (*update)(gpointer data);
+    guint update_interval;
+};
+
+/* the desktop window the layer is shown on */
+GtkWidget* fm_desktop_layer_get_desktop(FmDesktopLayer* layer);
+
+/* set the area covered by the layer, in the coordinates of the desktop.
+ * the whole layer needs to be painted again after this. */
+void fm_desktop_layer_set_geometry(FmDesktopLayer* layer, const GdkRectangle* rect);
+
+void fm_desktop_layer_get_geometry(FmDesktopLayer* layer, GdkRectangle* rect);
+
+/* queue a repaint of rect in the coordinates of the layer, or of the
+ * whole layer if rect is NULL. */
+void fm_desktop_layer_invalidate(FmDesktopLayer* layer, const GdkRectangle* rect);
+
+/* the functions below are used by FmDesktop */
+
+typedef void (*FmDesktopRedrawFunc)(GtkWidget* desktop, const GdkRectangle* rect);
+
+/* load the modules of the names in the NULL-terminated array */
+void fm_desktop_modules_load(char** names);
+
+void fm_desktop_modules_unload(void);
+
+/* create a layer of every loaded module for the desktop. redraw is
+ * called when the content of a layer is changed. */
+GSList* fm_desktop_layers_new(GtkWidget* desktop, FmDesktopRedrawFunc redraw);
+
+void fm_desktop_layers_free(GSList* layers);
+
+/* draw the layers on the desktop, as they were painted last time */
+void fm_desktop_layers_paint(GSList* layers, cairo_t* cr, const GdkRectangle* area);
+
+G_END_DECLS
+
+#endif
@@ -19,9 +19,14 @@
  *      MA 02110-1301, USA.
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
 #include "desktop.h"
 #include "pcmanfm.h"
 #include "app-config.h"
+#include "thumb.h"
 
 #include <glib/gi18n.h>
 
@@ -29,10 +34,31 @@
 #include <gdk/gdkkeysyms.h>
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
+#include <fontconfig/fontconfig.h>
 #include <math.h>
+#include <unistd.h>
+
+#ifdef HAVE_XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
+#ifdef HAVE_XRENDER
+#include <X11/extensions/Xrender.h>
+#endif
+#ifdef HAVE_XSS
+#include <X11/extensions/scrnsaver.h>
+#endif
+#ifdef HAVE_XCB
+#include <X11/Xlib-xcb.h>
+#include <stdlib.h>
+#endif
 
 #include "pref.h"
 #include "main-win.h"
+#include "wallpaper.h"
+#include "icon-variant.h"
+#include "desktop-module.h"
 
 #include "gseal-gtk-compat.h"
 
@@ -40,37 +66,193 @@
 #define PADDING 6
 #define MARGIN  2
 
+/* the damaged region is simplified to its bounding box when it gets more
+ * rects than this, so invalidating many items stays cheap. */
+#define MAX_DAMAGE_RECTS        64
+
+/* delay before reading _NET_WORKAREA again after it's changed, in ms */
+#define WORKING_AREA_DELAY      100
+
+/* when more items than this need to be rendered in one repaint, they are
+ * rendered in parallel by the worker threads instead, if pango can be
+ * used by them. see can_render_in_threads(). */
+#define ASYNC_RENDER_THRESHOLD  16
+
+/* time budget of a layout pass run in idle handler, in seconds */
+#define LAYOUT_TIME_SLICE       0.008
+/* number of items laid out between checks of the time budget */
+#define LAYOUT_CHECK_INTERVAL   32
+
+/* states of the pre-rendered images of an item */
+enum
+{
+    ITEM_STATE_NORMAL,
+    ITEM_STATE_SELECTED, /* selected or drop-highlighted */
+    N_ITEM_STATES
+};
+
+typedef struct _ItemRenderJob ItemRenderJob;
+
 struct _FmDesktopItem
 {
     GtkTreeIter it;
     FmFileInfo* fi;
     GdkPixbuf* icon;
+    FmIcon* icon_src; /* the icon of fi which icon is loaded from */
+    FmThumbRequest* thumb_req; /* the thumbnail being loaded, see update_item_thumbnail() */
+    time_t thumb_mtime; /* mtime of the file the thumbnail is made for */
+    int thumb_size; /* size of the thumbnail */
+    PangoLayout* pl; /* shaped text label, see get_item_layout() */
+    const char* pl_name; /* display name the label is shaped for */
+    char* search_key; /* case-folded display name, see get_search_key() */
+    guint pl_stamp; /* value of desktop->text_stamp when the label is shaped */
+    PangoRectangle text_extents; /* logical extents of the label in pixels */
+    cairo_surface_t* surfaces[N_ITEM_STATES]; /* pre-rendered images, see paint_item() */
+    ItemRenderJob* render_jobs[N_ITEM_STATES]; /* images being rendered by the workers */
+    cairo_surface_t* stale_surface; /* the last image, shown until a new one is rendered */
+    guint surface_stamp; /* value of desktop->surface_stamp when rendered */
+    int surface_w; /* size of the pre-rendered images */
+    int surface_h;
+    guint index; /* position of the item in desktop->items and the model */
+    GList fixed_link; /* link of the item in desktop->fixed_items */
+    GList sel_link; /* link of the item in desktop->selected */
     int x; /* position of the item on the desktop */
     int y;
+    int slot; /* layout cell of an auto-placed item, see layout_items_step() */
+    FmDesktopStack* stack; /* the stack the item is collapsed into, or NULL */
+    guint8 stack_kind; /* the stack the item belongs to, see get_stack_kind() */
     GdkRectangle icon_rect;
     GdkRectangle text_rect;
+    guint z; /* stacking order, items painted later have greater z */
+    guint grid_stamp; /* used to visit an item only once in grid queries */
+    int grid_col; /* range of grid cells the item is stored in */
+    int grid_row;
+    int grid_ncols;
+    int grid_nrows;
     gboolean is_special : 1; /* is this a special item like "My Computer", mounted volume, or "Trash" */
     gboolean is_mount : 1; /* is this a mounted volume*/
     gboolean is_selected : 1;
     gboolean is_prelight : 1;
     gboolean fixed_pos : 1;
+    gboolean icon_pending : 1; /* the icon is to be loaded again, see on_idle_load_icons() */
+    gboolean materialized : 1; /* the icon is loaded and the label is shaped, see calc_item_size() */
+    gboolean in_overlay : 1; /* the item is shown in the overlay of its expanded stack */
+    gboolean has_thumbnail : 1; /* icon is the thumbnail of the file */
+    gboolean thumb_failed : 1; /* no thumbnail can be made for the file */
+};
+
+/* A stack collects the auto-placed items which don't fit in the working
+ * area, see layout_items_step(). It's shown as a single icon, and the
+ * items are laid out only when it's expanded, see layout_overlay(). */
+struct _FmDesktopStack
+{
+    GPtrArray* items; /* FmDesktopItem*, in the order of the model */
+    int x; /* position of the stack on the desktop */
+    int y;
+    GdkRectangle icon_rect;
+    GdkRectangle text_rect;
+    GdkPixbuf* icon;
+    PangoLayout* pl;
+};
+
+/* a monitor of the screen, see update_monitors() */
+struct _FmDesktopMonitor
+{
+    FmDesktop* desktop;
+    int num; /* the number of the monitor in GdkScreen */
+    char* name; /* the name of the output, NULL if it's unknown */
+    GdkRectangle geometry;
+    GdkRectangle working_area; /* the part of desktop->working_area on the monitor */
+    /* the wallpaper shown or being loaded, and the color around it */
+    char* wallpaper;
+    FmWallpaperMode wallpaper_mode;
+    GdkColor wallpaper_bg;
+    FmWallpaperRequest* wallpaper_req;
+    GdkPixbuf* wallpaper_pix; /* NULL if it's a color */
+    /* the next image of the slideshow, see preload_wallpaper() */
+    char* next_wallpaper;
+    FmWallpaperMode next_mode;
+    GdkColor next_bg;
+    FmWallpaperRequest* next_req;
+    GdkPixbuf* next_pix;
+    gboolean primary : 1;
+    gboolean need_redraw : 1; /* the area in wallpaper_pixmap is outdated */
+};
+
+/* layout cells in the working area of a monitor, see update_layout_areas() */
+struct _FmDesktopLayoutArea
+{
+    GdkRectangle rect; /* the working area */
+    int x0; /* position of the first cell */
+    int y0;
+    int cols;
+    int rows;
+    int first_slot; /* the slot of the first cell */
+};
+
+typedef struct
+{
+    const char* title;
+    const char* icon_name;
+}StackKind;
+
+static const StackKind type_stacks[] =
+{
+    {N_("Folders"), "folder"},
+    {N_("Images"), "image-x-generic"},
+    {N_("Music"), "audio-x-generic"},
+    {N_("Videos"), "video-x-generic"},
+    {N_("Documents"), "x-office-document"},
+    {N_("Text Files"), "text-x-generic"},
+    {N_("Applications"), "application-x-executable"},
+    {N_("Other Files"), "unknown"}
+};
+
+static const StackKind date_stacks[] =
+{
+    {N_("Today"), "x-office-calendar"},
+    {N_("Last 7 Days"), "x-office-calendar"},
+    {N_("Last 30 Days"), "x-office-calendar"},
+    {N_("Last Year"), "x-office-calendar"},
+    {N_("Older"), "x-office-calendar"}
 };
 
+#define N_STACKS    G_N_ELEMENTS(type_stacks)
+
+/* space around the items in the overlay of an expanded stack */
+#define OVERLAY_PADDING 12
+
+/* the text typed to find an item is cleared after this many milliseconds */
+#define TYPEAHEAD_TIMEOUT   1500
+
+static inline FmDesktopItem* get_item(FmDesktop* desktop, guint i)
+{
+    return (FmDesktopItem*)g_ptr_array_index(desktop->items, i);
+}
+
 /* static void fm_desktop_finalize              (GObject *object); */
 static void fm_desktop_destroy               (GtkObject *object);
 
 static FmDesktopItem* hit_test(FmDesktop* self, int x, int y);
+static gboolean is_point_in_rect(GdkRectangle* rect, int x, int y);
 static FmDesktopItem* get_nearest_item(FmDesktop* desktop, FmDesktopItem* item, GtkDirectionType dir);
 static void calc_item_size(FmDesktop* desktop, FmDesktopItem* item);
 static void layout_items(FmDesktop* self);
 static void queue_layout_items(FmDesktop* desktop);
+static void queue_layout_items_from(FmDesktop* desktop, guint idx);
 static void paint_item(FmDesktop* self, FmDesktopItem* item, cairo_t* cr, GdkRectangle* expose_area);
 static void redraw_item(FmDesktop* desktop, FmDesktopItem* item);
+static void queue_redraw(FmDesktop* desktop, const GdkRectangle* rect);
+static void queue_redraw_region(FmDesktop* desktop, GdkRegion* region);
 static void calc_rubber_banding_rect(FmDesktop* self, int x, int y, GdkRectangle* rect);
 static void update_rubberbanding(FmDesktop* self, int newx, int newy );
 static void paint_rubber_banding_rect(FmDesktop* self, cairo_t* cr, GdkRectangle* expose_area);
 static void update_background(FmDesktop* desktop);
-static void update_working_area(FmDesktop* desktop);
+static void release_wallpaper(FmDesktop* desktop);
+static gboolean update_working_area(FmDesktop* desktop);
+static gboolean update_monitors(FmDesktop* desktop);
+static void free_monitor(FmDesktopMonitor* mon);
+static GdkRectangle* get_primary_working_area(FmDesktop* desktop);
 static GList* get_selected_items(FmDesktop* desktop, int* n_items);
 static void activate_selected_items(FmDesktop* desktop);
 static void set_focused_item(FmDesktop* desktop, FmDesktopItem* item);
@@ -78,8 +260,36 @@ static void select_all(FmDesktop* desktop);
 static void deselect_all(FmDesktop* desktop);
 
 static FmDesktopItem* desktop_item_new(GtkTreeIter* it);
+static char* get_search_key(const char* name);
+static guint name_index_lower_bound(FmDesktop* desktop, const char* key);
+static void name_index_insert(FmDesktop* desktop, FmDesktopItem* item);
+static void name_index_remove(FmDesktop* desktop, FmDesktopItem* item);
+static gint compare_search_keys(gconstpointer a, gconstpointer b);
 static void desktop_item_free(FmDesktopItem* item);
+static inline void get_item_surface_rect(FmDesktopItem* item, GdkRectangle* rect);
+static void free_item_surfaces(FmDesktopItem* item);
+static GdkPixbuf* get_icon_pixbuf(FmIcon* icon);
+static void update_item_icon(FmDesktop* desktop, FmDesktopItem* item);
+static gboolean update_item_thumbnail(FmDesktop* desktop, FmDesktopItem* item);
+static void cancel_render_jobs(FmDesktopItem* item);
+static void check_item_surfaces(FmDesktop* self, FmDesktopItem* item, GdkRectangle* area);
+static inline int get_item_state(FmDesktop* self, FmDesktopItem* item);
+static gboolean can_render_in_threads();
+static void queue_render_item(FmDesktop* self, FmDesktopItem* item, int state, guint priority);
 static void move_item(FmDesktop* desktop, FmDesktopItem* item, int x, int y, gboolean redraw);
+static void set_item_fixed(FmDesktop* desktop, FmDesktopItem* item, gboolean fixed);
+static void set_item_selected(FmDesktop* desktop, FmDesktopItem* item, gboolean selected);
+static FmDesktopStack* hit_test_stack(FmDesktop* self, int x, int y);
+static void expand_stack(FmDesktop* desktop, FmDesktopStack* stack);
+static void collapse_stack(FmDesktop* desktop);
+static inline void redraw_stack(FmDesktop* desktop, FmDesktopStack* stack);
+static void layout_overlay(FmDesktop* desktop);
+static guint get_overlay_page_size(FmDesktop* desktop);
+
+static void grid_rebuild(FmDesktop* desktop);
+static void grid_free(FmDesktop* desktop);
+static void grid_insert_item(FmDesktop* desktop, FmDesktopItem* item);
+static void grid_remove_item(FmDesktop* desktop, FmDesktopItem* item);
 
 static gboolean on_expose( GtkWidget* w, GdkEventExpose* evt );
 static void on_size_allocate( GtkWidget* w, GtkAllocation* alloc );
@@ -89,6 +299,7 @@ static gboolean on_button_release( GtkWidget* w, GdkEventButton* evt );
 static gboolean on_motion_notify( GtkWidget* w, GdkEventMotion* evt );
 static gboolean on_leave_notify( GtkWidget* w, GdkEventCrossing* evt );
 static gboolean on_key_press( GtkWidget* w, GdkEventKey* evt );
+static gboolean on_scroll( GtkWidget* w, GdkEventScroll* evt );
 static void on_style_set( GtkWidget* w, GtkStyle* prev );
 static void on_direction_changed( GtkWidget* w, GtkTextDirection prev );
 static void on_realize( GtkWidget* w );
@@ -98,7 +309,13 @@ static gboolean on_focus_out( GtkWidget* w, GdkEventFocus* evt );
 static void on_wallpaper_changed(FmConfig* cfg, gpointer user_data);
 static void on_desktop_text_changed(FmConfig* cfg, gpointer user_data);
 static void on_desktop_font_changed(FmConfig* cfg, gpointer user_data);
+static void on_desktop_stacks_changed(FmConfig* cfg, gpointer user_data);
+static void invalidate_text_layouts(FmDesktop* desktop);
 static void on_big_icon_size_changed(FmConfig* cfg, gpointer user_data);
+static void on_show_thumbnail_changed(FmConfig* cfg, gpointer user_data);
+static void on_slideshow_changed(FmConfig* cfg, gpointer user_data);
+static void update_slideshow();
+static void stop_slideshow();
 
 static void on_icon_theme_changed(GtkIconTheme* theme, gpointer user_data);
 
@@ -114,6 +331,8 @@ static void on_drag_data_get(GtkWidget *src_widget, GdkDragContext *drag_context
 
 static GdkFilterReturn on_root_event(GdkXEvent *xevent, GdkEvent *event, gpointer data);
 static void on_screen_size_changed(GdkScreen* screen, FmDesktop* desktop);
+static void on_monitors_changed(GdkScreen* screen, FmDesktop* desktop);
+static gint compare_monitors(gconstpointer a, gconstpointer b, gpointer user_data);
 
 /* popup menus */
 static void on_paste(GtkAction* act, gpointer user_data);
@@ -141,12 +360,21 @@ static gint n_screens = 0;
 static guint wallpaper_changed = 0;
 static guint desktop_text_changed = 0;
 static guint desktop_font_changed = 0;
+static guint desktop_stacks_changed = 0;
 static guint big_icon_size_changed = 0;
+static guint show_thumbnail_changed = 0;
+static guint slideshow_changed = 0;
 static guint icon_theme_changed = 0;
 static GtkAccelGroup* acc_grp = NULL;
 
 static PangoFontDescription* font_desc = NULL;
 
+/* the wallpaper slideshow of all screens, see update_slideshow() */
+static char** slideshow_files = NULL; /* the images in app_config->slideshow_dir */
+static guint n_slideshow_files = 0;
+static guint slideshow_pos = 0; /* the image shown */
+static guint slideshow_timeout = 0;
+
 static FmFolderModel* model = NULL;
 
 static Atom XA_NET_WORKAREA = 0;
@@ -159,6 +387,11 @@ static int desktop_sort_type = GTK_SORT_ASCENDING;
 
 static GdkCursor* hand_cursor = NULL;
 
+static GdkPixbuf* link_emblem = NULL;
+
+/* icons of the items at the current size, shared by all screens */
+static GHashTable* icon_cache = NULL;
+
 enum {
     FM_DND_DEST_DESKTOP_ITEM = N_FM_DND_DEST_DEFAULT_TARGETS + 1
 };
@@ -176,8 +409,19 @@ static GtkWidget* desktop_popup = NULL;
 
 static void desktop_item_free(FmDesktopItem* item)
 {
+    /* the file may be deleted before its thumbnail is done */
+    if(item->thumb_req)
+        fm_thumb_cancel(item->thumb_req);
     if(item->icon)
         g_object_unref(item->icon);
+    if(item->icon_src)
+        fm_icon_unref(item->icon_src);
+    if(item->pl)
+        g_object_unref(item->pl);
+    g_free(item->search_key);
+    free_item_surfaces(item);
+    if(item->stale_surface)
+        cairo_surface_destroy(item->stale_surface);
     g_slice_free(FmDesktopItem, item);
 }
 
@@ -190,12 +434,37 @@ static void fm_desktop_destroy(GtkObject *object)
     screen = gtk_widget_get_screen((GtkWidget*)self);
     gdk_window_remove_filter(gdk_screen_get_root_window(screen), on_root_event, self);
 
-    g_list_foreach(self->items, (GFunc)desktop_item_free, NULL);
-    g_list_free(self->items);
+    fm_desktop_layers_free(self->layers);
+    self->layers = NULL;
+
+    /* the items are linked into the queues through their own links */
+    g_queue_init(&self->fixed_items);
+    g_queue_init(&self->selected);
+    g_hash_table_destroy(self->item_hash);
+    g_ptr_array_free(self->name_index, TRUE);
+    self->name_index = NULL;
+    g_ptr_array_foreach(self->items, (GFunc)desktop_item_free, NULL);
+    g_ptr_array_free(self->items, TRUE);
     self->items = NULL;
+    grid_free(self);
+
+    if(self->stacks)
+    {
+        guint k;
+        for(k = 0; k < N_STACKS; ++k)
+        {
+            FmDesktopStack* stack = &self->stacks[k];
+            g_ptr_array_free(stack->items, TRUE);
+            if(stack->icon)
+                g_object_unref(stack->icon);
+            if(stack->pl)
+                g_object_unref(stack->pl);
+        }
+        g_free(self->stacks);
+        self->stacks = NULL;
+    }
+    self->expanded_stack = NULL;
 
-    g_object_unref(self->icon_render);
-    g_object_unref(self->pl);
 
     g_signal_handlers_disconnect_by_func(model, on_row_inserted, self);
     g_signal_handlers_disconnect_by_func(model, on_row_deleted, self);
@@ -208,6 +477,55 @@ static void fm_desktop_destroy(GtkObject *object)
     if(self->idle_layout)
         g_source_remove(self->idle_layout);
 
+    if(self->idle_icons)
+        g_source_remove(self->idle_icons);
+
+    if(self->typeahead_timeout)
+        g_source_remove(self->typeahead_timeout);
+    if(self->typeahead)
+    {
+        g_string_free(self->typeahead, TRUE);
+        self->typeahead = NULL;
+    }
+
+    release_wallpaper(self);
+    if(self->monitors)
+    {
+        g_ptr_array_foreach(self->monitors, (GFunc)free_monitor, NULL);
+        g_ptr_array_free(self->monitors, TRUE);
+        self->monitors = NULL;
+    }
+
+    if(self->working_area_timeout)
+        g_source_remove(self->working_area_timeout);
+
+    if(self->repaint_idle)
+    {
+        g_source_remove(self->repaint_idle);
+        self->repaint_idle = 0;
+    }
+    if(self->damage)
+    {
+        gdk_region_destroy(self->damage);
+        self->damage = NULL;
+    }
+    if(self->backbuffer)
+    {
+        g_object_unref(self->backbuffer);
+        self->backbuffer = NULL;
+    }
+
+    g_free(self->occupied);
+    self->occupied = NULL;
+    g_free(self->layout_areas);
+    self->layout_areas = NULL;
+
+    if(self->pos_db)
+    {
+        fm_item_pos_db_close(self->pos_db);
+        self->pos_db = NULL;
+    }
+
     G_OBJECT_CLASS(fm_desktop_parent_class)->dispose(object);
 }
 
@@ -215,34 +533,25 @@ static void fm_desktop_init(FmDesktop *self)
 {
     GdkScreen* screen = gtk_widget_get_screen((GtkWidget*)self);
     GdkWindow* root;
-    PangoContext* pc;
     GtkTreeIter it;
     GtkTargetList* targets;
+    guint k;
 
     gtk_window_set_default_size((GtkWindow*)self, gdk_screen_get_width(screen), gdk_screen_get_height(screen));
     gtk_window_move(GTK_WINDOW(self), 0, 0);
     gtk_widget_set_app_paintable((GtkWidget*)self, TRUE);
+    /* the desktop is painted to its own backbuffer, see on_expose() */
+    gtk_widget_set_double_buffered((GtkWidget*)self, FALSE);
     gtk_window_set_type_hint(GTK_WINDOW(self), GDK_WINDOW_TYPE_HINT_DESKTOP);
     gtk_widget_add_events((GtkWidget*)self,
                         GDK_POINTER_MOTION_MASK |
+                        GDK_POINTER_MOTION_HINT_MASK |
                         GDK_BUTTON_PRESS_MASK |
                         GDK_BUTTON_RELEASE_MASK |
+                        GDK_SCROLL_MASK |
                         GDK_KEY_PRESS_MASK|
                         GDK_PROPERTY_CHANGE_MASK);
 
-    self->icon_render = fm_cell_renderer_pixbuf_new();
-    g_object_set( self->icon_render, "follow-state", TRUE, NULL);
-    g_object_ref_sink(self->icon_render);
-    fm_cell_renderer_pixbuf_set_fixed_size(FM_CELL_RENDERER_PIXBUF(self->icon_render), fm_config->big_icon_size, fm_config->big_icon_size);
-
-    /* FIXME: call pango_layout_context_changed() on the layout in response to the
-     * "style-set" and "direction-changed" signals for the widget. */
-    pc = gtk_widget_get_pango_context( (GtkWidget*)self );
-    self->pl = gtk_widget_create_pango_layout( (GtkWidget*)self, NULL );
-    pango_layout_set_alignment( self->pl, PANGO_ALIGN_CENTER );
-    pango_layout_set_ellipsize( self->pl, PANGO_ELLIPSIZE_END );
-    pango_layout_set_wrap(self->pl, PANGO_WRAP_WORD_CHAR);
-
     g_signal_connect(model, "row-inserted", G_CALLBACK(on_row_inserted), self);
     g_signal_connect(model, "row-deleted", G_CALLBACK(on_row_deleted), self);
     g_signal_connect(model, "row-changed", G_CALLBACK(on_row_changed), self);
@@ -252,6 +561,8 @@ static void fm_desktop_init(FmDesktop *self)
     gdk_window_set_events(root, gdk_window_get_events(root)|GDK_PROPERTY_CHANGE_MASK);
     gdk_window_add_filter(root, on_root_event, self);
     g_signal_connect(screen, "size-changed", G_CALLBACK(on_screen_size_changed), self);
+    g_signal_connect(screen, "monitors-changed", G_CALLBACK(on_monitors_changed), self);
+    update_monitors(self);
 
     /* init dnd support */
     gtk_drag_source_set(self, 0,
@@ -271,14 +582,30 @@ static void fm_desktop_init(FmDesktop *self)
 
     self->dnd_dest = fm_dnd_dest_new((GtkWidget*)self);
     /* add items */
+    self->items = g_ptr_array_new();
+    self->item_hash = g_hash_table_new(g_direct_hash, g_direct_equal);
     if(gtk_tree_model_get_iter_first(GTK_TREE_MODEL(model), &it))
     {
         do{
             FmDesktopItem* item = desktop_item_new(&it);
-            self->items = g_list_prepend(self->items, item);
+            item->index = self->items->len;
+            g_ptr_array_add(self->items, item);
+            g_hash_table_insert(self->item_hash, it.user_data, item);
         }while(gtk_tree_model_iter_next(GTK_TREE_MODEL(model), &it));
-        self->items = g_list_reverse(self->items);
     }
+    /* later changes are applied to the index one by one */
+    self->name_index = g_ptr_array_sized_new(self->items->len);
+    for(k = 0; k < self->items->len; ++k)
+        g_ptr_array_add(self->name_index, get_item(self, k));
+    g_ptr_array_sort(self->name_index, compare_search_keys);
+    self->typeahead = g_string_new(NULL);
+
+    self->layers = fm_desktop_layers_new((GtkWidget*)self, (FmDesktopRedrawFunc)queue_redraw);
+
+    self->stacks = g_new0(FmDesktopStack, N_STACKS);
+    for(k = 0; k < N_STACKS; ++k)
+        self->stacks[k].items = g_ptr_array_new();
+    self->n_unstacked = G_MAXUINT;
 }
 
 
@@ -297,40 +624,53 @@ static char* get_config_file(FmDesktop* desktop, gboolean create_dir)
     return path;
 }
 
-static inline void load_item_pos(FmDesktop* desktop, GKeyFile* kf)
+/* the positions of items are stored in desktop-items-N.db, which
+ * replaces desktop-items-N.conf used by older versions. */
+static FmItemPosDb* get_pos_db(FmDesktop* desktop)
 {
-    char* path = get_config_file(desktop, FALSE);
-    if(g_key_file_load_from_file(kf, path, 0, NULL))
+    if(!desktop->pos_db)
     {
-        GList* l;
-        for(l = desktop->items; l; l=l->next)
+        char* dir = pcmanfm_get_profile_dir(FALSE);
+        int n = gdk_screen_get_number(gtk_widget_get_screen(GTK_WIDGET(desktop)));
+        char* path = g_strdup_printf("%s/desktop-items-%d.db", dir, n);
+        char* legacy_path = get_config_file(desktop, FALSE);
+        desktop->pos_db = fm_item_pos_db_open(path, legacy_path);
+        g_free(legacy_path);
+        g_free(path);
+        g_free(dir);
+    }
+    return desktop->pos_db;
+}
+
+static inline void load_item_pos(FmDesktop* desktop)
+{
+    FmItemPosDb* db = get_pos_db(desktop);
+    guint i;
+    for(i = 0; i < desktop->items->len; ++i)
+    {
+        FmDesktopItem* item = get_item(desktop, i);
+        const char* name = fm_path_get_basename(item->fi->path);
+        if(fm_item_pos_db_lookup(db, name, &item->x, &item->y))
         {
-            FmDesktopItem* item = (FmDesktopItem*)l->data;
-            const char* name = fm_path_get_basename(item->fi->path);
-            if(g_key_file_has_group(kf, name))
-            {
-                desktop->fixed_items = g_list_prepend(desktop->fixed_items, item);
-                item->fixed_pos = TRUE;
-                item->x = g_key_file_get_integer(kf, name, "x", NULL);
-                item->y = g_key_file_get_integer(kf, name, "y", NULL);
-                calc_item_size(desktop, item);
-            }
+            set_item_fixed(desktop, item, TRUE);
+            grid_remove_item(desktop, item);
+            calc_item_size(desktop, item);
+            grid_insert_item(desktop, item);
         }
     }
-    g_free(path);
 }
 
 static void on_model_loaded(FmFolderModel* model, gpointer user_data)
 {
     int i;
     /* the desktop folder is just loaded, apply desktop item positions */
-    GKeyFile* kf = g_key_file_new();
     for( i = 0; i < n_screens; i++ )
     {
         FmDesktop* desktop = FM_DESKTOP(desktops[i]);
-        load_item_pos(desktop, kf);
+        load_item_pos(desktop);
+        /* lay out all the items loaded so far in one pass */
+        queue_layout_items(desktop);
     }
-    g_key_file_free(kf);
 }
 
 void fm_desktop_manager_init()
@@ -364,6 +704,12 @@ void fm_desktop_manager_init()
     if(app_config->desktop_font)
         font_desc = pango_font_description_from_string(app_config->desktop_font);
 
+    /* the modules are only loaded if they are enabled */
+    fm_desktop_modules_load(app_config->desktop_modules);
+
+    /* the first image of the slideshow is shown when the desktops are realized */
+    update_slideshow();
+
     gdpy = gdk_display_get_default();
     n_screens = gdk_display_get_n_screens(gdpy);
     desktops = g_new(GtkWidget*, n_screens);
@@ -388,7 +734,10 @@ void fm_desktop_manager_init()
     wallpaper_changed = g_signal_connect(app_config, "changed::wallpaper", G_CALLBACK(on_wallpaper_changed), NULL);
     desktop_text_changed = g_signal_connect(app_config, "changed::desktop_text", G_CALLBACK(on_desktop_text_changed), NULL);
     desktop_font_changed = g_signal_connect(app_config, "changed::desktop_font", G_CALLBACK(on_desktop_font_changed), NULL);
+    desktop_stacks_changed = g_signal_connect(app_config, "changed::desktop_stacks", G_CALLBACK(on_desktop_stacks_changed), NULL);
     big_icon_size_changed = g_signal_connect(app_config, "changed::big_icon_size", G_CALLBACK(on_big_icon_size_changed), NULL);
+    show_thumbnail_changed = g_signal_connect(app_config, "changed::show_thumbnail", G_CALLBACK(on_show_thumbnail_changed), NULL);
+    slideshow_changed = g_signal_connect(app_config, "changed::slideshow", G_CALLBACK(on_slideshow_changed), NULL);
 
     icon_theme_changed = g_signal_connect(gtk_icon_theme_get_default(), "changed", G_CALLBACK(on_icon_theme_changed), NULL);
 
@@ -416,56 +765,26 @@ void fm_desktop_manager_init()
     pcmanfm_ref();
 }
 
-/* save position of desktop icons */
-static void save_item_pos(FmDesktop* desktop)
+/* save the position of the item if it's placed by the user. the changes
+ * are written to the disk in the background, see fm_item_pos_db_set(). */
+static void save_item_pos(FmDesktop* desktop, FmDesktopItem* item)
 {
-    GList* l;
-    GString* buf;
-    char* path;
-    buf = g_string_sized_new(1024);
-    for(l = desktop->fixed_items; l; l=l->next)
-    {
-        FmDesktopItem* item = (FmDesktopItem*)l->data;
-        const char* p;
-        /* write the file basename as group name */
-        g_string_append_c(buf, '[');
-        for(p = item->fi->path->name; *p; ++p)
-        {
-            switch(*p)
-            {
-            case '\r':
-                g_string_append(buf, "\\r");
-                break;
-            case '\n':
-                g_string_append(buf, "\\n");
-                break;
-            case '\\':
-                g_string_append(buf, "\\\\");
-                break;
-            default:
-                g_string_append_c(buf, *p);
-            }
-        }
-        g_string_append(buf, "]\n");
-        g_string_append_printf(buf, "x=%d\n"
-                                    "y=%d\n\n",
-                                    item->x, item->y);
-    }
-    path = get_config_file(desktop, TRUE);
-    g_file_set_contents(path, buf->str, buf->len, NULL);
-    g_free(path);
-    g_string_free(buf, TRUE);
+    FmItemPosDb* db = get_pos_db(desktop);
+    const char* name = fm_path_get_basename(item->fi->path);
+    if(item->fixed_pos)
+        fm_item_pos_db_set(db, name, item->x, item->y);
+    else
+        fm_item_pos_db_remove(db, name);
 }
 
 void fm_desktop_manager_finalize()
 {
     int i;
+    /* the positions are saved when the desktops are destroyed */
     for( i = 0; i < n_screens; i++ )
-    {
-        save_item_pos(FM_DESKTOP(desktops[i]));
         gtk_widget_destroy(desktops[i]);
-    }
     g_free(desktops);
+    fm_desktop_modules_unload();
     g_object_unref(win_group);
     win_group = NULL;
 
@@ -484,7 +803,11 @@ void fm_desktop_manager_finalize()
     g_signal_handler_disconnect(app_config, wallpaper_changed);
     g_signal_handler_disconnect(app_config, desktop_text_changed);
     g_signal_handler_disconnect(app_config, desktop_font_changed);
+    g_signal_handler_disconnect(app_config, desktop_stacks_changed);
     g_signal_handler_disconnect(app_config, big_icon_size_changed);
+    g_signal_handler_disconnect(app_config, show_thumbnail_changed);
+    g_signal_handler_disconnect(app_config, slideshow_changed);
+    stop_slideshow();
 
     g_signal_handler_disconnect(gtk_icon_theme_get_default(), icon_theme_changed);
 
@@ -500,6 +823,17 @@ void fm_desktop_manager_finalize()
         hand_cursor = NULL;
     }
 
+    if(link_emblem)
+    {
+        g_object_unref(link_emblem);
+        link_emblem = NULL;
+    }
+    if(icon_cache)
+    {
+        g_hash_table_destroy(icon_cache);
+        icon_cache = NULL;
+    }
+
     pcmanfm_unref();
 }
 
@@ -536,26 +870,26 @@ void set_focused_item(FmDesktop* desktop, FmDesktopItem* item)
 
 static void select_all(FmDesktop* desktop)
 {
-    GList* l;
-    for(l=desktop->items;l;l=l->next)
+    guint i;
+    for(i = 0; i < desktop->items->len; ++i)
     {
-        FmDesktopItem* item = (FmDesktopItem*)l->data;
-        item->is_selected = TRUE;
+        FmDesktopItem* item = get_item(desktop, i);
+        /* items collapsed into stacks are not shown */
+        if(item->stack && !item->in_overlay)
+            continue;
+        set_item_selected(desktop, item, TRUE);
         redraw_item(desktop, item);
     }
 }
 
 static void deselect_all(FmDesktop* desktop)
 {
-    GList* l;
-    for( l = desktop->items; l ;l = l->next )
+    /* only the selected items need to be visited */
+    while( desktop->selected.head )
     {
-        FmDesktopItem* item = (FmDesktopItem*) l->data;
-        if( item->is_selected )
-        {
-            item->is_selected = FALSE;
-            redraw_item( desktop, item );
-        }
+        FmDesktopItem* item = (FmDesktopItem*)desktop->selected.head->data;
+        set_item_selected( desktop, item, FALSE );
+        redraw_item( desktop, item );
     }
 }
 
@@ -630,6 +964,23 @@ gboolean on_button_press( GtkWidget* w, GdkEventButton* evt )
 
     if( evt->type == GDK_BUTTON_PRESS )
     {
+        /* clicking a stack expands or collapses it, and clicking
+         * anywhere else outside of the overlay collapses it. */
+        if( !clicked_item && evt->button == 1 )
+        {
+            FmDesktopStack* stack = hit_test_stack(self, (int)evt->x, (int)evt->y);
+            if( stack )
+            {
+                if( stack == self->expanded_stack )
+                    collapse_stack(self);
+                else
+                    expand_stack(self, stack);
+                goto out;
+            }
+        }
+        if( self->expanded_stack && !is_point_in_rect(&self->overlay_rect, (int)evt->x, (int)evt->y) )
+            collapse_stack(self);
+
         if( evt->button == 1 )  /* left button */
         {
             self->button_pressed = TRUE;    /* store button state for drag & drop */
@@ -648,9 +999,9 @@ gboolean on_button_press( GtkWidget* w, GdkEventButton* evt )
         if( clicked_item )
         {
             if( evt->state & (GDK_SHIFT_MASK | GDK_CONTROL_MASK) )
-                clicked_item->is_selected = ! clicked_item->is_selected;
+                set_item_selected( self, clicked_item, ! clicked_item->is_selected );
             else
-                clicked_item->is_selected = TRUE;
+                set_item_selected( self, clicked_item, TRUE );
 
             if( self->focus && self->focus != item )
             {
@@ -777,6 +1128,10 @@ static gboolean on_single_click_timeout( FmDesktop* self )
 gboolean on_motion_notify( GtkWidget* w, GdkEventMotion* evt )
 {
     FmDesktop* self = (FmDesktop*)w;
+
+    /* with motion hints, the next motion event is not sent until we ask
+     * for it, so the motions during a slow update are compressed into one. */
+    gdk_event_request_motions(evt);
     if( ! self->button_pressed )
     {
         if( fm_config->single_click )
@@ -841,6 +1196,26 @@ gboolean on_motion_notify( GtkWidget* w, GdkEventMotion* evt )
     return TRUE;
 }
 
+/* turn the pages of the overlay if there are too many items in the stack */
+gboolean on_scroll( GtkWidget* w, GdkEventScroll* evt )
+{
+    FmDesktop* self = (FmDesktop*)w;
+    if( self->expanded_stack && is_point_in_rect(&self->overlay_rect, (int)evt->x, (int)evt->y) )
+    {
+        if( evt->direction == GDK_SCROLL_UP || evt->direction == GDK_SCROLL_LEFT )
+        {
+            if( self->overlay_page == 0 )
+                return TRUE;
+            --self->overlay_page;
+        }
+        else
+            ++self->overlay_page; /* it's clamped by layout_overlay() */
+        layout_overlay(self);
+        return TRUE;
+    }
+    return FALSE;
+}
+
 gboolean on_leave_notify( GtkWidget* w, GdkEventCrossing *evt )
 {
     FmDesktop* self = (FmDesktop*)w;
@@ -852,6 +1227,83 @@ gboolean on_leave_notify( GtkWidget* w, GdkEventCrossing *evt )
     return TRUE;
 }
 
+/* make the item visible if it's collapsed into a stack */
+static void show_item(FmDesktop* desktop, FmDesktopItem* item)
+{
+    GPtrArray* items;
+    guint lo = 0, hi, page;
+    if(!item->stack)
+        return;
+    if(item->stack != desktop->expanded_stack)
+        expand_stack(desktop, item->stack);
+    /* the items of a stack are in the order of the model */
+    items = item->stack->items;
+    hi = items->len;
+    while(lo < hi)
+    {
+        guint mid = (lo + hi) / 2;
+        if(((FmDesktopItem*)g_ptr_array_index(items, mid))->index < item->index)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if(lo >= items->len || g_ptr_array_index(items, lo) != item)
+        return;
+    page = lo / get_overlay_page_size(desktop);
+    if(page != desktop->overlay_page)
+    {
+        desktop->overlay_page = page;
+        layout_overlay(desktop);
+    }
+}
+
+static gboolean on_typeahead_timeout(FmDesktop* desktop)
+{
+    g_string_truncate(desktop->typeahead, 0);
+    desktop->typeahead_timeout = 0;
+    return FALSE;
+}
+
+/* Type-ahead find: focus the first item whose name starts with the text
+ * typed so far. Returns FALSE if the key is not used for this. */
+static gboolean on_typeahead_key(FmDesktop* desktop, GdkEventKey* evt)
+{
+    GString* text = desktop->typeahead;
+    gunichar c = gdk_keyval_to_unicode(evt->keyval);
+    char* key;
+    guint pos;
+
+    if(evt->keyval == GDK_BackSpace && text->len > 0)
+        g_string_truncate(text, g_utf8_find_prev_char(text->str, text->str + text->len) - text->str);
+    /* space activates the selected items unless a name is being typed */
+    else if(c && g_unichar_isprint(c) && (c != ' ' || text->len > 0))
+        g_string_append_unichar(text, c);
+    else
+        return FALSE;
+
+    if(desktop->typeahead_timeout)
+        g_source_remove(desktop->typeahead_timeout);
+    desktop->typeahead_timeout = g_timeout_add(TYPEAHEAD_TIMEOUT, (GSourceFunc)on_typeahead_timeout, desktop);
+    if(text->len == 0)
+        return TRUE;
+
+    key = get_search_key(text->str);
+    pos = name_index_lower_bound(desktop, key);
+    if(pos < desktop->name_index->len)
+    {
+        FmDesktopItem* item = (FmDesktopItem*)g_ptr_array_index(desktop->name_index, pos);
+        if(g_str_has_prefix(item->search_key, key))
+        {
+            deselect_all(desktop);
+            set_item_selected(desktop, item, TRUE);
+            show_item(desktop, item);
+            set_focused_item(desktop, item);
+        }
+    }
+    g_free(key);
+    return TRUE;
+}
+
 static open_context_menu(FmDesktop* desktop, GdkEventKey* evt)
 {
     FmFileInfoList* files = fm_desktop_get_selected_files(desktop);
@@ -873,11 +1325,22 @@ gboolean on_key_press( GtkWidget* w, GdkEventKey* evt )
     FmDesktopItem* item;
     int modifier = ( evt->state & ( GDK_SHIFT_MASK | GDK_CONTROL_MASK | GDK_MOD1_MASK ) );
     FmPathList* sels;
+
+    if( !(modifier & (GDK_CONTROL_MASK | GDK_MOD1_MASK)) && on_typeahead_key(desktop, evt) )
+        return TRUE;
+
     switch ( evt->keyval )
     {
     case GDK_Menu:
         open_context_menu(desktop, evt);
         return TRUE;
+    case GDK_Escape:
+        if(desktop->expanded_stack)
+        {
+            collapse_stack(desktop);
+            return TRUE;
+        }
+        break;
     case GDK_F10:
         if(modifier & GDK_SHIFT_MASK)
         {
@@ -891,7 +1354,7 @@ gboolean on_key_press( GtkWidget* w, GdkEventKey* evt )
             if(0 == modifier)
             {
                 deselect_all(desktop);
-                item->is_selected = TRUE;
+                set_item_selected(desktop, item, TRUE);
             }
             set_focused_item(desktop, item);
         }
@@ -904,7 +1367,7 @@ gboolean on_key_press( GtkWidget* w, GdkEventKey* evt )
             if(0 == modifier)
             {
                 deselect_all(desktop);
-                item->is_selected = TRUE;
+                set_item_selected(desktop, item, TRUE);
             }
             set_focused_item(desktop, item);
         }
@@ -917,7 +1380,7 @@ gboolean on_key_press( GtkWidget* w, GdkEventKey* evt )
             if(0 == modifier)
             {
                 deselect_all(desktop);
-                item->is_selected = TRUE;
+                set_item_selected(desktop, item, TRUE);
             }
             set_focused_item(desktop, item);
         }
@@ -930,7 +1393,7 @@ gboolean on_key_press( GtkWidget* w, GdkEventKey* evt )
             if(0 == modifier)
             {
                 deselect_all(desktop);
-                item->is_selected = TRUE;
+                set_item_selected(desktop, item, TRUE);
             }
             set_focused_item(desktop, item);
         }
@@ -941,7 +1404,7 @@ gboolean on_key_press( GtkWidget* w, GdkEventKey* evt )
         {
             if(desktop->focus)
             {
-                desktop->focus->is_selected = !desktop->focus->is_selected;
+                set_item_selected(desktop, desktop->focus, !desktop->focus->is_selected);
                 redraw_item(desktop, desktop->focus);
             }
         }
@@ -1015,14 +1478,19 @@ void on_style_set( GtkWidget* w, GtkStyle* prev )
     PangoContext* pc = gtk_widget_get_pango_context(w);
     if(font_desc)
         pango_context_set_font_description(pc, font_desc);
-    pango_layout_context_changed(self->pl);
+    invalidate_text_layouts(self);
+    /* colors of selected items are changed */
+    ++self->surface_stamp;
+    queue_redraw(self, NULL);
 }
 
 void on_direction_changed( GtkWidget* w, GtkTextDirection prev )
 {
     FmDesktop* self = (FmDesktop*)w;
-    PangoContext* pc = gtk_widget_get_pango_context(w);
-    pango_layout_context_changed(self->pl);
+    /* the labels are re-shaped with the new direction when laid out */
+    ++self->text_stamp;
+    /* the monitors are laid out from the other side */
+    g_ptr_array_sort_with_data(self->monitors, compare_monitors, self);
     queue_layout_items(self);
 }
 
@@ -1045,8 +1513,8 @@ gboolean on_focus_in( GtkWidget* w, GdkEventFocus* evt )
 {
     FmDesktop* self = (FmDesktop*) w;
     GTK_WIDGET_SET_FLAGS( w, GTK_HAS_FOCUS );
-    if( !self->focus && self->items)
-        self->focus = (FmDesktopItem*)self->items->data;
+    if( !self->focus && self->items->len > 0 )
+        self->focus = get_item(self, 0);
     if( self->focus )
         redraw_item( self, self->focus );
     return FALSE;
@@ -1064,40 +1532,218 @@ gboolean on_focus_out( GtkWidget* w, GdkEventFocus* evt )
 }
 
 
-gboolean on_expose( GtkWidget* w, GdkEventExpose* evt )
+static void paint_background(FmDesktop* self, cairo_t* cr)
 {
-    FmDesktop* self = (FmDesktop*)w;
-    GList* l;
-    cairo_t* cr;
+    /* the wallpaper pixmap is as large as the screen, which has the
+     * same origin as the desktop window. */
+    if(self->wallpaper_pixmap)
+        gdk_cairo_set_source_pixmap(cr, self->wallpaper_pixmap, 0, 0);
+    else
+        gdk_cairo_set_source_color(cr, &app_config->desktop_bg);
+    cairo_paint(cr);
+}
 
-    if( G_UNLIKELY( ! gtk_widget_get_visible (w) || ! gtk_widget_get_mapped (w) ) )
-        return TRUE;
+static void paint_item_in_region(FmDesktop* self, FmDesktopItem* item, cairo_t* cr,
+                                 GdkRectangle* area, GdkRegion* region)
+{
+    GdkRectangle* intersect, tmp, tmp2;
+    if(gdk_rectangle_intersect( area, &item->icon_rect, &tmp ))
+        intersect = &tmp;
+    else
+        intersect = NULL;
+
+    if(gdk_rectangle_intersect( area, &item->text_rect, &tmp2 ))
+    {
+        if(intersect)
+            gdk_rectangle_union(intersect, &tmp2, intersect);
+        else
+            intersect = &tmp2;
+    }
+
+    if(intersect && gdk_region_rect_in(region, intersect) != GDK_OVERLAP_RECTANGLE_OUT)
+        paint_item( self, item, cr, intersect );
+}
+
+/* a stack is drawn as a pile of two icons, labeled with the number of items */
+static void paint_stack(FmDesktop* self, FmDesktopStack* stack, cairo_t* cr, GdkRectangle* area)
+{
+    GdkRectangle rect;
+    int text_x, text_y;
+
+    gdk_rectangle_union(&stack->icon_rect, &stack->text_rect, &rect);
+    if(!gdk_rectangle_intersect(area, &rect, NULL))
+        return;
+
+    cairo_save(cr);
+    if(stack->icon)
+    {
+        gdk_cairo_set_source_pixbuf(cr, stack->icon, stack->icon_rect.x + 4, stack->icon_rect.y);
+        cairo_paint_with_alpha(cr, 0.5);
+        gdk_cairo_set_source_pixbuf(cr, stack->icon, stack->icon_rect.x, stack->icon_rect.y + 4);
+        cairo_paint(cr);
+    }
+
+    text_x = stack->x + (self->cell_w - self->text_w)/2 + 2;
+    text_y = stack->icon_rect.y + stack->icon_rect.height + 2;
+    if(stack == self->expanded_stack)
+    {
+        GtkStyle* style = gtk_widget_get_style((GtkWidget*)self);
+        gdk_cairo_rectangle(cr, &stack->text_rect);
+        gdk_cairo_set_source_color(cr, &style->bg[GTK_STATE_SELECTED]);
+        cairo_fill(cr);
+        gdk_cairo_set_source_color(cr, &style->fg[GTK_STATE_SELECTED]);
+    }
+    else
+    {
+        gdk_cairo_set_source_color(cr, &app_config->desktop_shadow);
+        cairo_move_to(cr, text_x + 1, text_y + 1);
+        pango_cairo_show_layout(cr, stack->pl);
+        gdk_cairo_set_source_color(cr, &app_config->desktop_fg);
+    }
+    cairo_move_to(cr, text_x, text_y);
+    pango_cairo_show_layout(cr, stack->pl);
+    cairo_restore(cr);
+}
+
+/* repaint the damaged region of the backbuffer */
+static void paint_backbuffer(FmDesktop* self, GdkRegion* region)
+{
+    guint i;
+    cairo_t* cr;
+    GdkRectangle area;
+    GPtrArray* pending;
+
+    cr = gdk_cairo_create(self->backbuffer);
+    gdk_cairo_region(cr, region);
+    cairo_clip(cr);
+    gdk_region_get_clipbox(region, &area);
+
+    /* Many items need to be rendered, e.g. after the icon size or the
+     * font is changed. They are rendered by the workers in parallel,
+     * the items not covered by panels first, and painted when done.
+     * Until then their last image or their icon is painted. */
+    pending = g_ptr_array_new();
+    for( i = 0; i < self->items->len; ++i )
+    {
+        FmDesktopItem* item = get_item(self, i);
+        GdkRectangle rect;
+        int state;
+        if(item->stack && !item->in_overlay)
+            continue;
+        state = get_item_state(self, item);
+        check_item_surfaces(self, item, &rect);
+        if(!item->surfaces[state] && !item->render_jobs[state]
+           && gdk_region_rect_in(region, &rect) != GDK_OVERLAP_RECTANGLE_OUT)
+            g_ptr_array_add(pending, item);
+    }
+    if(pending->len >= ASYNC_RENDER_THRESHOLD && can_render_in_threads())
+    {
+        for( i = 0; i < pending->len; ++i )
+        {
+            FmDesktopItem* item = (FmDesktopItem*)g_ptr_array_index(pending, i);
+            GdkRectangle rect;
+            get_item_surface_rect(item, &rect);
+            queue_render_item(self, item, get_item_state(self, item),
+                              gdk_rectangle_intersect(&rect, &self->working_area, NULL) ? 0 : 1);
+        }
+    }
+    g_ptr_array_free(pending, TRUE);
 
-    cr = gdk_cairo_create( gtk_widget_get_window(w) );
+    paint_background(self, cr);
+    fm_desktop_layers_paint(self->layers, cr, &area);
     if( self->rubber_bending )
-        paint_rubber_banding_rect( self, cr, &evt->area );
+        paint_rubber_banding_rect( self, cr, &area );
 
-    for( l = self->items; l; l = l->next )
+    for( i = 0; i < self->items->len; ++i )
     {
-        FmDesktopItem* item = (FmDesktopItem*)l->data;
-        GdkRectangle* intersect, tmp, tmp2;
-        if(gdk_rectangle_intersect( &evt->area, &item->icon_rect, &tmp ))
-            intersect = &tmp;
-        else
-            intersect = NULL;
+        FmDesktopItem* item = get_item(self, i);
+        if(!item->stack)
+            paint_item_in_region(self, item, cr, &area, region);
+    }
 
-        if(gdk_rectangle_intersect( &evt->area, &item->text_rect, &tmp2 ))
+    if(self->stacks)
+    {
+        for( i = 0; i < N_STACKS; ++i )
         {
-            if(intersect)
-                gdk_rectangle_union(intersect, &tmp2, intersect);
-            else
-                intersect = &tmp2;
+            FmDesktopStack* stack = &self->stacks[i];
+            if(stack->items->len > 0)
+                paint_stack(self, stack, cr, &area);
         }
+    }
 
-        if(intersect)
-            paint_item( self, item, cr, intersect );
+    /* the overlay is above everything else */
+    if(self->expanded_stack && gdk_rectangle_intersect(&area, &self->overlay_rect, NULL))
+    {
+        GPtrArray* items = self->expanded_stack->items;
+        cairo_save(cr);
+        gdk_cairo_rectangle(cr, &self->overlay_rect);
+        cairo_set_source_rgba(cr, app_config->desktop_shadow.red / 65535.0,
+                              app_config->desktop_shadow.green / 65535.0,
+                              app_config->desktop_shadow.blue / 65535.0, 0.8);
+        cairo_fill(cr);
+        cairo_restore(cr);
+        for( i = 0; i < items->len; ++i )
+        {
+            FmDesktopItem* item = (FmDesktopItem*)g_ptr_array_index(items, i);
+            if(item->in_overlay)
+                paint_item_in_region(self, item, cr, &area, region);
+        }
     }
     cairo_destroy(cr);
+}
+
+gboolean on_expose( GtkWidget* w, GdkEventExpose* evt )
+{
+    FmDesktop* self = (FmDesktop*)w;
+    GdkWindow* window = gtk_widget_get_window(w);
+    GdkRegion* region;
+    GdkRectangle area;
+    int width, height;
+
+    if( G_UNLIKELY( ! gtk_widget_get_visible (w) || ! gtk_widget_get_mapped (w) ) )
+        return TRUE;
+
+    gdk_drawable_get_size(window, &width, &height);
+    if(self->backbuffer)
+    {
+        int old_w, old_h;
+        gdk_drawable_get_size(self->backbuffer, &old_w, &old_h);
+        if(old_w != width || old_h != height)
+        {
+            g_object_unref(self->backbuffer);
+            self->backbuffer = NULL;
+        }
+    }
+    if(!self->backbuffer)
+    {
+        self->backbuffer = gdk_pixmap_new(window, width, height, -1);
+        queue_redraw(self, NULL);
+    }
+
+    /* Exposures by the X server only need the backbuffer to be copied
+     * again. Damage from the changes is repainted here, once per frame,
+     * however many times it's queued before. */
+    region = gdk_region_copy(evt->region);
+    if(self->damage)
+    {
+        paint_backbuffer(self, self->damage);
+        gdk_region_union(region, self->damage);
+        gdk_region_destroy(self->damage);
+        self->damage = NULL;
+        self->n_damage_rects = 0;
+    }
+    if(self->repaint_idle)
+    {
+        g_source_remove(self->repaint_idle);
+        self->repaint_idle = 0;
+    }
+
+    gdk_region_get_clipbox(region, &area);
+    gdk_gc_set_clip_region(self->gc, region);
+    gdk_draw_drawable(window, self->gc, self->backbuffer,
+                      area.x, area.y, area.x, area.y, area.width, area.height);
+    gdk_gc_set_clip_region(self->gc, NULL);
+    gdk_region_destroy(region);
 
     return TRUE;
 }
@@ -1105,39 +1751,51 @@ gboolean on_expose( GtkWidget* w, GdkEventExpose* evt )
 void on_size_allocate( GtkWidget* w, GtkAllocation* alloc )
 {
     FmDesktop* self = (FmDesktop*)w;
+    guint old_cell_w = self->cell_w, old_cell_h = self->cell_h;
+    gboolean monitors_changed;
 
     /* calculate item size */
-    PangoContext* pc;
-    PangoFontMetrics *metrics;
-    int font_h;
-    pc = gtk_widget_get_pango_context( (GtkWidget*)self );
+    if(self->font_h == 0) /* the font is changed */
+    {
+        PangoContext* pc;
+        PangoFontMetrics *metrics;
+        pc = gtk_widget_get_pango_context( (GtkWidget*)self );
 
-    metrics = pango_context_get_metrics( pc, NULL, NULL);
+        metrics = pango_context_get_metrics( pc, NULL, NULL);
 
-    font_h = pango_font_metrics_get_ascent(metrics) + pango_font_metrics_get_descent (metrics);
-    font_h /= PANGO_SCALE;
+        self->font_h = pango_font_metrics_get_ascent(metrics) + pango_font_metrics_get_descent (metrics);
+        self->font_h /= PANGO_SCALE;
+        pango_font_metrics_unref(metrics);
+    }
 
     self->spacing = SPACING;
     self->xpad = self->ypad = PADDING;
     self->xmargin = self->ymargin = MARGIN;
-    self->text_h = font_h * 2;
+    self->text_h = self->font_h * 2;
     self->text_w = 100;
-    self->pango_text_h = self->text_h * PANGO_SCALE;
-    self->pango_text_w = self->text_w * PANGO_SCALE;
+    if(self->pango_text_h != self->text_h * PANGO_SCALE
+       || self->pango_text_w != self->text_w * PANGO_SCALE)
+    {
+        /* the labels need to be wrapped again */
+        self->pango_text_h = self->text_h * PANGO_SCALE;
+        self->pango_text_w = self->text_w * PANGO_SCALE;
+        ++self->text_stamp;
+    }
     self->text_h += 4;
     self->text_w += 4; /* 4 is for drawing border */
     self->cell_h = fm_config->big_icon_size + self->spacing + self->text_h + self->ypad * 2;
     self->cell_w = MAX(self->text_w, fm_config->big_icon_size) + self->xpad * 2;
 
+    monitors_changed = update_monitors(self);
+    /* this relayouts the items if the working area is changed */
     update_working_area(self);
-    /* queue_layout_items(self); this is called in update_working_area */
+    /* the layout areas depend on the monitors and the size of the cells */
+    if(monitors_changed || self->cell_w != old_cell_w || self->cell_h != old_cell_h)
+        queue_layout_items(self);
 
-    /* scale the wallpaper */
+    /* only the wallpapers of the monitors changed are loaded again */
     if(GTK_WIDGET_REALIZED(self))
-    {
-        if(app_config->wallpaper_mode != FM_WP_COLOR && app_config->wallpaper_mode != FM_WP_TILE)
-            update_background(self);
-    }
+        update_background(self);
 
     GTK_WIDGET_CLASS(fm_desktop_parent_class)->size_allocate( w, alloc );
 }
@@ -1149,26 +1807,170 @@ void on_size_request( GtkWidget* w, GtkRequisition* req )
     req->height = gdk_screen_get_height( scr );
 }
 
+
 static gboolean is_point_in_rect( GdkRectangle* rect, int x, int y )
 {
     return rect->x < x && x < (rect->x + rect->width) && y > rect->y && y < (rect->y + rect->height);
 }
 
-FmDesktopItem* hit_test(FmDesktop* self, int x, int y)
+/*
+ * Spatial index of desktop items.
+ * The area covered by the desktop and all of its items is divided into
+ * a uniform grid of cells, which are as large as a layout cell.
+ * Every grid cell holds a list of the items whose bounds overlap it,
+ * so hit-testing only needs to check a few items instead of all of them.
+ * The grid is rebuilt by layout_items() and updated by move_item().
+ */
+
+/* the bounds of an item, which also contain its position (item->x, item->y) */
+static inline void get_item_bounds(FmDesktopItem* item, GdkRectangle* rect)
 {
-    /*
+    GdkRectangle pos;
+    gdk_rectangle_union(&item->icon_rect, &item->text_rect, rect);
+    pos.x = item->x;
+    pos.y = item->y;
+    pos.width = pos.height = 1;
+    gdk_rectangle_union(rect, &pos, rect);
+}
+
+static inline int grid_get_col(FmDesktop* desktop, int x)
+{
+    int col;
+    if(x < desktop->grid_x)
+        return 0;
+    col = (x - desktop->grid_x) / (int)desktop->grid_cell_w;
+    return MIN(col, (int)desktop->grid_cols - 1);
+}
+
+static inline int grid_get_row(FmDesktop* desktop, int y)
+{
+    int row;
+    if(y < desktop->grid_y)
+        return 0;
+    row = (y - desktop->grid_y) / (int)desktop->grid_cell_h;
+    return MIN(row, (int)desktop->grid_rows - 1);
+}
+
+static void grid_insert_item(FmDesktop* desktop, FmDesktopItem* item)
+{
+    GdkRectangle rect;
+    int col, row, col2, row2;
+    /* so grid_remove_item() does nothing if the item is not inserted */
+    item->grid_ncols = item->grid_nrows = 0;
+    /* items collapsed into stacks are not shown */
+    if(!desktop->grid || (item->stack && !item->in_overlay))
+        return;
+    get_item_bounds(item, &rect);
+    item->grid_col = grid_get_col(desktop, rect.x);
+    item->grid_row = grid_get_row(desktop, rect.y);
+    col2 = grid_get_col(desktop, rect.x + rect.width - 1);
+    row2 = grid_get_row(desktop, rect.y + rect.height - 1);
+    item->grid_ncols = col2 - item->grid_col + 1;
+    item->grid_nrows = row2 - item->grid_row + 1;
+    for(row = item->grid_row; row <= row2; ++row)
+    {
+        GSList** cell = desktop->grid + row * desktop->grid_cols;
+        for(col = item->grid_col; col <= col2; ++col)
+            cell[col] = g_slist_prepend(cell[col], item);
+    }
+}
+
+static void grid_remove_item(FmDesktop* desktop, FmDesktopItem* item)
+{
+    int col, row;
+    /* the cells are the ones the item was inserted into, since its
+     * position may have been changed after the insertion. */
+    if(desktop->grid)
+    {
+        for(row = item->grid_row; row < item->grid_row + item->grid_nrows; ++row)
+        {
+            GSList** cell = desktop->grid + row * desktop->grid_cols;
+            for(col = item->grid_col; col < item->grid_col + item->grid_ncols; ++col)
+                cell[col] = g_slist_remove(cell[col], item);
+        }
+    }
+    item->grid_ncols = item->grid_nrows = 0;
+}
+
+static void grid_free(FmDesktop* desktop)
+{
+    if(desktop->grid)
+    {
+        guint i, n = desktop->grid_cols * desktop->grid_rows;
+        for(i = 0; i < n; ++i)
+            g_slist_free(desktop->grid[i]);
+        g_free(desktop->grid);
+        desktop->grid = NULL;
+    }
+    desktop->grid_cols = desktop->grid_rows = 0;
+}
+
+static void grid_rebuild(FmDesktop* desktop)
+{
+    GdkScreen* screen = gtk_widget_get_screen((GtkWidget*)desktop);
+    GdkRectangle area, rect;
+    guint i, z = 0;
+
+    grid_free(desktop);
+
+    /* the grid covers the whole screen and all items, even the ones
+     * placed outside of the screen. */
+    area.x = area.y = 0;
+    area.width = gdk_screen_get_width(screen);
+    area.height = gdk_screen_get_height(screen);
+    for(i = 0; i < desktop->items->len; ++i)
+    {
+        FmDesktopItem* item = get_item(desktop, i);
+        /* items collapsed into stacks are not shown */
+        if(item->stack && !item->in_overlay)
+            continue;
+        get_item_bounds(item, &rect);
+        gdk_rectangle_union(&area, &rect, &area);
+    }
+
+    desktop->grid_x = area.x;
+    desktop->grid_y = area.y;
+    desktop->grid_cell_w = MAX(desktop->cell_w, 1);
+    desktop->grid_cell_h = MAX(desktop->cell_h, 1);
+    desktop->grid_cols = MAX((area.width + desktop->grid_cell_w - 1) / desktop->grid_cell_w, 1);
+    desktop->grid_rows = MAX((area.height + desktop->grid_cell_h - 1) / desktop->grid_cell_h, 1);
+    desktop->grid = g_new0(GSList*, desktop->grid_cols * desktop->grid_rows);
+
+    for(i = 0; i < desktop->items->len; ++i)
+    {
+        FmDesktopItem* item = get_item(desktop, i);
+        item->z = z++;
+        grid_insert_item(desktop, item);
+    }
+}
+
+FmDesktopItem* hit_test(FmDesktop* self, int x, int y)
+{
+    /*
         Items painted from first to last, so last items are "above" in z-order.
         We should find the last matched item, since this is consistent
         with the expected behavior.
     */
     FmDesktopItem* result = NULL;
     FmDesktopItem* item;
-    GList* l;
-    for( l = self->items; l; l = l->next )
+    GSList* l;
+    /* the overlay of the expanded stack hides the items under it */
+    gboolean in_overlay = self->expanded_stack && is_point_in_rect(&self->overlay_rect, x, y);
+
+    if(!self->grid || x < self->grid_x || y < self->grid_y)
+        return NULL;
+    if(x >= self->grid_x + (int)(self->grid_cols * self->grid_cell_w)
+       || y >= self->grid_y + (int)(self->grid_rows * self->grid_cell_h))
+        return NULL;
+
+    for( l = self->grid[grid_get_row(self, y) * self->grid_cols + grid_get_col(self, x)]; l; l = l->next )
     {
         item = (FmDesktopItem*) l->data;
-        if( is_point_in_rect( &item->icon_rect, x, y )
-         || is_point_in_rect( &item->text_rect, x, y ) )
+        if( in_overlay ? !item->in_overlay : item->in_overlay )
+            continue;
+        if( ( is_point_in_rect( &item->icon_rect, x, y )
+           || is_point_in_rect( &item->text_rect, x, y ) )
+           && ( !result || item->z > result->z ) )
         {
             result = item;
         }
@@ -1178,122 +1980,108 @@ FmDesktopItem* hit_test(FmDesktop* self, int x, int y)
 
 FmDesktopItem* get_nearest_item(FmDesktop* desktop, FmDesktopItem* item,  GtkDirectionType dir)
 {
-    GList* l;
     FmDesktopItem* item2, *ret = NULL;
-    guint min_x_dist, min_y_dist;
+    guint min_dist, min_cross_dist;
+    gboolean horizontal = (dir == GTK_DIR_LEFT || dir == GTK_DIR_RIGHT);
+    gboolean backward = (dir == GTK_DIR_LEFT || dir == GTK_DIR_UP);
+    int n_lines, n_cells, line, i;
 
-    if(!desktop->items || !desktop->items->next)
+    if(!item || !desktop->grid || desktop->items->len < 2)
         return NULL;
 
-    min_x_dist = min_y_dist = (guint)-1;
-    item2 = NULL;
+    min_dist = min_cross_dist = (guint)-1;
 
-    switch(dir)
+    /* Scan the grid line by line (columns for left and right, rows for
+     * up and down), starting at the line containing the item, and find
+     * the nearest item in the specified direction. */
+    if(horizontal)
     {
-    case GTK_DIR_LEFT:
-        for( l = desktop->items; l; l = l->next )
-        {
-            int dist;
-            item2 = (FmDesktopItem*) l->data;
-            if(item2->x >= item->x)
-                continue;
-            dist = item->x - item2->x;
-            if(dist < min_x_dist)
-            {
-                ret = item2;
-                min_x_dist = dist;
-                min_y_dist = ABS(item->y - item2->y);
-            }
-            else if(dist == min_x_dist && item2 != ret) /* if there is another item of the same x distance */
-            {
-                /* get the one with smaller y distance */
-                dist = ABS(item2->y - item->y);
-                if(dist < min_y_dist)
-                {
-                    ret = item2;
-                    min_y_dist = dist;
-                }
-            }
-        }
-        break;
-    case GTK_DIR_RIGHT:
-        for( l = desktop->items; l; l = l->next )
+        n_lines = desktop->grid_cols;
+        n_cells = desktop->grid_rows;
+        line = grid_get_col(desktop, item->x);
+    }
+    else
+    {
+        n_lines = desktop->grid_rows;
+        n_cells = desktop->grid_cols;
+        line = grid_get_row(desktop, item->y);
+    }
+
+    ++desktop->grid_stamp;
+    for(; line >= 0 && line < n_lines; line += backward ? -1 : 1)
+    {
+        if(ret)
         {
-            int dist;
-            item2 = (FmDesktopItem*) l->data;
-            if(item2->x <= item->x)
-                continue;
-            dist = item2->x - item->x;
-            if(dist < min_x_dist)
-            {
-                ret = item2;
-                min_x_dist = dist;
-                min_y_dist = ABS(item->y - item2->y);
-            }
-            else if(dist == min_x_dist && item2 != ret) /* if there is another item of the same x distance */
-            {
-                /* get the one with smaller y distance */
-                dist = ABS(item2->y - item->y);
-                if(dist < min_y_dist)
-                {
-                    ret = item2;
-                    min_y_dist = dist;
-                }
-            }
+            /* items not seen yet are beyond all the lines scanned so far,
+             * so they cannot be nearer than the item already found. */
+            int bound;
+            if(horizontal)
+                bound = backward ? item->x - (desktop->grid_x + (line + 1) * (int)desktop->grid_cell_w) + 1
+                                 : desktop->grid_x + line * (int)desktop->grid_cell_w - item->x;
+            else
+                bound = backward ? item->y - (desktop->grid_y + (line + 1) * (int)desktop->grid_cell_h) + 1
+                                 : desktop->grid_y + line * (int)desktop->grid_cell_h - item->y;
+            if(bound > 0 && (guint)bound > min_dist)
+                break;
         }
-        break;
-    case GTK_DIR_UP:
-        for( l = desktop->items; l; l = l->next )
+
+        for(i = 0; i < n_cells; ++i)
         {
-            int dist;
-            item2 = (FmDesktopItem*) l->data;
-            if(item2->y >= item->y)
-                continue;
-            dist = item->y - item2->y;
-            if(dist < min_y_dist)
-            {
-                ret = item2;
-                min_y_dist = dist;
-                min_x_dist = ABS(item->x - item2->x);
-            }
-            else if(dist == min_y_dist && item2 != ret) /* if there is another item of the same y distance */
+            GSList* l;
+            if(horizontal)
+                l = desktop->grid[i * desktop->grid_cols + line];
+            else
+                l = desktop->grid[line * desktop->grid_cols + i];
+            for(; l; l = l->next)
             {
-                /* get the one with smaller x distance */
-                dist = ABS(item2->x - item->x);
-                if(dist < min_x_dist)
+                guint dist, cross_dist;
+                item2 = (FmDesktopItem*)l->data;
+                if(item2->grid_stamp == desktop->grid_stamp)
+                    continue;
+                item2->grid_stamp = desktop->grid_stamp;
+
+                switch(dir)
                 {
-                    ret = item2;
-                    min_x_dist = dist;
+                case GTK_DIR_LEFT:
+                    if(item2->x >= item->x)
+                        continue;
+                    dist = item->x - item2->x;
+                    cross_dist = ABS(item->y - item2->y);
+                    break;
+                case GTK_DIR_RIGHT:
+                    if(item2->x <= item->x)
+                        continue;
+                    dist = item2->x - item->x;
+                    cross_dist = ABS(item->y - item2->y);
+                    break;
+                case GTK_DIR_UP:
+                    if(item2->y >= item->y)
+                        continue;
+                    dist = item->y - item2->y;
+                    cross_dist = ABS(item->x - item2->x);
+                    break;
+                case GTK_DIR_DOWN:
+                    if(item2->y <= item->y)
+                        continue;
+                    dist = item2->y - item->y;
+                    cross_dist = ABS(item->x - item2->x);
+                    break;
+                default:
+                    return NULL;
                 }
-            }
-        }
-        break;
-    case GTK_DIR_DOWN:
-        for( l = desktop->items; l; l = l->next )
-        {
-            int dist;
-            item2 = (FmDesktopItem*) l->data;
-            if(item2->y <= item->y)
-                continue;
-            dist = item2->y - item->y;
-            if(dist < min_y_dist)
-            {
-                ret = item2;
-                min_y_dist = dist;
-                min_x_dist = ABS(item->x - item2->x);
-            }
-            else if(dist == min_y_dist && item2 != ret) /* if there is another item of the same y distance */
-            {
-                /* get the one with smaller x distance */
-                dist = ABS(item2->x - item->x);
-                if(dist < min_x_dist)
+
+                /* if there is another item of the same distance, get the
+                 * one with smaller distance in the other direction. */
+                if(dist < min_dist
+                   || (dist == min_dist && (cross_dist < min_cross_dist
+                       || (cross_dist == min_cross_dist && item2->z < ret->z))))
                 {
                     ret = item2;
-                    min_x_dist = dist;
+                    min_dist = dist;
+                    min_cross_dist = cross_dist;
                 }
             }
         }
-        break;
     }
     return ret;
 }
@@ -1302,99 +2090,323 @@ static inline FmDesktopItem* desktop_item_new(GtkTreeIter* it)
 {
     FmDesktopItem* item = g_slice_new0(FmDesktopItem);
     item->it = *it;
-    gtk_tree_model_get(GTK_TREE_MODEL(model), it, COL_FILE_ICON, &item->icon, COL_FILE_INFO, &item->fi, -1);
+    item->fixed_link.data = item;
+    item->sel_link.data = item;
+    /* the icon is loaded when the item is shown, see materialize_item() */
+    gtk_tree_model_get(GTK_TREE_MODEL(model), it, COL_FILE_INFO, &item->fi, -1);
+    item->search_key = get_search_key(fm_file_info_get_disp_name(item->fi));
     return item;
 }
 
+/*
+ * Index of the items for type-ahead find.
+ * desktop->name_index holds the items sorted by their case-folded display
+ * names, so the first item whose name starts with the typed text can be
+ * found with a binary search. Keys of the same prefix are next to each
+ * other in this order, which is not the case for collation keys.
+ */
+
+static char* get_search_key(const char* name)
+{
+    char* normalized = g_utf8_normalize(name, -1, G_NORMALIZE_ALL);
+    char* key = g_utf8_casefold(normalized ? normalized : name, -1);
+    g_free(normalized);
+    return key;
+}
+
+static gint compare_search_keys(gconstpointer a, gconstpointer b)
+{
+    FmDesktopItem* item1 = *(FmDesktopItem**)a;
+    FmDesktopItem* item2 = *(FmDesktopItem**)b;
+    return strcmp(item1->search_key, item2->search_key);
+}
+
+/* get the first position in the index whose key is not less than key */
+static guint name_index_lower_bound(FmDesktop* desktop, const char* key)
+{
+    guint lo = 0, hi = desktop->name_index->len;
+    while(lo < hi)
+    {
+        guint mid = (lo + hi) / 2;
+        FmDesktopItem* item = (FmDesktopItem*)g_ptr_array_index(desktop->name_index, mid);
+        if(strcmp(item->search_key, key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void name_index_insert(FmDesktop* desktop, FmDesktopItem* item)
+{
+    guint pos = name_index_lower_bound(desktop, item->search_key);
+    gpointer* pdata;
+    g_ptr_array_add(desktop->name_index, NULL);
+    pdata = desktop->name_index->pdata;
+    memmove(pdata + pos + 1, pdata + pos, (desktop->name_index->len - 1 - pos) * sizeof(gpointer));
+    pdata[pos] = item;
+}
+
+static void name_index_remove(FmDesktop* desktop, FmDesktopItem* item)
+{
+    guint pos = name_index_lower_bound(desktop, item->search_key);
+    /* the item is one of the items with the same key */
+    for(; pos < desktop->name_index->len; ++pos)
+    {
+        FmDesktopItem* item2 = (FmDesktopItem*)g_ptr_array_index(desktop->name_index, pos);
+        if(item2 == item)
+        {
+            g_ptr_array_remove_index(desktop->name_index, pos);
+            break;
+        }
+        if(strcmp(item2->search_key, item->search_key) != 0)
+            break;
+    }
+}
+
+/* update item->index of the items starting from the idx-th one */
+static void renumber_items(FmDesktop* desktop, guint idx)
+{
+    for(; idx < desktop->items->len; ++idx)
+        get_item(desktop, idx)->index = idx;
+}
+
+static void set_item_fixed(FmDesktop* desktop, FmDesktopItem* item, gboolean fixed)
+{
+    if(item->fixed_pos == fixed)
+        return;
+    item->fixed_pos = fixed;
+    if(fixed)
+        g_queue_push_tail_link(&desktop->fixed_items, &item->fixed_link);
+    else
+        g_queue_unlink(&desktop->fixed_items, &item->fixed_link);
+}
+
+/* NOTE: the item is not redrawn by this function. */
+static void set_item_selected(FmDesktop* desktop, FmDesktopItem* item, gboolean selected)
+{
+    if(item->is_selected == selected)
+        return;
+    item->is_selected = selected;
+    if(selected)
+        g_queue_push_tail_link(&desktop->selected, &item->sel_link);
+    else
+        g_queue_unlink(&desktop->selected, &item->sel_link);
+}
+
 void on_row_inserted(GtkTreeModel* mod, GtkTreePath* tp, GtkTreeIter* it, FmDesktop* desktop)
 {
     FmDesktopItem* item = desktop_item_new(it);
-    desktop->items = g_list_insert(desktop->items, item, gtk_tree_path_get_indices(tp)[0]);
-    queue_layout_items(desktop);
+    guint idx = gtk_tree_path_get_indices(tp)[0];
+    gpointer* pdata;
+
+    /* insert the item at idx, keeping the array in the order of the model */
+    g_ptr_array_add(desktop->items, NULL);
+    pdata = desktop->items->pdata;
+    idx = MIN(idx, desktop->items->len - 1);
+    memmove(pdata + idx + 1, pdata + idx, (desktop->items->len - 1 - idx) * sizeof(gpointer));
+    pdata[idx] = item;
+    renumber_items(desktop, idx);
+    g_hash_table_insert(desktop->item_hash, it->user_data, item);
+    name_index_insert(desktop, item);
+
+    queue_layout_items_from(desktop, idx);
 }
 
 void on_row_deleted(GtkTreeModel* mod, GtkTreePath* tp, FmDesktop* desktop)
 {
-    GList* l;
-    int i = 0, idx = gtk_tree_path_get_indices(tp)[0];
-    for(l=desktop->items;l;l=l->next, ++i)
+    FmDesktopItem* item;
+    guint idx = gtk_tree_path_get_indices(tp)[0];
+
+    if(idx >= desktop->items->len)
+        return;
+    item = get_item(desktop, idx);
+
+    if (item->fixed_pos)
     {
-        FmDesktopItem* item = (FmDesktopItem*)l->data;
-        if(i == idx)
-        {
-            if (item->fixed_pos)
-                desktop->fixed_items = g_list_remove(desktop->fixed_items, item);
+        /* the file is deleted, so is its position */
+        set_item_fixed(desktop, item, FALSE);
+        save_item_pos(desktop, item);
+        /* the cells occupied by the item are free now */
+        idx = 0;
+    }
+    set_item_selected(desktop, item, FALSE);
+    g_hash_table_remove(desktop->item_hash, item->it.user_data);
+    name_index_remove(desktop, item);
+    if(item->stack)
+    {
+        g_ptr_array_remove(item->stack->items, item);
+        /* the last item of the expanded stack is deleted */
+        if(item->stack == desktop->expanded_stack && item->stack->items->len == 0)
+            collapse_stack(desktop);
+    }
+    if(item->icon_pending)
+        --desktop->n_icons_pending;
 
-            desktop_item_free(item);
-            if(desktop->focus == item)
-            {
-                if(l->next)
-                    desktop->focus = (FmDesktopItem*)l->next->data;
-                else if(l->prev)
-                    desktop->focus = (FmDesktopItem*)l->prev->data;
-                else
-                    desktop->focus = NULL;
-            }
-            if(desktop->drop_hilight == item)
-                desktop->drop_hilight = NULL;
-            if(desktop->hover_item == item)
-                desktop->hover_item = NULL;
-            desktop->items = g_list_delete_link(desktop->items, l);
-            break;
-        }
+    if(desktop->focus == item)
+    {
+        if(item->index + 1 < desktop->items->len)
+            desktop->focus = get_item(desktop, item->index + 1);
+        else if(item->index > 0)
+            desktop->focus = get_item(desktop, item->index - 1);
+        else
+            desktop->focus = NULL;
     }
+    if(desktop->drop_hilight == item)
+        desktop->drop_hilight = NULL;
+    if(desktop->hover_item == item)
+        desktop->hover_item = NULL;
 
-    queue_layout_items(desktop);
+    g_ptr_array_remove_index(desktop->items, item->index);
+    renumber_items(desktop, item->index);
+    grid_remove_item(desktop, item);
+    desktop_item_free(item);
+
+    queue_layout_items_from(desktop, idx);
 }
 
 void on_row_changed(GtkTreeModel* mod, GtkTreePath* tp, GtkTreeIter* it, FmDesktop* desktop)
 {
-    GList* l;
-    for(l=desktop->items;l;l=l->next)
+    FmDesktopItem* item = (FmDesktopItem*)g_hash_table_lookup(desktop->item_hash, it->user_data);
+    if(item)
     {
-        FmDesktopItem* item = (FmDesktopItem*)l->data;
-        if(item->it.user_data == it->user_data)
+        FmFileInfo* old_fi = item->fi;
+        char* key;
+        gtk_tree_model_get(mod, it, COL_FILE_INFO, &item->fi, -1);
+        key = get_search_key(fm_file_info_get_disp_name(item->fi));
+        if(strcmp(key, item->search_key) != 0)
         {
-            if(item->icon)
-                g_object_unref(item->icon);
-            gtk_tree_model_get(mod, it, COL_FILE_ICON, &item->icon, COL_FILE_INFO, &item->fi, -1);
-            redraw_item(desktop, item);
-            /* FIXME: check if sorting of files is changed. */
-            break;
+            name_index_remove(desktop, item);
+            g_free(item->search_key);
+            item->search_key = key;
+            name_index_insert(desktop, item);
         }
+        else
+            g_free(key);
+        /* the thumbnail is loaded again if the file is changed */
+        update_item_thumbnail(desktop, item);
+        /* the icon is loaded here only if it's changed. if it's being
+         * reloaded, it's updated by on_idle_load_icons() later. */
+        if(item->fi->icon != item->icon_src)
+            update_item_icon(desktop, item);
+        else if(item->fi == old_fi && item->pl
+                && strcmp(pango_layout_get_text(item->pl), fm_file_info_get_disp_name(item->fi)) == 0)
+            return; /* nothing to be drawn is changed */
+        /* the display name may be changed, shape the label again */
+        item->pl_name = NULL;
+        free_item_surfaces(item);
+        redraw_item(desktop, item);
+        grid_remove_item(desktop, item);
+        calc_item_size(desktop, item);
+        grid_insert_item(desktop, item);
+        redraw_item(desktop, item);
+        /* FIXME: check if sorting of files is changed. */
     }
     /* queue_layout_items(desktop); */
 }
 
 void on_rows_reordered(GtkTreeModel* mod, GtkTreePath* parent_tp, GtkTreeIter* parent_it, gpointer arg3, FmDesktop* desktop)
 {
-    GtkTreeIter it;
-    GList* new_items = NULL;
-    if(!gtk_tree_model_get_iter_first(mod, &it))
+    /* new_order[i] is the old position of the item now at position i */
+    gint* new_order = (gint*)arg3;
+    gpointer* old_items;
+    guint i, n = desktop->items->len;
+
+    if(n == 0)
         return;
-    do
+    old_items = g_memdup(desktop->items->pdata, n * sizeof(gpointer));
+    for(i = 0; i < n; ++i)
     {
-        GList* l;
-        for(l = desktop->items; l; l=l->next)
-        {
-            FmDesktopItem* item = (FmDesktopItem*)l->data;
-            if(item->it.user_data == it.user_data)
-            {
-                desktop->items = g_list_remove_link(desktop->items, l);
-                new_items = g_list_concat(l, new_items);
-                break;
-            }
-        }
-    }while(gtk_tree_model_iter_next(mod, &it));
-    desktop->items = g_list_reverse(new_items);
+        FmDesktopItem* item = (FmDesktopItem*)old_items[new_order[i]];
+        desktop->items->pdata[i] = item;
+        item->index = i;
+    }
+    g_free(old_items);
     queue_layout_items(desktop);
 }
 
 
+/* get the shaped label of the item. the text is only shaped again if
+ * the display name, the font, or the wrap width is changed. */
+static PangoLayout* get_item_layout(FmDesktop* desktop, FmDesktopItem* item)
+{
+    const char* name = fm_file_info_get_disp_name(item->fi);
+    if(item->pl && item->pl_stamp == desktop->text_stamp && item->pl_name == name)
+        return item->pl;
+
+    if(!item->pl)
+    {
+        item->pl = gtk_widget_create_pango_layout( (GtkWidget*)desktop, NULL );
+        pango_layout_set_alignment( item->pl, PANGO_ALIGN_CENTER );
+        pango_layout_set_ellipsize( item->pl, PANGO_ELLIPSIZE_END );
+        pango_layout_set_wrap(item->pl, PANGO_WRAP_WORD_CHAR);
+    }
+    else
+        pango_layout_context_changed(item->pl);
+    pango_layout_set_height(item->pl, desktop->pango_text_h);
+    pango_layout_set_width(item->pl, desktop->pango_text_w);
+    pango_layout_set_text(item->pl, name, -1);
+    pango_layout_get_pixel_extents(item->pl, NULL, &item->text_extents);
+    free_item_surfaces(item);
+
+    item->pl_name = name;
+    item->pl_stamp = desktop->text_stamp;
+    return item->pl;
+}
+
+/* make all labels be shaped again when they are laid out next time */
+static void invalidate_text_layouts(FmDesktop* desktop)
+{
+    desktop->font_h = 0;
+    ++desktop->text_stamp;
+    /* the size of the labels may be changed even if the cells are not */
+    queue_layout_items(desktop);
+    queue_redraw(desktop, NULL);
+    gtk_widget_queue_resize(GTK_WIDGET(desktop));
+}
+
+/* load the icon of the item, which is done only when it's shown */
+static void materialize_item(FmDesktop* desktop, FmDesktopItem* item)
+{
+    item->materialized = TRUE;
+    if(item->fi->icon)
+    {
+        GdkPixbuf* icon;
+        item->icon_src = fm_icon_ref(item->fi->icon);
+        icon = get_icon_pixbuf(item->icon_src);
+        item->icon = icon ? (GdkPixbuf*)g_object_ref(icon) : NULL;
+    }
+    /* the icon is shown until the thumbnail is loaded */
+    update_item_thumbnail(desktop, item);
+}
+
+/* Calculate the rects of the item. Items placed outside of the screen
+ * are not materialized: their icons are not loaded and their labels are
+ * not shaped until they are moved onto the screen, so a desktop with
+ * lots of files only pays for the items it can show. Such items get the
+ * rects of an item with the full-sized icon and label. */
 void calc_item_size(FmDesktop* desktop, FmDesktopItem* item)
 {
-    //int text_x, text_y, text_w, text_h;    /* Probably goes along with the FIXME in this function */
-    PangoRectangle rc, rc2;
+    PangoRectangle* rc2 = &item->text_extents;
+
+    if(!item->materialized)
+    {
+        GdkScreen* screen = gtk_widget_get_screen((GtkWidget*)desktop);
+        if(item->x + (int)desktop->cell_w <= 0 || item->y + (int)desktop->cell_h <= 0
+           || item->x >= gdk_screen_get_width(screen) || item->y >= gdk_screen_get_height(screen))
+        {
+            item->icon_rect.width = fm_config->big_icon_size;
+            item->icon_rect.height = fm_config->big_icon_size + desktop->spacing;
+            item->icon_rect.x = item->x + (desktop->cell_w - fm_config->big_icon_size) / 2;
+            item->icon_rect.y = item->y + desktop->ypad;
+            item->text_rect.width = desktop->text_w;
+            item->text_rect.height = desktop->text_h;
+            item->text_rect.x = item->x + (desktop->cell_w - desktop->text_w) / 2;
+            item->text_rect.y = item->icon_rect.y + item->icon_rect.height;
+            return;
+        }
+        materialize_item(desktop, item);
+    }
 
     /* icon rect */
     if(item->icon)
@@ -1415,19 +2427,12 @@ void calc_item_size(FmDesktop* desktop, FmDesktopItem* item)
     }
 
     /* text label rect */
-    pango_layout_set_text(desktop->pl, NULL, 0);
-    /* FIXME: we should cache text_h * PANGO_SCALE and text_w * PANGO_SCALE */
-    pango_layout_set_height(desktop->pl, desktop->pango_text_h);
-    pango_layout_set_width(desktop->pl, desktop->pango_text_w);
-    pango_layout_set_text(desktop->pl, fm_file_info_get_disp_name(item->fi), -1);
-
-    pango_layout_get_pixel_extents(desktop->pl, &rc, &rc2);
-    pango_layout_set_text(desktop->pl, NULL, 0);
+    get_item_layout(desktop, item);
 
-    item->text_rect.x = item->x + (desktop->cell_w - rc2.width - 4) / 2;
-    item->text_rect.y = item->icon_rect.y + item->icon_rect.height + rc2.y;
-    item->text_rect.width = rc2.width + 4;
-    item->text_rect.height = rc2.height + 4;
+    item->text_rect.x = item->x + (desktop->cell_w - rc2->width - 4) / 2;
+    item->text_rect.y = item->icon_rect.y + item->icon_rect.height + rc2->y;
+    item->text_rect.width = rc2->width + 4;
+    item->text_rect.height = rc2->height + 4;
 }
 
 static inline void get_item_rect(FmDesktopItem* item, GdkRectangle* rect)
@@ -1435,159 +2440,1096 @@ static inline void get_item_rect(FmDesktopItem* item, GdkRectangle* rect)
     gdk_rectangle_union(&item->icon_rect, &item->text_rect, rect);
 }
 
-static gboolean is_pos_occupied(FmDesktop* desktop, FmDesktopItem* item)
+/*
+ * Items without a fixed position are placed into the layout cells of
+ * the working areas of the monitors, the primary one first, and column
+ * by column in each of them. The cells are numbered in this order, and
+ * item->slot is the number of the cell an item is placed in. The items
+ * which don't fit are placed beyond the edge of the screen, as if there
+ * were another monitor there. Cells covered by fixed items are marked
+ * in the bitmap desktop->occupied so they can be skipped without
+ * checking every fixed item.
+ */
+
+/* division rounded towards negative infinity */
+static inline int div_floor(int a, int b)
+{
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/* get the column of layout cells containing the x coordinate */
+static inline int get_layout_col(FmDesktop* desktop, int x0, int x)
+{
+    int cell_w = MAX(desktop->cell_w, 1);
+    if(gtk_widget_get_direction(GTK_WIDGET(desktop)) != GTK_TEXT_DIR_RTL) /* LTR or NONE */
+        return div_floor(x - x0, cell_w);
+    return div_floor(x0 + cell_w - 1 - x, cell_w); /* RTL */
+}
+
+static void init_layout_area(FmDesktop* desktop, FmDesktopLayoutArea* area, GdkRectangle* wa)
+{
+    int cell_w = MAX((int)desktop->cell_w, 1), cell_h = MAX((int)desktop->cell_h, 1);
+    area->rect = *wa;
+    if(gtk_widget_get_direction(GTK_WIDGET(desktop)) != GTK_TEXT_DIR_RTL) /* LTR or NONE */
+        area->x0 = wa->x + desktop->xmargin;
+    else /* RTL */
+        area->x0 = wa->x + wa->width - desktop->xmargin - cell_w;
+    area->y0 = wa->y + desktop->ymargin;
+    area->cols = MAX((wa->width - 2 * (int)desktop->xmargin) / cell_w, 1);
+    area->rows = MAX((wa->height - 2 * (int)desktop->ymargin - cell_h) / cell_h + 1, 1);
+}
+
+static void update_layout_areas(FmDesktop* desktop)
+{
+    GdkScreen* screen = gtk_widget_get_screen((GtkWidget*)desktop);
+    FmDesktopLayoutArea* area;
+    GdkRectangle rect;
+    guint i, k, n = 0;
+    int slot = 0;
+
+    g_free(desktop->layout_areas);
+    desktop->layout_areas = g_new(FmDesktopLayoutArea, desktop->monitors->len + 1);
+    for(i = 0; i < desktop->monitors->len; ++i)
+    {
+        FmDesktopMonitor* mon = (FmDesktopMonitor*)g_ptr_array_index(desktop->monitors, i);
+        /* cloned monitors show the same items */
+        for(k = 0; k < i; ++k)
+        {
+            FmDesktopMonitor* prev = (FmDesktopMonitor*)g_ptr_array_index(desktop->monitors, k);
+            if(gdk_rectangle_intersect(&prev->geometry, &mon->geometry, &rect)
+               && rect.width == mon->geometry.width && rect.height == mon->geometry.height)
+                break;
+        }
+        if(k < i)
+            continue;
+        area = &desktop->layout_areas[n++];
+        init_layout_area(desktop, area, &mon->working_area);
+        area->first_slot = slot;
+        slot += area->cols * area->rows;
+    }
+
+    /* the area off the screen has the rows of the primary monitor */
+    rect = n > 0 ? desktop->layout_areas[0].rect : desktop->working_area;
+    rect.x = 0;
+    rect.width = 0;
+    area = &desktop->layout_areas[n++];
+    init_layout_area(desktop, area, &rect);
+    if(gtk_widget_get_direction(GTK_WIDGET(desktop)) != GTK_TEXT_DIR_RTL) /* LTR or NONE */
+        area->x0 = gdk_screen_get_width(screen) + desktop->xmargin;
+    else /* RTL */
+        area->x0 = -(int)desktop->xmargin - MAX((int)desktop->cell_w, 1);
+    area->first_slot = slot;
+    area->cols = (G_MAXINT - slot) / area->rows;
+    desktop->n_layout_areas = n;
+}
+
+static inline FmDesktopLayoutArea* get_slot_area(FmDesktop* desktop, int slot)
+{
+    guint i = desktop->n_layout_areas - 1;
+    while(i > 0 && slot < desktop->layout_areas[i].first_slot)
+        --i;
+    return &desktop->layout_areas[i];
+}
+
+/* number of the layout cells on the screen */
+static inline int get_n_screen_slots(FmDesktop* desktop)
+{
+    return desktop->layout_areas[desktop->n_layout_areas - 1].first_slot;
+}
+
+static inline void get_slot_pos(FmDesktop* desktop, int slot, int* x, int* y)
+{
+    FmDesktopLayoutArea* area = get_slot_area(desktop, slot);
+    int col = (slot - area->first_slot) / area->rows;
+    int row = (slot - area->first_slot) % area->rows;
+    if(gtk_widget_get_direction(GTK_WIDGET(desktop)) != GTK_TEXT_DIR_RTL) /* LTR or NONE */
+        *x = area->x0 + col * (int)desktop->cell_w;
+    else /* RTL */
+        *x = area->x0 - col * (int)desktop->cell_w;
+    *y = area->y0 + row * (int)desktop->cell_h;
+}
+
+static inline gboolean is_slot_occupied(FmDesktop* desktop, int slot)
+{
+    if((guint)slot >= desktop->occupied_slots)
+        return FALSE;
+    return (desktop->occupied[slot >> 3] & (1 << (slot & 7))) != 0;
+}
+
+/* get the range of layout cells of the area covered by a fixed item.
+ * returns FALSE if no cell of the area is covered. */
+static gboolean get_occupied_cells(FmDesktop* desktop, FmDesktopLayoutArea* area, GdkRectangle* rect,
+                                   int* col1, int* col2, int* row1, int* row2)
+{
+    int tmp;
+    int cell_h = MAX(desktop->cell_h, 1);
+
+    *col1 = get_layout_col(desktop, area->x0, rect->x);
+    *col2 = get_layout_col(desktop, area->x0, rect->x + rect->width - 1);
+    if(*col1 > *col2) /* RTL */
+    {
+        tmp = *col1;
+        *col1 = *col2;
+        *col2 = tmp;
+    }
+    *row1 = div_floor(rect->y - area->y0, cell_h);
+    *row2 = div_floor(rect->y + rect->height - 1 - area->y0, cell_h);
+    if(*col2 < 0 || *row2 < 0 || *col1 >= area->cols || *row1 >= area->rows)
+        return FALSE;
+    *col1 = MAX(*col1, 0);
+    *col2 = MIN(*col2, area->cols - 1);
+    *row1 = MAX(*row1, 0);
+    *row2 = MIN(*row2, area->rows - 1);
+    return TRUE;
+}
+
+static void update_occupied_cells(FmDesktop* desktop)
 {
     GList* l;
-    for(l = desktop->fixed_items; l; l=l->next)
+    GdkRectangle rect;
+    FmDesktopLayoutArea* area;
+    int col1, col2, row1, row2, col, row;
+    guint i, n_slots = 0;
+
+    update_layout_areas(desktop);
+
+    for(l = desktop->fixed_items.head; l; l = l->next)
     {
-        FmDesktopItem* fixed = (FmDesktopItem*)l->data;
-        if (fixed == item)
+        FmDesktopItem* item = (FmDesktopItem*)l->data;
+        /* the size of the label may be changed */
+        redraw_item(desktop, item);
+        grid_remove_item(desktop, item);
+        calc_item_size(desktop, item);
+        grid_insert_item(desktop, item);
+        redraw_item(desktop, item);
+        get_item_rect(item, &rect);
+        if(rect.width <= 0 || rect.height <= 0)
             continue;
-        GdkRectangle rect;
-        get_item_rect(fixed, &rect);
-        if(gdk_rectangle_intersect(&rect, &item->icon_rect, NULL)
-         ||gdk_rectangle_intersect(&rect, &item->text_rect, NULL))
+        for(i = 0; i < desktop->n_layout_areas; ++i)
+        {
+            area = &desktop->layout_areas[i];
+            if(get_occupied_cells(desktop, area, &rect, &col1, &col2, &row1, &row2))
+                n_slots = MAX(n_slots, (guint)(area->first_slot + col2 * area->rows + row2 + 1));
+        }
+    }
+
+    g_free(desktop->occupied);
+    desktop->occupied = g_new0(guint8, (n_slots + 7) / 8);
+    desktop->occupied_slots = n_slots;
+
+    for(l = desktop->fixed_items.head; l; l = l->next)
+    {
+        FmDesktopItem* item = (FmDesktopItem*)l->data;
+        get_item_rect(item, &rect);
+        if(rect.width <= 0 || rect.height <= 0)
+            continue;
+        for(i = 0; i < desktop->n_layout_areas; ++i)
+        {
+            area = &desktop->layout_areas[i];
+            if(!get_occupied_cells(desktop, area, &rect, &col1, &col2, &row1, &row2))
+                continue;
+            for(col = col1; col <= col2; ++col)
+            {
+                for(row = row1; row <= row2; ++row)
+                {
+                    guint bit = area->first_slot + col * area->rows + row;
+                    desktop->occupied[bit >> 3] |= (1 << (bit & 7));
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Stacks mode.
+ * If there are more auto-placed items than free cells in the working
+ * area, the items which don't fit are collapsed into stacks by their
+ * type or modification time, and only the stacks are placed in the last
+ * free cells. Items in a stack are not laid out nor painted until the
+ * stack is expanded, so the number of items shown is bounded by the
+ * size of the screen however many files there are.
+ */
+
+static guint get_stack_kind(FmFileInfo* fi, time_t today)
+{
+    if(app_config->desktop_stacks == FM_STACK_BY_DATE)
+    {
+        time_t mtime = fm_file_info_get_mtime(fi);
+        if(mtime >= today)
+            return 0;
+        if(mtime >= today - 6 * 24 * 3600)
+            return 1;
+        if(mtime >= today - 29 * 24 * 3600)
+            return 2;
+        if(mtime >= today - 364 * 24 * 3600)
+            return 3;
+        return 4;
+    }
+    else
+    {
+        FmMimeType* mime_type;
+        const char* type;
+        if(fm_file_info_is_dir(fi))
+            return 0;
+        mime_type = fm_file_info_get_mime_type(fi);
+        type = mime_type ? fm_mime_type_get_type(mime_type) : NULL;
+        if(!type)
+            return 7;
+        if(g_str_has_prefix(type, "image/"))
+            return 1;
+        if(g_str_has_prefix(type, "audio/"))
+            return 2;
+        if(g_str_has_prefix(type, "video/"))
+            return 3;
+        if(g_str_has_prefix(type, "application/vnd.") || strcmp(type, "application/pdf") == 0
+           || strcmp(type, "application/msword") == 0 || strcmp(type, "application/rtf") == 0)
+            return 4;
+        if(g_str_has_prefix(type, "text/"))
+            return 5;
+        if(strcmp(type, "application/x-desktop") == 0 || strcmp(type, "application/x-executable") == 0
+           || strcmp(type, "application/x-shellscript") == 0)
+            return 6;
+        return 7;
+    }
+}
+
+static inline const StackKind* get_stack_kinds(guint* n_kinds)
+{
+    if(app_config->desktop_stacks == FM_STACK_BY_DATE)
+    {
+        *n_kinds = G_N_ELEMENTS(date_stacks);
+        return date_stacks;
+    }
+    *n_kinds = G_N_ELEMENTS(type_stacks);
+    return type_stacks;
+}
+
+/* decide how many auto-placed items are laid out before the rest are
+ * collapsed into stacks. called before a full relayout. */
+static void prepare_stacks(FmDesktop* desktop)
+{
+    guint i, k, n_auto, n_free = 0, n_stacks, n_reserved;
+    int slot, n_slots;
+    gboolean used[N_STACKS];
+
+    /* the stacks are placed again after the items */
+    for(k = 0; k < N_STACKS; ++k)
+        if(desktop->stacks[k].items->len > 0)
+            redraw_stack(desktop, &desktop->stacks[k]);
+    /* the items of the expanded stack are laid out again later */
+    if(desktop->expanded_stack)
+    {
+        GPtrArray* items = desktop->expanded_stack->items;
+        for(i = 0; i < items->len; ++i)
+        {
+            FmDesktopItem* item = (FmDesktopItem*)g_ptr_array_index(items, i);
+            if(item->in_overlay)
+            {
+                grid_remove_item(desktop, item);
+                item->in_overlay = FALSE;
+            }
+        }
+    }
+    for(k = 0; k < N_STACKS; ++k)
+        g_ptr_array_set_size(desktop->stacks[k].items, 0);
+    desktop->layout_n_auto = 0;
+    desktop->n_unstacked = G_MAXUINT;
+
+    if(app_config->desktop_stacks == FM_STACK_NONE)
+        return;
+    n_auto = desktop->items->len - desktop->fixed_items.length;
+    n_slots = get_n_screen_slots(desktop);
+    for(slot = 0; slot < n_slots && n_free <= n_auto; ++slot)
+    {
+        if(!is_slot_occupied(desktop, slot))
+            ++n_free;
+    }
+    if(n_auto <= n_free)
+        return;
+
+    if(app_config->desktop_stacks == FM_STACK_BY_DATE)
+    {
+        time_t now = time(NULL);
+        struct tm tm;
+        localtime_r(&now, &tm);
+        tm.tm_sec = tm.tm_min = tm.tm_hour = 0;
+        now = mktime(&tm); /* the beginning of today */
+        for(i = 0; i < desktop->items->len; ++i)
+            get_item(desktop, i)->stack_kind = get_stack_kind(get_item(desktop, i)->fi, now);
+    }
+    else
+    {
+        for(i = 0; i < desktop->items->len; ++i)
+            get_item(desktop, i)->stack_kind = get_stack_kind(get_item(desktop, i)->fi, 0);
+    }
+
+    /* a free cell is needed for every stack, and the more cells are
+     * reserved, the more items are stacked. */
+    n_stacks = 0;
+    do
+    {
+        guint n = 0;
+        n_reserved = n_stacks;
+        memset(used, 0, sizeof(used));
+        for(i = 0, k = 0; i < desktop->items->len; ++i)
+        {
+            FmDesktopItem* item = get_item(desktop, i);
+            if(item->fixed_pos)
+                continue;
+            if(k++ + n_reserved >= n_free && !used[item->stack_kind])
+            {
+                used[item->stack_kind] = TRUE;
+                ++n;
+            }
+        }
+        n_stacks = n;
+    }while(n_stacks > n_reserved);
+    desktop->n_unstacked = n_free > n_reserved ? n_free - n_reserved : 0;
+}
+
+static void calc_stack_size(FmDesktop* desktop, FmDesktopStack* stack, const StackKind* kind)
+{
+    PangoRectangle rc;
+    char* label;
+
+    if(stack->icon)
+        g_object_unref(stack->icon);
+    stack->icon = gtk_icon_theme_load_icon(gtk_icon_theme_get_default(), kind->icon_name,
+                                           fm_config->big_icon_size, 0, NULL);
+    if(!stack->pl)
+    {
+        stack->pl = gtk_widget_create_pango_layout((GtkWidget*)desktop, NULL);
+        pango_layout_set_alignment(stack->pl, PANGO_ALIGN_CENTER);
+        pango_layout_set_ellipsize(stack->pl, PANGO_ELLIPSIZE_END);
+        pango_layout_set_wrap(stack->pl, PANGO_WRAP_WORD_CHAR);
+    }
+    else
+        pango_layout_context_changed(stack->pl);
+    pango_layout_set_height(stack->pl, desktop->pango_text_h);
+    pango_layout_set_width(stack->pl, desktop->pango_text_w);
+    label = g_strdup_printf("%s (%u)", _(kind->title), stack->items->len);
+    pango_layout_set_text(stack->pl, label, -1);
+    g_free(label);
+    pango_layout_get_pixel_extents(stack->pl, NULL, &rc);
+
+    /* the pile is 4 pixels larger than the icon */
+    stack->icon_rect.width = fm_config->big_icon_size + 4;
+    stack->icon_rect.height = fm_config->big_icon_size + 4;
+    stack->icon_rect.x = stack->x + (desktop->cell_w - stack->icon_rect.width) / 2;
+    stack->icon_rect.y = stack->y + desktop->ypad - 4;
+    stack->icon_rect.height += desktop->spacing;
+    stack->text_rect.x = stack->x + (desktop->cell_w - rc.width - 4) / 2;
+    stack->text_rect.y = stack->icon_rect.y + stack->icon_rect.height + rc.y;
+    stack->text_rect.width = rc.width + 4;
+    stack->text_rect.height = rc.height + 4;
+}
+
+static inline void redraw_stack(FmDesktop* desktop, FmDesktopStack* stack)
+{
+    GdkRectangle rect;
+    gdk_rectangle_union(&stack->icon_rect, &stack->text_rect, &rect);
+    queue_redraw(desktop, &rect);
+}
+
+/* place the stacks in the free cells after the last auto-placed item */
+static void place_stacks(FmDesktop* desktop, int slot)
+{
+    guint k, n_kinds;
+    const StackKind* kinds = get_stack_kinds(&n_kinds);
+
+    for(k = 0; k < n_kinds; ++k)
+    {
+        FmDesktopStack* stack = &desktop->stacks[k];
+        if(stack->items->len == 0)
+            continue;
+        while(is_slot_occupied(desktop, slot))
+            ++slot;
+        get_slot_pos(desktop, slot++, &stack->x, &stack->y);
+        calc_stack_size(desktop, stack, &kinds[k]);
+        redraw_stack(desktop, stack);
+    }
+
+    if(desktop->expanded_stack)
+    {
+        if(desktop->expanded_stack->items->len > 0)
+            layout_overlay(desktop);
+        else
+            collapse_stack(desktop);
+    }
+}
+
+FmDesktopStack* hit_test_stack(FmDesktop* self, int x, int y)
+{
+    guint k;
+    if(!self->stacks || (self->expanded_stack && is_point_in_rect(&self->overlay_rect, x, y)))
+        return NULL;
+    for(k = 0; k < N_STACKS; ++k)
+    {
+        FmDesktopStack* stack = &self->stacks[k];
+        if(stack->items->len > 0 && (is_point_in_rect(&stack->icon_rect, x, y)
+                                     || is_point_in_rect(&stack->text_rect, x, y)))
+            return stack;
+    }
+    return NULL;
+}
+
+static void hide_overlay_items(FmDesktop* desktop)
+{
+    GPtrArray* items = desktop->expanded_stack->items;
+    guint i;
+    for(i = 0; i < items->len; ++i)
+    {
+        FmDesktopItem* item = (FmDesktopItem*)g_ptr_array_index(items, i);
+        if(item->in_overlay)
+        {
+            grid_remove_item(desktop, item);
+            item->in_overlay = FALSE;
+        }
+    }
+    queue_redraw(desktop, &desktop->overlay_rect);
+}
+
+/* number of items in a page of the overlay, which takes at most 2/3
+ * of the working area of the primary monitor. */
+static guint get_overlay_page_size(FmDesktop* desktop)
+{
+    GdkRectangle* wa = get_primary_working_area(desktop);
+    int max_cols = MAX((wa->width * 2 / 3 - 2 * OVERLAY_PADDING) / MAX((int)desktop->cell_w, 1), 1);
+    int max_rows = MAX((wa->height * 2 / 3 - 2 * OVERLAY_PADDING) / MAX((int)desktop->cell_h, 1), 1);
+    return max_cols * max_rows;
+}
+
+/* Lay out the current page of items of the expanded stack in the overlay */
+void layout_overlay(FmDesktop* desktop)
+{
+    GPtrArray* items = desktop->expanded_stack->items;
+    GdkRectangle* wa = get_primary_working_area(desktop);
+    int cell_w = MAX((int)desktop->cell_w, 1), cell_h = MAX((int)desktop->cell_h, 1);
+    int max_cols, cols, rows;
+    guint i, per_page, n_pages, first, n;
+
+    if(items->len == 0) /* there is no page to show */
+    {
+        collapse_stack(desktop);
+        return;
+    }
+    hide_overlay_items(desktop);
+
+    per_page = get_overlay_page_size(desktop);
+    max_cols = MAX((wa->width * 2 / 3 - 2 * OVERLAY_PADDING) / cell_w, 1);
+    n_pages = (items->len + per_page - 1) / per_page;
+    if(desktop->overlay_page >= n_pages)
+        desktop->overlay_page = n_pages - 1;
+    first = desktop->overlay_page * per_page;
+    n = MIN(per_page, items->len - first);
+
+    /* as square as possible */
+    for(cols = 1; cols < max_cols && (guint)(cols * cols) < n; ++cols)
+        ;
+    rows = (n + cols - 1) / cols;
+    desktop->overlay_rect.width = cols * cell_w + 2 * OVERLAY_PADDING;
+    desktop->overlay_rect.height = rows * cell_h + 2 * OVERLAY_PADDING;
+    desktop->overlay_rect.x = wa->x + (wa->width - desktop->overlay_rect.width) / 2;
+    desktop->overlay_rect.y = wa->y + (wa->height - desktop->overlay_rect.height) / 2;
+
+    for(i = 0; i < n; ++i)
+    {
+        FmDesktopItem* item = (FmDesktopItem*)g_ptr_array_index(items, first + i);
+        item->x = desktop->overlay_rect.x + OVERLAY_PADDING + (i % cols) * cell_w;
+        item->y = desktop->overlay_rect.y + OVERLAY_PADDING + (i / cols) * cell_h;
+        item->in_overlay = TRUE;
+        calc_item_size(desktop, item);
+        grid_insert_item(desktop, item);
+    }
+    queue_redraw(desktop, &desktop->overlay_rect);
+}
+
+void expand_stack(FmDesktop* desktop, FmDesktopStack* stack)
+{
+    if(desktop->expanded_stack)
+        collapse_stack(desktop);
+    desktop->expanded_stack = stack;
+    desktop->overlay_page = 0;
+    layout_overlay(desktop);
+    redraw_stack(desktop, stack);
+}
+
+void collapse_stack(FmDesktop* desktop)
+{
+    FmDesktopStack* stack = desktop->expanded_stack;
+    if(!stack)
+        return;
+    hide_overlay_items(desktop);
+    desktop->expanded_stack = NULL;
+    redraw_stack(desktop, stack);
+}
+
+/* Lay out the items starting from desktop->layout_pos.
+ * If timer is not NULL, stop when the time slice is used up. The grid
+ * is kept up to date and only the moved items are redrawn then, since
+ * the desktop is used between the slices.
+ * Returns TRUE if there are still items left to be laid out. */
+static gboolean layout_items_step(FmDesktop* self, GTimer* timer)
+{
+    guint i, n = 0;
+    int slot = 0;
+
+    if(self->layout_pos == 0) /* relayout everything */
+    {
+        update_occupied_cells(self);
+        prepare_stacks(self);
+    }
+
+    if(self->layout_pos >= self->items->len)
+    {
+        self->layout_pos = G_MAXUINT;
+        place_stacks(self, 0);
+        return FALSE;
+    }
+
+    /* continue from the cell after the last auto-placed item */
+    for(i = self->layout_pos; i > 0; --i)
+    {
+        FmDesktopItem* item = get_item(self, i - 1);
+        if(!item->fixed_pos)
+        {
+            slot = item->slot + 1;
+            break;
+        }
+    }
+
+    for(i = self->layout_pos; i < self->items->len; ++i, ++n)
+    {
+        FmDesktopItem* item = get_item(self, i);
+        if(timer && n >= LAYOUT_CHECK_INTERVAL && n % LAYOUT_CHECK_INTERVAL == 0
+           && g_timer_elapsed(timer, NULL) > LAYOUT_TIME_SLICE)
         {
-            //g_print("%s intersects with %s\n", fm_file_info_get_disp_name(item->fi), fm_file_info_get_disp_name(fixed->fi));
+            self->layout_pos = i;
             return TRUE;
         }
+
+        if(timer && !(item->stack && !item->in_overlay))
+        {
+            redraw_item(self, item);
+            grid_remove_item(self, item);
+        }
+        item->stack = NULL;
+        item->in_overlay = FALSE;
+        if(item->fixed_pos)
+            item->slot = -1;
+        else if(self->layout_n_auto++ >= self->n_unstacked)
+        {
+            /* it's laid out when the stack is expanded */
+            item->slot = -1;
+            item->stack = &self->stacks[item->stack_kind];
+            g_ptr_array_add(item->stack->items, item);
+            continue;
+        }
+        else
+        {
+            /* skip the cells occupied by fixed items */
+            while(is_slot_occupied(self, slot))
+                ++slot;
+            item->slot = slot++;
+            get_slot_pos(self, item->slot, &item->x, &item->y);
+        }
+        calc_item_size(self, item);
+        if(timer)
+        {
+            grid_insert_item(self, item);
+            redraw_item(self, item);
+        }
     }
+    self->layout_pos = G_MAXUINT;
+    place_stacks(self, slot);
     return FALSE;
 }
 
 void layout_items(FmDesktop* self)
 {
-    GList* l;
-    FmDesktopItem* item;
-    int x, y, bottom;
-    GtkTextDirection direction = gtk_widget_get_direction(GTK_WIDGET(self));
+    if(self->idle_layout)
+    {
+        g_source_remove(self->idle_layout);
+        self->idle_layout = 0;
+    }
+    self->layout_pos = 0;
+    layout_items_step(self, NULL);
+    grid_rebuild(self);
+    queue_redraw(self, NULL);
+}
+
+static gboolean on_idle_layout(FmDesktop* desktop)
+{
+    GTimer* timer = g_timer_new();
+    gboolean more = layout_items_step(desktop, timer);
+    g_timer_destroy(timer);
+
+    /* the grid is updated for each slice, but it may not cover all
+     * the items, and their z-order is not set before this. */
+    if(!more)
+    {
+        desktop->idle_layout = 0;
+        grid_rebuild(desktop);
+    }
+    return more;
+}
+
+/* queue a relayout of the items starting from the idx-th one */
+static void queue_layout_items_from(FmDesktop* desktop, guint idx)
+{
+    /* which items are stacked depends on all of them */
+    if(app_config->desktop_stacks != FM_STACK_NONE)
+        idx = 0;
+    if(idx < desktop->layout_pos)
+        desktop->layout_pos = idx;
+    /* while the desktop folder is being loaded, all the items are
+     * laid out in one pass when it's done. see on_model_loaded(). */
+    if(0 == desktop->idle_layout && fm_folder_model_get_is_loaded(model))
+        desktop->idle_layout = g_idle_add((GSourceFunc)on_idle_layout, desktop);
+}
+
+void queue_layout_items(FmDesktop* desktop)
+{
+    queue_layout_items_from(desktop, 0);
+}
+
+static GdkPixbuf* get_link_emblem()
+{
+    if(!link_emblem)
+        link_emblem = gtk_icon_theme_load_icon(gtk_icon_theme_get_default(),
+                                               "emblem-symbolic-link", 16, 0, NULL);
+    return link_emblem;
+}
+
+/* get the area covered by the pre-rendered image of the item */
+static inline void get_item_surface_rect(FmDesktopItem* item, GdkRectangle* rect)
+{
+    gdk_rectangle_union(&item->icon_rect, &item->text_rect, rect);
+    /* 1 pixel more for the shadow of the label */
+    --rect->x;
+    --rect->y;
+    rect->width += 2;
+    rect->height += 2;
+}
+
+static void free_item_surfaces(FmDesktopItem* item)
+{
+    int i;
+    gboolean kept = FALSE;
+    cancel_render_jobs(item);
+    for(i = 0; i < N_ITEM_STATES; ++i)
+    {
+        if(!item->surfaces[i])
+            continue;
+        /* one of the images is kept, so the item is not blank while
+         * the new images are rendered by the workers. */
+        if(!kept)
+        {
+            if(item->stale_surface)
+                cairo_surface_destroy(item->stale_surface);
+            item->stale_surface = item->surfaces[i];
+            kept = TRUE;
+        }
+        else
+            cairo_surface_destroy(item->surfaces[i]);
+        item->surfaces[i] = NULL;
+    }
+}
+
+/*
+ * Rendering of the items.
+ * Everything needed to render an item is copied into an ItemRenderJob,
+ * so the job can be done in a worker thread while the item is changed
+ * in the main thread. The workers shape the labels with their own Pango
+ * context, since Pango objects cannot be shared between threads.
+ */
+struct _ItemRenderJob
+{
+    FmDesktopItem* item; /* NULL if the job is cancelled */
+    FmDesktop* desktop;
+    int state;
+    volatile gint cancelled; /* set by the main thread, read by the worker */
+    guint priority; /* jobs with lower priority are rendered first */
+    guint seq;
+    GdkRectangle area; /* area covered by the image */
+    GdkRectangle icon_rect;
+    GdkRectangle text_rect;
+    int text_x;
+    int text_y;
+    GdkPixbuf* icon;
+    GdkPixbuf* emblem;
+    GdkColor fg;
+    GdkColor shadow;
+    GdkColor sel_bg;
+    GdkColor sel_fg;
+    GdkColor sel_base;
+    /* for shaping the label in the worker */
+    char* text;
+    PangoFontDescription* font;
+    PangoDirection dir;
+    double resolution;
+    cairo_font_options_t* font_options;
+    int pango_text_w;
+    int pango_text_h;
+    cairo_surface_t* surface; /* the result */
+};
+
+static GThreadPool* render_pool = NULL;
+static PangoFontMap* render_font_map = NULL; /* shared by the workers */
+G_LOCK_DEFINE_STATIC(render); /* for render_done and render_done_idle */
+static GSList* render_done = NULL; /* jobs done by the workers */
+static guint render_done_idle = 0;
+static guint render_seq = 0;
+/* PangoContext of the worker, created from render_font_map and freed
+ * when the thread exits */
+#if GLIB_CHECK_VERSION(2, 32, 0)
+static GPrivate render_context = G_PRIVATE_INIT(g_object_unref);
+#else
+static GStaticPrivate render_context = G_STATIC_PRIVATE_INIT;
+#endif
 
-    y = self->working_area.y + self->ymargin;
-    bottom = self->working_area.y + self->working_area.height - self->ymargin - self->cell_h;
+static void fill_render_job(FmDesktop* self, FmDesktopItem* item, int state, ItemRenderJob* job)
+{
+    GtkStyle* style = gtk_widget_get_style((GtkWidget*)self);
+
+    job->desktop = self;
+    job->item = item;
+    job->state = state;
+    get_item_surface_rect(item, &job->area);
+    job->icon_rect = item->icon_rect;
+    job->text_rect = item->text_rect;
+    job->text_x = item->x + (self->cell_w - self->text_w)/2 + 2;
+    job->text_y = item->icon_rect.y + item->icon_rect.height + 2;
+    job->icon = item->icon;
+    job->emblem = fm_file_info_is_symlink(item->fi) ? get_link_emblem() : NULL;
+    job->fg = app_config->desktop_fg;
+    job->shadow = app_config->desktop_shadow;
+    job->sel_bg = style->bg[GTK_STATE_SELECTED];
+    job->sel_fg = style->fg[GTK_STATE_SELECTED];
+    job->sel_base = style->base[GTK_STATE_SELECTED];
+}
+
+/* render the icon and the label of the item into an image surface */
+static cairo_surface_t* render_item_surface(ItemRenderJob* job, PangoLayout* pl)
+{
+    cairo_surface_t* surface;
+    cairo_t* cr;
+    GdkColor* fg;
+
+    surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, job->area.width, job->area.height);
+    cr = cairo_create(surface);
+    /* draw in the coordinates of the desktop */
+    cairo_translate(cr, -job->area.x, -job->area.y);
+
+    if(job->state == ITEM_STATE_SELECTED) /* draw background for text label */
+    {
+        gdk_cairo_rectangle(cr, &job->text_rect);
+        gdk_cairo_set_source_color(cr, &job->sel_bg);
+        cairo_fill(cr);
+        fg = &job->sel_fg;
+    }
+    else
+    {
+        /* the shadow */
+        gdk_cairo_set_source_color(cr, &job->shadow);
+        cairo_move_to(cr, job->text_x + 1, job->text_y + 1);
+        pango_cairo_show_layout(cr, pl);
+        fg = &job->fg;
+    }
+    /* real text */
+    gdk_cairo_set_source_color(cr, fg);
+    cairo_move_to(cr, job->text_x, job->text_y);
+    pango_cairo_show_layout(cr, pl);
+
+    /* draw the icon */
+    if(job->icon)
+    {
+        GdkPixbuf* icon;
+        int icon_x = job->icon_rect.x;
+        int icon_y = job->icon_rect.y;
+        int h = gdk_pixbuf_get_height(job->icon);
+        /* the variants are shared by all items with the same icon */
+        if(job->state == ITEM_STATE_SELECTED)
+            icon = fm_icon_variant_get(job->icon, FM_ICON_VARIANT_SELECTED, &job->sel_base);
+        else
+            icon = (GdkPixbuf*)g_object_ref(job->icon);
+        gdk_cairo_set_source_pixbuf(cr, icon, icon_x, icon_y);
+        cairo_paint(cr);
+        g_object_unref(icon);
+
+        if(job->emblem)
+        {
+            gdk_cairo_set_source_pixbuf(cr, job->emblem, icon_x,
+                                        icon_y + h - gdk_pixbuf_get_height(job->emblem));
+            cairo_paint(cr);
+        }
+    }
+    cairo_destroy(cr);
+    return surface;
+}
+
+/* render the item in the main thread */
+static cairo_surface_t* render_item(FmDesktop* self, FmDesktopItem* item, int state)
+{
+    ItemRenderJob job;
+    fill_render_job(self, item, state, &job);
+    return render_item_surface(&job, get_item_layout(self, item));
+}
+
+static void render_job_free(ItemRenderJob* job)
+{
+    if(job->icon)
+        g_object_unref(job->icon);
+    if(job->emblem)
+        g_object_unref(job->emblem);
+    if(job->surface)
+        cairo_surface_destroy(job->surface);
+    g_free(job->text);
+    pango_font_description_free(job->font);
+    if(job->font_options)
+        cairo_font_options_destroy(job->font_options);
+    g_slice_free(ItemRenderJob, job);
+}
+
+/* install the images rendered by the workers, in the main thread */
+static gboolean on_render_done(gpointer user_data)
+{
+    GSList *jobs, *l;
+
+    G_LOCK(render);
+    jobs = render_done;
+    render_done = NULL;
+    render_done_idle = 0;
+    G_UNLOCK(render);
+
+    for(l = jobs; l; l = l->next)
+    {
+        ItemRenderJob* job = (ItemRenderJob*)l->data;
+        FmDesktopItem* item = job->item;
+        if(item && job->surface)
+        {
+            /* the jobs of an item are cancelled when its images are freed,
+             * so the image still matches the item. */
+            item->render_jobs[job->state] = NULL;
+            item->surfaces[job->state] = job->surface;
+            job->surface = NULL;
+            redraw_item(job->desktop, item);
+        }
+        render_job_free(job);
+    }
+    g_slist_free(jobs);
+    return FALSE;
+}
+
+static void render_thread(gpointer data, gpointer user_data)
+{
+    ItemRenderJob* job = (ItemRenderJob*)data;
+
+    if(!g_atomic_int_get(&job->cancelled))
+    {
+        PangoContext* pc;
+        PangoLayout* pl;
+#if GLIB_CHECK_VERSION(2, 32, 0)
+        pc = (PangoContext*)g_private_get(&render_context);
+#else
+        pc = (PangoContext*)g_static_private_get(&render_context);
+#endif
+        if(!pc)
+        {
+            pc = pango_cairo_font_map_create_context((PangoCairoFontMap*)render_font_map);
+#if GLIB_CHECK_VERSION(2, 32, 0)
+            g_private_set(&render_context, pc);
+#else
+            g_static_private_set(&render_context, pc, g_object_unref);
+#endif
+        }
+        pango_cairo_context_set_resolution(pc, job->resolution);
+        pango_cairo_context_set_font_options(pc, job->font_options);
+        pango_context_set_font_description(pc, job->font);
+        pango_context_set_base_dir(pc, job->dir);
+
+        /* the same as get_item_layout() */
+        pl = pango_layout_new(pc);
+        pango_layout_set_alignment(pl, PANGO_ALIGN_CENTER);
+        pango_layout_set_ellipsize(pl, PANGO_ELLIPSIZE_END);
+        pango_layout_set_wrap(pl, PANGO_WRAP_WORD_CHAR);
+        pango_layout_set_height(pl, job->pango_text_h);
+        pango_layout_set_width(pl, job->pango_text_w);
+        pango_layout_set_text(pl, job->text, -1);
+        job->surface = render_item_surface(job, pl);
+        g_object_unref(pl);
+    }
+
+    G_LOCK(render);
+    render_done = g_slist_prepend(render_done, job);
+    if(!render_done_idle)
+        render_done_idle = g_idle_add(on_render_done, NULL);
+    G_UNLOCK(render);
+}
+
+static gint compare_render_jobs(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    const ItemRenderJob* job1 = (const ItemRenderJob*)a;
+    const ItemRenderJob* job2 = (const ItemRenderJob*)b;
+    if(job1->priority != job2->priority)
+        return job1->priority < job2->priority ? -1 : 1;
+    return job1->seq < job2->seq ? -1 : (job1->seq > job2->seq ? 1 : 0);
+}
+
+/* pango and fontconfig can be used by several threads only since
+ * pango 1.32.6 and fontconfig 2.10.91. the items are rendered in the
+ * main thread with the older versions. */
+static gboolean can_render_in_threads()
+{
+    static int result = -1;
+    if(result < 0)
+        result = (pango_version_check(1, 32, 6) == NULL && FcGetVersion() >= 21091);
+    return result;
+}
+
+/* render the image of the item in a worker thread. it's installed and
+ * the item is redrawn in the main loop when it's done. */
+static void queue_render_item(FmDesktop* self, FmDesktopItem* item, int state, guint priority)
+{
+    ItemRenderJob* job;
+    PangoContext* pc;
+    const cairo_font_options_t* font_options;
 
-    if(direction != GTK_TEXT_DIR_RTL) /* LTR or NONE */
+    if(G_UNLIKELY(!render_pool))
     {
-        x = self->working_area.x + self->xmargin;
-        for( l = self->items; l; l = l->next )
-        {
-            item = (FmDesktopItem*)l->data;
-            if(item->fixed_pos)
-                calc_item_size(self, item);
-            else
-            {
-            _next_position:
-                item->x = x;
-                item->y = y;
-                calc_item_size(self, item);
-                y += self->cell_h;
-                if(y > bottom)
-                {
-                    x += self->cell_w;
-                    y = self->working_area.y + self->ymargin;
-                }
-                /* check if this position is occupied by a fixed item */
-                if(is_pos_occupied(self, item))
-                    goto _next_position;
-            }
-        }
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        /* the fonts are loaded and cached only once for all workers */
+        render_font_map = pango_cairo_font_map_new();
+        render_pool = g_thread_pool_new(render_thread, NULL, MAX(n_cpus, 1), FALSE, NULL);
+        g_thread_pool_set_sort_function(render_pool, compare_render_jobs, NULL);
     }
-    else /* RTL */
+
+    /* the label is shaped here, so its size is known to the layout */
+    get_item_layout(self, item);
+    pc = gtk_widget_get_pango_context((GtkWidget*)self);
+
+    job = g_slice_new0(ItemRenderJob);
+    fill_render_job(self, item, state, job);
+    if(job->icon)
+        g_object_ref(job->icon);
+    if(job->emblem)
+        g_object_ref(job->emblem);
+    job->priority = priority;
+    job->seq = render_seq++;
+    job->text = g_strdup(fm_file_info_get_disp_name(item->fi));
+    job->font = pango_font_description_copy(pango_context_get_font_description(pc));
+    job->dir = gtk_widget_get_direction((GtkWidget*)self) == GTK_TEXT_DIR_RTL
+             ? PANGO_DIRECTION_RTL : PANGO_DIRECTION_LTR;
+    job->resolution = pango_cairo_context_get_resolution(pc);
+    font_options = pango_cairo_context_get_font_options(pc);
+    job->font_options = font_options ? cairo_font_options_copy(font_options) : NULL;
+    job->pango_text_w = self->pango_text_w;
+    job->pango_text_h = self->pango_text_h;
+
+    item->render_jobs[state] = job;
+    g_thread_pool_push(render_pool, job, NULL);
+}
+
+static void cancel_render_jobs(FmDesktopItem* item)
+{
+    int i;
+    for(i = 0; i < N_ITEM_STATES; ++i)
     {
-        x = self->working_area.x + self->working_area.width - self->xmargin - self->cell_w;
-        for( l = self->items; l; l = l->next )
+        ItemRenderJob* job = item->render_jobs[i];
+        if(job)
         {
-            item = (FmDesktopItem*)l->data;
-            if(item->fixed_pos)
-                calc_item_size(self, item);
-            else
-            {
-            _next_position_rtl:
-                item->x = x;
-                item->y = y;
-                calc_item_size(self, item);
-                y += self->cell_h;
-                if(y > bottom)
-                {
-                    x -= self->cell_w;
-                    y = self->working_area.y + self->ymargin;
-                }
-                /* check if this position is occupied by a fixed item */
-                if(is_pos_occupied(self, item))
-                    goto _next_position_rtl;
-            }
+            /* the job is freed in on_render_done() */
+            g_atomic_int_set(&job->cancelled, TRUE);
+            job->item = NULL;
+            item->render_jobs[i] = NULL;
         }
     }
-    gtk_widget_queue_draw( GTK_WIDGET(self) );
 }
 
-static gboolean on_idle_layout(FmDesktop* desktop)
+static inline int get_item_state(FmDesktop* self, FmDesktopItem* item)
 {
-    desktop->idle_layout = 0;
-    layout_items(desktop);
-    return FALSE;
+    if(item->is_selected || item == self->drop_hilight)
+        return ITEM_STATE_SELECTED;
+    return ITEM_STATE_NORMAL;
 }
 
-void queue_layout_items(FmDesktop* desktop)
+/* free the images of the item if they don't match the item anymore */
+static void check_item_surfaces(FmDesktop* self, FmDesktopItem* item, GdkRectangle* area)
 {
-    if(0 == desktop->idle_layout)
-        desktop->idle_layout = g_idle_add((GSourceFunc)on_idle_layout, desktop);
+    get_item_surface_rect(item, area);
+    if(item->surface_stamp != self->surface_stamp
+       || area->width != item->surface_w || area->height != item->surface_h)
+    {
+        free_item_surfaces(item);
+        item->surface_stamp = self->surface_stamp;
+        item->surface_w = area->width;
+        item->surface_h = area->height;
+    }
+}
+
+/* paint the last image of the item while the new one is rendered by a
+ * worker, or only its icon if the size of the item is changed since. */
+static void paint_stale_item(FmDesktopItem* item, cairo_t* cr, GdkRectangle* area,
+                             GdkRectangle* expose_area)
+{
+    cairo_save(cr);
+    gdk_cairo_rectangle(cr, expose_area);
+    cairo_clip(cr);
+    if(item->stale_surface
+       && cairo_image_surface_get_width(item->stale_surface) == area->width
+       && cairo_image_surface_get_height(item->stale_surface) == area->height)
+    {
+        cairo_set_source_surface(cr, item->stale_surface, area->x, area->y);
+        cairo_paint(cr);
+    }
+    else if(item->icon)
+    {
+        gdk_cairo_set_source_pixbuf(cr, item->icon, item->icon_rect.x, item->icon_rect.y);
+        cairo_paint(cr);
+    }
+    cairo_restore(cr);
 }
 
 void paint_item(FmDesktop* self, FmDesktopItem* item, cairo_t* cr, GdkRectangle* expose_area)
 {
     GtkStyle* style;
     GtkWidget* widget = (GtkWidget*)self;
-    GtkCellRendererState state = 0;
-    GdkColor* fg;
-    GdkWindow* window;
-    int text_x, text_y;
+    GdkRectangle area;
+    int state;
     /* g_debug("%s, %d, %d, %d, %d", item->fi->path->name, expose_area->x, expose_area->y, expose_area->width, expose_area->height); */
 
     style = gtk_widget_get_style(widget);
-    window = gtk_widget_get_window(widget);
+    state = get_item_state(self, item);
 
-    pango_layout_set_text(self->pl, NULL, 0);
-    pango_layout_set_width(self->pl, self->pango_text_w);
-    pango_layout_set_height(self->pl, self->pango_text_h);
-
-    pango_layout_set_text(self->pl, fm_file_info_get_disp_name(item->fi), -1);
-
-    /* FIXME: do we need to cache this? */
-    text_x = item->x + (self->cell_w - self->text_w)/2 + 2;
-    text_y = item->icon_rect.y + item->icon_rect.height + 2;
-
-    if(item->is_selected || item == self->drop_hilight) /* draw background for text label */
+    /* the item is only rendered again if it's changed since last time */
+    check_item_surfaces(self, item, &area);
+    if(!item->surfaces[state])
     {
-        state = GTK_CELL_RENDERER_SELECTED;
-
-        cairo_save(cr);
-        gdk_cairo_rectangle(cr, &item->text_rect);
-        gdk_cairo_set_source_color(cr, &style->bg[GTK_STATE_SELECTED]);
-        cairo_clip(cr);
-        cairo_paint(cr);
-        cairo_restore(cr);
-        fg = &style->fg[GTK_STATE_SELECTED];
+        /* it's painted again when the worker is done */
+        if(item->render_jobs[state])
+        {
+            paint_stale_item(item, cr, &area, expose_area);
+            return;
+        }
+        item->surfaces[state] = render_item(self, item, state);
     }
-    else
+    if(item->stale_surface)
     {
-        /* the shadow */
-        gdk_gc_set_rgb_fg_color(self->gc, &app_config->desktop_shadow);
-        gdk_draw_layout( window, self->gc, text_x + 1, text_y + 1, self->pl );
-        fg = &app_config->desktop_fg;
+        cairo_surface_destroy(item->stale_surface);
+        item->stale_surface = NULL;
     }
-    /* real text */
-    gdk_gc_set_rgb_fg_color(self->gc, fg);
-    gdk_draw_layout( window, self->gc, text_x, text_y, self->pl );
-    pango_layout_set_text(self->pl, NULL, 0);
 
+    cairo_save(cr);
+    cairo_set_source_surface(cr, item->surfaces[state], area.x, area.y);
+    gdk_cairo_rectangle(cr, expose_area);
+    cairo_fill(cr);
+    cairo_restore(cr);
+
+    /* the focus is drawn by the theme engine which needs a GdkDrawable */
     if(item == self->focus && gtk_widget_has_focus(widget) )
-        gtk_paint_focus(style, window, gtk_widget_get_state(widget),
+        gtk_paint_focus(style, self->backbuffer, gtk_widget_get_state(widget),
                         expose_area, widget, "icon_view",
                         item->text_rect.x, item->text_rect.y, item->text_rect.width, item->text_rect.height);
-
-    /* draw the icon */
-    g_object_set( self->icon_render, "pixbuf", item->icon, "info", fm_file_info_ref(item->fi), NULL );
-    gtk_cell_renderer_render(GTK_CELL_RENDERER(self->icon_render), window, widget, &item->icon_rect, &item->icon_rect, expose_area, state);
 }
 
 void redraw_item(FmDesktop* desktop, FmDesktopItem* item)
@@ -1598,7 +3540,70 @@ void redraw_item(FmDesktop* desktop, FmDesktopItem* item)
     --rect.y;
     rect.width += 2;
     rect.height += 2;
-    gdk_window_invalidate_rect(gtk_widget_get_window(GTK_WIDGET(desktop)), &rect, FALSE);
+    queue_redraw(desktop, &rect);
+}
+
+static gboolean on_repaint_idle(FmDesktop* desktop)
+{
+    desktop->repaint_idle = 0;
+    if(desktop->damage && GTK_WIDGET_REALIZED(desktop))
+        gdk_window_invalidate_region(gtk_widget_get_window(GTK_WIDGET(desktop)), desktop->damage, FALSE);
+    return FALSE;
+}
+
+static void schedule_repaint(FmDesktop* desktop)
+{
+    /* run before GDK processes the updates, so the damage queued
+     * during this main loop iteration is painted in the same frame. */
+    if(!desktop->repaint_idle)
+        desktop->repaint_idle = g_idle_add_full(GDK_PRIORITY_REDRAW - 10,
+                                        (GSourceFunc)on_repaint_idle, desktop, NULL);
+}
+
+/* add rect, or the whole desktop if it's NULL, to the damaged region
+ * of the backbuffer. */
+void queue_redraw(FmDesktop* desktop, const GdkRectangle* rect)
+{
+    GdkRectangle all;
+
+    /* the whole backbuffer is painted when it's created */
+    if(!desktop->backbuffer)
+        return;
+    if(!rect)
+    {
+        all.x = all.y = 0;
+        gdk_drawable_get_size(desktop->backbuffer, &all.width, &all.height);
+        rect = &all;
+    }
+    if(!desktop->damage)
+    {
+        desktop->damage = gdk_region_rectangle(rect);
+        desktop->n_damage_rects = 1;
+    }
+    else if(++desktop->n_damage_rects > MAX_DAMAGE_RECTS)
+    {
+        GdkRectangle box;
+        gdk_region_get_clipbox(desktop->damage, &box);
+        gdk_rectangle_union(&box, rect, &box);
+        gdk_region_destroy(desktop->damage);
+        desktop->damage = gdk_region_rectangle(&box);
+        desktop->n_damage_rects = 1;
+    }
+    else
+        gdk_region_union_with_rect(desktop->damage, rect);
+    schedule_repaint(desktop);
+}
+
+void queue_redraw_region(FmDesktop* desktop, GdkRegion* region)
+{
+    if(!desktop->backbuffer)
+        return;
+    if(!desktop->damage)
+        desktop->damage = gdk_region_copy(region);
+    else
+        gdk_region_union(desktop->damage, region);
+    ++desktop->n_damage_rects;
+    schedule_repaint(desktop);
 }
 
 void calc_rubber_banding_rect( FmDesktop* self, int x, int y, GdkRectangle* rect )
@@ -1632,51 +3637,124 @@ void calc_rubber_banding_rect( FmDesktop* self, int x, int y, GdkRectangle* rect
     rect->height = y2 - y1;
 }
 
+/* update selection of the items in rect according to the rubber band,
+ * and add the items changed to the damaged region. */
+static void update_rubberbanding_in_rect(FmDesktop* self, GdkRectangle* rect,
+                                         GdkRectangle* band, GdkRegion* region)
+{
+    int col, col2, row, row2;
+    GSList* l;
+
+    col = grid_get_col(self, rect->x);
+    row = grid_get_row(self, rect->y);
+    col2 = grid_get_col(self, rect->x + rect->width - 1);
+    row2 = grid_get_row(self, rect->y + rect->height - 1);
+    for(; row <= row2; ++row)
+    {
+        GSList** cell = self->grid + row * self->grid_cols;
+        for(col = grid_get_col(self, rect->x); col <= col2; ++col)
+        {
+            for(l = cell[col]; l; l = l->next)
+            {
+                FmDesktopItem* item = (FmDesktopItem*)l->data;
+                gboolean selected;
+                if(item->grid_stamp == self->grid_stamp)
+                    continue;
+                item->grid_stamp = self->grid_stamp;
+
+                selected = gdk_rectangle_intersect(band, &item->icon_rect, NULL)
+                        || gdk_rectangle_intersect(band, &item->text_rect, NULL);
+                if(item->is_selected != selected)
+                {
+                    GdkRectangle item_rect;
+                    set_item_selected(self, item, selected);
+                    gdk_rectangle_union(&item->icon_rect, &item->text_rect, &item_rect);
+                    --item_rect.x;
+                    --item_rect.y;
+                    item_rect.width += 2;
+                    item_rect.height += 2;
+                    gdk_region_union_with_rect(region, &item_rect);
+                }
+            }
+        }
+    }
+}
+
 void update_rubberbanding( FmDesktop* self, int newx, int newy )
 {
-    GList* l;
-    GdkRectangle old_rect, new_rect;
-    //GdkRegion *region;
-    GdkWindow *window;
+    GdkRectangle old_rect, new_rect, rect;
+    GdkRectangle* rects;
+    GdkRegion *region, *unchanged;
+    gboolean full = FALSE;
+    int i, n_rects;
+
+    if(newx == self->rubber_bending_x && newy == self->rubber_bending_y)
+        return;
 
-    window = gtk_widget_get_window(GTK_WIDGET(self));
+    /* the first update also deselects items which are not in the rubber band */
+    if(self->rubber_bending_x == self->drag_start_x && self->rubber_bending_y == self->drag_start_y)
+        full = TRUE;
 
     calc_rubber_banding_rect(self, self->rubber_bending_x, self->rubber_bending_y, &old_rect );
     calc_rubber_banding_rect(self, newx, newy, &new_rect );
-
-    gdk_window_invalidate_rect(window, &old_rect, FALSE );
-    gdk_window_invalidate_rect(window, &new_rect, FALSE );
-//    gdk_window_clear_area(((GtkWidget*)self)->window, new_rect.x, new_rect.y, new_rect.width, new_rect.height );
-/*
-    region = gdk_region_rectangle( &old_rect );
-    gdk_region_union_with_rect( region, &new_rect );
-
-//    gdk_window_invalidate_region( ((GtkWidget*)self)->window, &region, TRUE );
-
-    gdk_region_destroy( region );
-*/
     self->rubber_bending_x = newx;
     self->rubber_bending_y = newy;
 
-    /* update selection */
-    for( l = self->items; l; l = l->next )
+    /* Only the area covered by one of the rects changes, plus the frame
+     * of both. The rects share a corner at the drag start point, so this
+     * is at most a few strips along the moving edges. */
+    region = gdk_region_rectangle(&old_rect);
+    gdk_region_union_with_rect(region, &new_rect);
+    if(gdk_rectangle_intersect(&old_rect, &new_rect, &rect) && rect.width > 2 && rect.height > 2)
     {
-        FmDesktopItem* item = (FmDesktopItem*)l->data;
-        gboolean selected;
-        if( gdk_rectangle_intersect( &new_rect, &item->icon_rect, NULL ) ||
-            gdk_rectangle_intersect( &new_rect, &item->text_rect, NULL ) )
-            selected = TRUE;
-        else
-            selected = FALSE;
+        ++rect.x;
+        ++rect.y;
+        rect.width -= 2;
+        rect.height -= 2;
+        unchanged = gdk_region_rectangle(&rect);
+        gdk_region_subtract(region, unchanged);
+        gdk_region_destroy(unchanged);
+    }
 
-        if( item->is_selected != selected )
+    /* Items not touching the damaged strips intersect the new rect iff
+     * they intersected the old one, so only the items in the strips need
+     * to be tested again. The items changed are added to the region. */
+    if(full || !self->grid)
+    {
+        for( i = 0; i < (int)self->items->len; ++i )
         {
-            item->is_selected = selected;
-            redraw_item( self, item );
+            FmDesktopItem* item = get_item(self, i);
+            gboolean selected;
+            /* items collapsed into stacks are not shown */
+            if( item->stack && !item->in_overlay )
+                continue;
+            selected = gdk_rectangle_intersect( &new_rect, &item->icon_rect, NULL )
+                    || gdk_rectangle_intersect( &new_rect, &item->text_rect, NULL );
+            if( item->is_selected != selected )
+            {
+                set_item_selected( self, item, selected );
+                gdk_rectangle_union(&item->icon_rect, &item->text_rect, &rect);
+                --rect.x;
+                --rect.y;
+                rect.width += 2;
+                rect.height += 2;
+                gdk_region_union_with_rect(region, &rect);
+            }
         }
     }
-}
+    else
+    {
+        gdk_region_get_rectangles(region, &rects, &n_rects);
+        ++self->grid_stamp;
+        for(i = 0; i < n_rects; ++i)
+            if(rects[i].width > 0 && rects[i].height > 0)
+                update_rubberbanding_in_rect(self, &rects[i], &new_rect, region);
+        g_free(rects);
+    }
 
+    queue_redraw_region(self, region);
+    gdk_region_destroy(region);
+}
 
 void paint_rubber_banding_rect(FmDesktop* self, cairo_t* cr, GdkRectangle* expose_area)
 {
@@ -1712,142 +3790,616 @@ void paint_rubber_banding_rect(FmDesktop* self, cairo_t* cr, GdkRectangle* expos
     cairo_restore(cr);
 }
 
-static void update_background(FmDesktop* desktop)
+static void release_wallpaper(FmDesktop* desktop)
+{
+    guint i;
+    if(desktop->wallpaper_pixmap)
+    {
+        g_object_unref(desktop->wallpaper_pixmap);
+        desktop->wallpaper_pixmap = NULL;
+    }
+    for(i = 0; desktop->monitors && i < desktop->monitors->len; ++i)
+    {
+        FmDesktopMonitor* mon = (FmDesktopMonitor*)g_ptr_array_index(desktop->monitors, i);
+        if(mon->wallpaper_pix)
+        {
+            g_object_unref(mon->wallpaper_pix);
+            mon->wallpaper_pix = NULL;
+        }
+    }
+}
+
+static void set_background_color(FmDesktop* desktop)
 {
     GtkWidget* widget = (GtkWidget*)desktop;
-    GdkPixbuf* pix, *scaled;
-    GdkPixmap* pixmap;
-    Pixmap pixmap_id;
-    int src_w, src_h;
-    int dest_w, dest_h;
     GdkWindow* root = gdk_screen_get_root_window(gtk_widget_get_screen(widget));
     GdkWindow *window = gtk_widget_get_window(widget);
+    GdkColor bg = app_config->desktop_bg;
+
+    gdk_rgb_find_color(gdk_drawable_get_colormap(window), &bg);
+    gdk_window_set_back_pixmap(window, NULL, FALSE);
+    gdk_window_set_background(window, &bg);
+    gdk_window_set_back_pixmap(root, NULL, FALSE);
+    gdk_window_set_background(root, &bg);
+    gdk_window_clear(root);
+    release_wallpaper(desktop);
+    queue_redraw(desktop, NULL);
+}
+
+#ifdef HAVE_XSHM
+static int shm_usable = -1; /* -1 means not checked yet */
 
+/* get position and width of the bits of a color in a pixel */
+static void get_mask_shift(unsigned long mask, int* shift, int* bits)
+{
+    for(*shift = 0; mask && !(mask & 1); mask >>= 1)
+        ++*shift;
+    for(*bits = 0; mask & 1; mask >>= 1)
+        ++*bits;
+}
+
+/* upload pix to (x, y) of pixmap through a shared memory XImage.
+ * returns FALSE if MIT-SHM cannot be used, so other ways should be tried. */
+static gboolean upload_pixbuf_shm(GdkPixmap* pixmap, GdkGC* gc, GdkPixbuf* pix, int x, int y)
+{
+    Display* dpy = GDK_DRAWABLE_XDISPLAY(pixmap);
+    Visual* visual = GDK_VISUAL_XVISUAL(gdk_drawable_get_visual(pixmap));
+    int depth = gdk_drawable_get_depth(pixmap);
+    int w = gdk_pixbuf_get_width(pix), h = gdk_pixbuf_get_height(pix);
+    int n_channels = gdk_pixbuf_get_n_channels(pix);
+    int rowstride = gdk_pixbuf_get_rowstride(pix);
+    const guchar* pixels = gdk_pixbuf_get_pixels(pix);
+    int r_shift, r_bits, g_shift, g_bits, b_shift, b_bits;
+    XShmSegmentInfo shminfo;
+    XImage* img;
+    int row, col;
+    gboolean attached;
+
+    if(shm_usable == -1)
+        shm_usable = XShmQueryExtension(dpy);
+    /* only TrueColor visuals with 32 bits per pixel are handled here */
+    if(!shm_usable || visual->class != TrueColor || depth < 24)
+        return FALSE;
+    /* the 8 bit channels of the pixbuf cannot be packed into wider ones,
+     * e.g. the 10 bit ones of depth 30. GDK converts them then. */
+    get_mask_shift(visual->red_mask, &r_shift, &r_bits);
+    get_mask_shift(visual->green_mask, &g_shift, &g_bits);
+    get_mask_shift(visual->blue_mask, &b_shift, &b_bits);
+    if(r_bits > 8 || g_bits > 8 || b_bits > 8)
+        return FALSE;
+
+    img = XShmCreateImage(dpy, visual, depth, ZPixmap, NULL, &shminfo, w, h);
+    if(!img)
+        return FALSE;
+    if(img->bits_per_pixel != 32)
+    {
+        XDestroyImage(img);
+        return FALSE;
+    }
+    shminfo.shmid = shmget(IPC_PRIVATE, img->bytes_per_line * img->height, IPC_CREAT|0600);
+    if(shminfo.shmid < 0)
+    {
+        XDestroyImage(img);
+        return FALSE;
+    }
+    shminfo.shmaddr = img->data = shmat(shminfo.shmid, NULL, 0);
+    shminfo.readOnly = False;
+
+    /* attaching fails if the X server is on another machine */
+    gdk_error_trap_push();
+    attached = (shminfo.shmaddr != (char*)-1) && XShmAttach(dpy, &shminfo);
+    XSync(dpy, False);
+    if(gdk_error_trap_pop())
+        attached = FALSE;
+    /* the segment is freed when both of us are detached from it */
+    shmctl(shminfo.shmid, IPC_RMID, NULL);
+    if(!attached)
+    {
+        shm_usable = 0;
+        if(shminfo.shmaddr != (char*)-1)
+            shmdt(shminfo.shmaddr);
+        img->data = NULL;
+        XDestroyImage(img);
+        return FALSE;
+    }
+
+    for(row = 0; row < h; ++row)
+    {
+        const guchar* src = pixels + row * rowstride;
+        guint32* dest = (guint32*)(img->data + row * img->bytes_per_line);
+        if(r_shift == 16 && g_shift == 8 && b_shift == 0
+           && r_bits == 8 && g_bits == 8 && b_bits == 8) /* the most common one */
+        {
+            for(col = 0; col < w; ++col, src += n_channels)
+                dest[col] = (src[0] << 16) | (src[1] << 8) | src[2];
+        }
+        else
+        {
+            for(col = 0; col < w; ++col, src += n_channels)
+                dest[col] = ((guint32)(src[0] >> (8 - r_bits)) << r_shift)
+                          | ((guint32)(src[1] >> (8 - g_bits)) << g_shift)
+                          | ((guint32)(src[2] >> (8 - b_bits)) << b_shift);
+        }
+    }
+    if(img->byte_order != (G_BYTE_ORDER == G_LITTLE_ENDIAN ? LSBFirst : MSBFirst))
+    {
+        for(row = 0; row < h; ++row)
+        {
+            guint32* dest = (guint32*)(img->data + row * img->bytes_per_line);
+            for(col = 0; col < w; ++col)
+                dest[col] = GUINT32_SWAP_LE_BE(dest[col]);
+        }
+    }
+
+    XShmPutImage(dpy, GDK_DRAWABLE_XID(pixmap), GDK_GC_XGC(gc), img, 0, 0, x, y, w, h, False);
+    /* wait until the server is done with the shared memory */
+    XSync(dpy, False);
+    XShmDetach(dpy, &shminfo);
+    XDestroyImage(img);
+    shmdt(shminfo.shmaddr);
+    return TRUE;
+}
+#endif
+
+/* fill the rectangles of pixmap with the background color */
+static void fill_rects(FmDesktop* desktop, GdkPixmap* pixmap, GdkRectangle* rects, int n_rects)
+{
+    int i;
+#ifdef HAVE_XRENDER
+    Display* dpy = GDK_DRAWABLE_XDISPLAY(pixmap);
+    int event_base, error_base;
+    XRenderPictFormat* format;
+    if(XRenderQueryExtension(dpy, &event_base, &error_base)
+       && (format = XRenderFindVisualFormat(dpy, GDK_VISUAL_XVISUAL(gdk_drawable_get_visual(pixmap)))))
+    {
+        Picture pict = XRenderCreatePicture(dpy, GDK_DRAWABLE_XID(pixmap), format, 0, NULL);
+        XRenderColor color;
+        XRectangle xrects[4];
+        color.red = app_config->desktop_bg.red;
+        color.green = app_config->desktop_bg.green;
+        color.blue = app_config->desktop_bg.blue;
+        color.alpha = 0xffff;
+        for(i = 0; i < n_rects; ++i)
+        {
+            xrects[i].x = rects[i].x;
+            xrects[i].y = rects[i].y;
+            xrects[i].width = rects[i].width;
+            xrects[i].height = rects[i].height;
+        }
+        XRenderFillRectangles(dpy, PictOpSrc, pict, &color, xrects, n_rects);
+        XRenderFreePicture(dpy, pict);
+        return;
+    }
+#endif
+    gdk_gc_set_rgb_fg_color(desktop->gc, &app_config->desktop_bg);
+    for(i = 0; i < n_rects; ++i)
+        gdk_draw_rectangle(pixmap, desktop->gc, TRUE, rects[i].x, rects[i].y, rects[i].width, rects[i].height);
+}
+
+/* draw pix in the center of rect of pixmap, and fill the rest of rect
+ * with the background color */
+static void draw_pixbuf_centered(FmDesktop* desktop, GdkPixmap* pixmap, GdkPixbuf* pix, GdkRectangle* rect)
+{
+    int pix_w = gdk_pixbuf_get_width(pix), pix_h = gdk_pixbuf_get_height(pix);
+    int x, y, right = rect->x + rect->width, bottom = rect->y + rect->height;
+    GdkPixbuf* sub = NULL;
+    GdkRectangle borders[4];
+    int n = 0;
+
+    /* nothing is drawn outside of the monitor */
+    if(pix_w > rect->width || pix_h > rect->height)
+    {
+        sub = gdk_pixbuf_new_subpixbuf(pix, MAX(pix_w - rect->width, 0) / 2,
+                                       MAX(pix_h - rect->height, 0) / 2,
+                                       MIN(pix_w, rect->width), MIN(pix_h, rect->height));
+        pix = sub;
+        pix_w = gdk_pixbuf_get_width(pix);
+        pix_h = gdk_pixbuf_get_height(pix);
+    }
+    x = rect->x + (rect->width - pix_w) / 2;
+    y = rect->y + (rect->height - pix_h) / 2;
+
+    /* the areas not covered by the image: top, bottom, left, and right */
+    if(y > rect->y)
+    {
+        borders[n].x = rect->x; borders[n].y = rect->y; borders[n].width = rect->width; borders[n].height = y - rect->y;
+        ++n;
+    }
+    if(y + pix_h < bottom)
+    {
+        borders[n].x = rect->x; borders[n].y = y + pix_h; borders[n].width = rect->width; borders[n].height = bottom - y - pix_h;
+        ++n;
+    }
+    if(x > rect->x)
+    {
+        borders[n].x = rect->x; borders[n].y = y; borders[n].width = x - rect->x; borders[n].height = pix_h;
+        ++n;
+    }
+    if(x + pix_w < right)
+    {
+        borders[n].x = x + pix_w; borders[n].y = y; borders[n].width = right - x - pix_w; borders[n].height = pix_h;
+        ++n;
+    }
+    if(n > 0)
+        fill_rects(desktop, pixmap, borders, n);
+
+#ifdef HAVE_XSHM
+    if(!upload_pixbuf_shm(pixmap, desktop->gc, pix, x, y))
+#endif
+    gdk_draw_pixbuf(pixmap, desktop->gc, pix, 0, 0, x, y, -1, -1, GDK_RGB_DITHER_NORMAL, 0, 0);
+    if(sub)
+        g_object_unref(sub);
+}
+
+/* draw the wallpaper of the monitor into desktop->wallpaper_pixmap */
+static void draw_monitor_wallpaper(FmDesktop* desktop, FmDesktopMonitor* mon)
+{
+    GdkPixmap* pixmap = desktop->wallpaper_pixmap;
+    GdkPixbuf* pix = mon->wallpaper_pix;
+
+    mon->need_redraw = FALSE;
+    if(!pix)
+        fill_rects(desktop, pixmap, &mon->geometry, 1);
+    else if(mon->wallpaper_mode == FM_WP_TILE)
+    {
+        cairo_t* cr = gdk_cairo_create(pixmap);
+        gdk_cairo_set_source_pixbuf(cr, pix, mon->geometry.x, mon->geometry.y);
+        cairo_pattern_set_extend(cairo_get_source(cr), CAIRO_EXTEND_REPEAT);
+        gdk_cairo_rectangle(cr, &mon->geometry);
+        cairo_fill(cr);
+        cairo_destroy(cr);
+    }
+    else /* the image is already scaled by fm_wallpaper_load_async() */
+        draw_pixbuf_centered(desktop, pixmap, pix, &mon->geometry);
+}
+
+/* make pixmap the background of the root window */
+static void set_root_pixmap(FmDesktop* desktop, GdkPixmap* pixmap)
+{
+    GtkWidget* widget = (GtkWidget*)desktop;
+    GdkWindow* root = gdk_screen_get_root_window(gtk_widget_get_screen(widget));
+    GdkWindow *window = gtk_widget_get_window(widget);
     Display* xdisplay;
     Pixmap xpixmap = 0;
     Window xroot;
 
-    if(app_config->wallpaper_mode == FM_WP_COLOR
-       || !app_config->wallpaper
-       || !*app_config->wallpaper
-       || ! (pix = gdk_pixbuf_new_from_file(app_config->wallpaper, NULL)) ) /* solid color only */
+    gdk_window_set_back_pixmap(root, pixmap, FALSE);
+    gdk_window_set_back_pixmap(window, NULL, TRUE);
+
+    /* set root map here */
+    xdisplay = GDK_WINDOW_XDISPLAY(root);
+    xroot = GDK_WINDOW_XID(root);
+    xpixmap = GDK_DRAWABLE_XID(pixmap);
+
+    /* the pixmap is ready, so the server is only grabbed to change
+     * both properties at once. the properties are set again even if
+     * the pixmap is not changed, to tell other programs that it's
+     * drawn again. */
+    XGrabServer (xdisplay);
+
+    XChangeProperty(xdisplay, xroot,
+                    XA_XROOTMAP_ID, XA_PIXMAP, 32, PropModeReplace, (guchar*)&xpixmap, 1);
+    XChangeProperty( xdisplay,
+                xroot,
+                gdk_x11_get_xatom_by_name("_XROOTPMAP_ID"), XA_PIXMAP,
+                32, PropModeReplace,
+                (guchar *) &xpixmap, 1);
+
+    XUngrabServer( xdisplay );
+
+    XSetWindowBackgroundPixmap( xdisplay, xroot, xpixmap );
+    XFlush( xdisplay );
+}
+
+/* show the wallpapers of the monitors. if the pixmap of the screen can
+ * be reused, only the monitors whose wallpaper is changed are drawn. */
+static void update_background_pixmap(FmDesktop* desktop)
+{
+    GtkWidget* widget = (GtkWidget*)desktop;
+    GdkScreen* screen = gtk_widget_get_screen(widget);
+    GdkWindow* root = gdk_screen_get_root_window(screen);
+    int w = gdk_screen_get_width(screen), h = gdk_screen_get_height(screen);
+    int pixmap_w = 0, pixmap_h = 0;
+    GdkRegion* region;
+    guint i;
+
+    /* no pixmap is needed if there are only colors */
+    for(i = 0; i < desktop->monitors->len; ++i)
     {
-        GdkColor bg = app_config->desktop_bg;
+        FmDesktopMonitor* mon = (FmDesktopMonitor*)g_ptr_array_index(desktop->monitors, i);
+        if(mon->wallpaper_pix)
+            break;
+    }
+    if(i >= desktop->monitors->len)
+    {
+        for(i = 0; i < desktop->monitors->len; ++i)
+            ((FmDesktopMonitor*)g_ptr_array_index(desktop->monitors, i))->need_redraw = FALSE;
+        set_background_color(desktop);
+        return;
+    }
 
-        gdk_rgb_find_color(gdk_drawable_get_colormap(window), &bg);
-        gdk_window_set_back_pixmap(window, NULL, FALSE);
-        gdk_window_set_background(window, &bg);
-        gdk_window_set_back_pixmap(root, NULL, FALSE);
-        gdk_window_set_background(root, &bg);
+    if(desktop->wallpaper_pixmap)
+        gdk_drawable_get_size(desktop->wallpaper_pixmap, &pixmap_w, &pixmap_h);
+    if(pixmap_w != w || pixmap_h != h)
+    {
+        GdkPixmap* pixmap = gdk_pixmap_new(gtk_widget_get_window(widget), w, h, -1);
+        GdkPixmap* old_pixmap = desktop->wallpaper_pixmap;
+        GdkRectangle rect;
+        rect.x = rect.y = 0;
+        rect.width = w;
+        rect.height = h;
+        desktop->wallpaper_pixmap = pixmap;
+        /* the parts of the screen not on any monitor */
+        fill_rects(desktop, pixmap, &rect, 1);
+        for(i = 0; i < desktop->monitors->len; ++i)
+            draw_monitor_wallpaper(desktop, (FmDesktopMonitor*)g_ptr_array_index(desktop->monitors, i));
+        set_root_pixmap(desktop, pixmap);
+        /* the pixmap is kept while its id is in the root window properties,
+         * and the previous one is freed as soon as it's replaced. */
+        if(old_pixmap)
+            g_object_unref(old_pixmap);
         gdk_window_clear(root);
-        gdk_window_clear(window);
-        gdk_window_invalidate_rect(window, NULL, TRUE);
+        queue_redraw(desktop, NULL);
         return;
     }
 
-    src_w = gdk_pixbuf_get_width(pix);
-    src_h = gdk_pixbuf_get_height(pix);
-    if(app_config->wallpaper_mode == FM_WP_TILE)
+    region = gdk_region_new();
+    for(i = 0; i < desktop->monitors->len; ++i)
+    {
+        FmDesktopMonitor* mon = (FmDesktopMonitor*)g_ptr_array_index(desktop->monitors, i);
+        if(!mon->need_redraw)
+            continue;
+        draw_monitor_wallpaper(desktop, mon);
+        gdk_region_union_with_rect(region, &mon->geometry);
+    }
+    if(!gdk_region_empty(region))
+    {
+        GdkRectangle* rects;
+        int n_rects;
+        set_root_pixmap(desktop, desktop->wallpaper_pixmap);
+        gdk_region_get_rectangles(region, &rects, &n_rects);
+        for(i = 0; i < (guint)n_rects; ++i)
+            gdk_window_clear_area(root, rects[i].x, rects[i].y, rects[i].width, rects[i].height);
+        g_free(rects);
+        queue_redraw_region(desktop, region);
+    }
+    gdk_region_destroy(region);
+}
+
+static void on_wallpaper_ready(GdkPixbuf* pix, gpointer user_data)
+{
+    FmDesktopMonitor* mon = (FmDesktopMonitor*)user_data;
+    mon->wallpaper_req = NULL;
+    if(mon->wallpaper_pix)
+        g_object_unref(mon->wallpaper_pix);
+    /* solid color only if it cannot be loaded */
+    mon->wallpaper_pix = pix ? (GdkPixbuf*)g_object_ref(pix) : NULL;
+    mon->need_redraw = TRUE;
+    update_background_pixmap(mon->desktop);
+}
+
+static void drop_preloaded_wallpaper(FmDesktopMonitor* mon)
+{
+    if(mon->next_req)
     {
-        dest_w = src_w;
-        dest_h = src_h;
-        pixmap = gdk_pixmap_new(window, dest_w, dest_h, -1);
+        fm_wallpaper_cancel(mon->next_req);
+        mon->next_req = NULL;
     }
-    else
+    if(mon->next_pix)
     {
-        GdkScreen* screen = gtk_widget_get_screen(widget);
-        dest_w = gdk_screen_get_width(screen);
-        dest_h = gdk_screen_get_height(screen);
-        pixmap = gdk_pixmap_new(window, dest_w, dest_h, -1);
+        g_object_unref(mon->next_pix);
+        mon->next_pix = NULL;
     }
+    g_free(mon->next_wallpaper);
+    mon->next_wallpaper = NULL;
+}
+
+static void on_wallpaper_preloaded(GdkPixbuf* pix, gpointer user_data)
+{
+    FmDesktopMonitor* mon = (FmDesktopMonitor*)user_data;
+    mon->next_req = NULL;
+    mon->next_pix = pix ? (GdkPixbuf*)g_object_ref(pix) : NULL;
+}
+
+/* Decode and scale the image to be shown next on the monitor in
+ * advance, with a lower priority than the images wanted now. At most
+ * two images are kept for the monitor, the one shown and the next one. */
+static void preload_wallpaper(FmDesktopMonitor* mon, const char* file, FmWallpaperMode mode)
+{
+    if(mon->next_wallpaper && strcmp(file, mon->next_wallpaper) == 0 && mode == mon->next_mode
+       && gdk_color_equal(&mon->next_bg, &app_config->desktop_bg))
+        return;
+    drop_preloaded_wallpaper(mon);
+    mon->next_wallpaper = g_strdup(file);
+    mon->next_mode = mode;
+    mon->next_bg = app_config->desktop_bg;
+    mon->next_req = fm_wallpaper_preload_async(file, mode, mon->geometry.width, mon->geometry.height,
+                                               &app_config->desktop_bg, on_wallpaper_preloaded, mon);
+}
 
-    if(gdk_pixbuf_get_has_alpha(pix)
-        || app_config->wallpaper_mode == FM_WP_CENTER
-        || app_config->wallpaper_mode == FM_WP_FIT)
+/* show the image preloaded if it's the one wanted.
+ * returns FALSE if it's not. */
+static gboolean use_preloaded_wallpaper(FmDesktopMonitor* mon, const char* file, FmWallpaperMode mode)
+{
+    if(!mon->next_wallpaper || strcmp(file, mon->next_wallpaper) != 0 || mode != mon->next_mode
+       || !gdk_color_equal(&mon->next_bg, &app_config->desktop_bg))
+        return FALSE;
+    if(mon->wallpaper_req)
+        fm_wallpaper_cancel(mon->wallpaper_req);
+    mon->wallpaper_req = NULL;
+    g_free(mon->wallpaper);
+    mon->wallpaper = mon->next_wallpaper;
+    mon->wallpaper_mode = mode;
+    mon->next_wallpaper = NULL;
+    if(mon->next_req)
     {
-        gdk_gc_set_rgb_fg_color(desktop->gc, &app_config->desktop_bg);
-        gdk_draw_rectangle(pixmap, desktop->gc, TRUE, 0, 0, dest_w, dest_h);
+        /* still being decoded. the request is joined to the same job
+         * before the preload is cancelled, so the job is not stopped. */
+        mon->wallpaper_req = fm_wallpaper_load_async(file, mode,
+                                            mon->geometry.width, mon->geometry.height,
+                                            &mon->next_bg, on_wallpaper_ready, mon);
+        fm_wallpaper_cancel(mon->next_req);
+        mon->next_req = NULL;
     }
+    else
+    {
+        if(mon->wallpaper_pix)
+            g_object_unref(mon->wallpaper_pix);
+        mon->wallpaper_pix = mon->next_pix;
+        mon->next_pix = NULL;
+        mon->need_redraw = TRUE;
+    }
+    return TRUE;
+}
+
+static void update_background(FmDesktop* desktop)
+{
+    guint i;
 
-    switch(app_config->wallpaper_mode)
+    for(i = 0; i < desktop->monitors->len; ++i)
     {
-        case FM_WP_TILE:
-            gdk_draw_pixbuf(pixmap, desktop->gc, pix, 0, 0, 0, 0, dest_w, dest_h, GDK_RGB_DITHER_NORMAL, 0, 0);
-            break;
-        case FM_WP_STRETCH:
-            if(dest_w == src_w && dest_h == src_h)
-                scaled = (GdkPixbuf*)g_object_ref(pix);
-            else
-                scaled = gdk_pixbuf_scale_simple(pix, dest_w, dest_h, GDK_INTERP_BILINEAR);
-            gdk_draw_pixbuf(pixmap, desktop->gc, scaled, 0, 0, 0, 0, dest_w, dest_h, GDK_RGB_DITHER_NORMAL, 0, 0);
-            g_object_unref(scaled);
-            break;
-        case FM_WP_FIT:
-            if(dest_w != src_w || dest_h != src_h)
+        FmDesktopMonitor* mon = (FmDesktopMonitor*)g_ptr_array_index(desktop->monitors, i);
+        const char* file;
+        FmWallpaperMode mode;
+        gboolean bg_changed = !gdk_color_equal(&mon->wallpaper_bg, &app_config->desktop_bg);
+        gboolean in_slideshow, changed;
+
+        fm_app_config_get_monitor_wallpaper(app_config, mon->num, mon->name, &file, &mode);
+        /* the slideshow replaces the wallpaper of all monitors */
+        in_slideshow = (file == app_config->wallpaper && n_slideshow_files > 0 && mode != FM_WP_COLOR);
+        if(in_slideshow)
+            file = slideshow_files[slideshow_pos];
+        mon->wallpaper_bg = app_config->desktop_bg;
+        if(mode == FM_WP_COLOR || !file || !*file) /* solid color only */
+        {
+            drop_preloaded_wallpaper(mon);
+            if(mon->wallpaper_req)
             {
-                gdouble w_ratio = (float)dest_w / src_w;
-                gdouble h_ratio = (float)dest_h / src_h;
-                gdouble ratio = MIN(w_ratio, h_ratio);
-                if(ratio != 1.0)
-                {
-                    src_w *= ratio;
-                    src_h *= ratio;
-                    scaled = gdk_pixbuf_scale_simple(pix, src_w, src_h, GDK_INTERP_BILINEAR);
-                    g_object_unref(pix);
-                    pix = scaled;
-                }
+                fm_wallpaper_cancel(mon->wallpaper_req);
+                mon->wallpaper_req = NULL;
             }
-            /* continue to execute code in case FM_WP_CENTER */
-        case FM_WP_CENTER:
+            if(mon->wallpaper_pix || bg_changed)
+                mon->need_redraw = TRUE;
+            if(mon->wallpaper_pix)
             {
-                int x, y;
-                x = (dest_w - src_w)/2;
-                y = (dest_h - src_h)/2;
-                gdk_draw_pixbuf(pixmap, desktop->gc, pix, 0, 0, x, y, -1, -1, GDK_RGB_DITHER_NORMAL, 0, 0);
+                g_object_unref(mon->wallpaper_pix);
+                mon->wallpaper_pix = NULL;
             }
-            break;
-    }
-    gdk_window_set_back_pixmap(root, pixmap, FALSE);
-    gdk_window_set_back_pixmap(window, NULL, TRUE);
+            g_free(mon->wallpaper);
+            mon->wallpaper = NULL;
+            continue;
+        }
 
-    pixmap_id = GDK_DRAWABLE_XID(pixmap);
-    XChangeProperty(GDK_WINDOW_XDISPLAY(root), GDK_WINDOW_XID(root),
-                    XA_XROOTMAP_ID, XA_PIXMAP, 32, PropModeReplace, (guchar*)&pixmap_id, 1);
+        /* the wallpaper is only loaded again if it's changed. the monitor
+         * is a new one if its size is changed, see update_monitors(). */
+        changed = bg_changed || mode != mon->wallpaper_mode || g_strcmp0(file, mon->wallpaper) != 0
+                  || (!mon->wallpaper_req && !mon->wallpaper_pix);
+        if(changed && !use_preloaded_wallpaper(mon, file, mode))
+        {
+            if(mon->wallpaper_req)
+                fm_wallpaper_cancel(mon->wallpaper_req);
+            g_free(mon->wallpaper);
+            mon->wallpaper = g_strdup(file);
+            mon->wallpaper_mode = mode;
+            /* the current wallpaper or color is shown until the new one is
+             * loaded to avoid flickering. */
+            mon->wallpaper_req = fm_wallpaper_load_async(file, mode,
+                                            mon->geometry.width, mon->geometry.height,
+                                            &app_config->desktop_bg, on_wallpaper_ready, mon);
+        }
 
-    /* set root map here */
-    xdisplay = GDK_WINDOW_XDISPLAY(root);
-    xroot = GDK_WINDOW_XID(root);
+        /* get the next image ready while this one is shown */
+        if(in_slideshow && n_slideshow_files > 1)
+            preload_wallpaper(mon, slideshow_files[(slideshow_pos + 1) % n_slideshow_files], mode);
+        else
+            drop_preloaded_wallpaper(mon);
+    }
+    update_background_pixmap(desktop);
+}
 
-    XGrabServer (xdisplay);
+static void on_slideshow_changed(FmConfig* cfg, gpointer user_data)
+{
+    int i;
+    update_slideshow();
+    for(i=0; i < n_screens; ++i)
+        update_background(FM_DESKTOP(desktops[i]));
+}
 
-    if( pixmap )
+/* the slideshow is paused while the screen saver is running or nobody
+ * is using the session, and the wallpaper cannot be seen. */
+static gboolean is_session_idle()
+{
+    gboolean idle = FALSE;
+#ifdef HAVE_XSS
+    Display* dpy = GDK_DISPLAY_XDISPLAY(gdk_display_get_default());
+    int event_base, error_base;
+    XScreenSaverInfo* info;
+    if(XScreenSaverQueryExtension(dpy, &event_base, &error_base)
+       && (info = XScreenSaverAllocInfo()))
     {
-        xpixmap = GDK_WINDOW_XWINDOW(pixmap);
+        if(XScreenSaverQueryInfo(dpy, DefaultRootWindow(dpy), info))
+            idle = (info->state == ScreenSaverOn
+                    || info->idle >= (unsigned long)app_config->slideshow_interval * 60000);
+        XFree(info);
+    }
+#endif
+    return idle;
+}
 
-        XChangeProperty( xdisplay,
-                    xroot,
-                    gdk_x11_get_xatom_by_name("_XROOTPMAP_ID"), XA_PIXMAP,
-                    32, PropModeReplace,
-                    (guchar *) &xpixmap, 1);
+static gboolean on_slideshow_timeout(gpointer user_data)
+{
+    int i;
+    if(is_session_idle())
+        return TRUE;
+    /* the next image is preloaded, so it's shown without waiting */
+    slideshow_pos = (slideshow_pos + 1) % n_slideshow_files;
+    for(i=0; i < n_screens; ++i)
+        update_background(FM_DESKTOP(desktops[i]));
+    return TRUE;
+}
 
-        XSetWindowBackgroundPixmap( xdisplay, xroot, xpixmap );
-    }
-    else
+void stop_slideshow()
+{
+    if(slideshow_timeout)
     {
-        /* FIXME: Anyone knows how to handle this correctly??? */
+        g_source_remove(slideshow_timeout);
+        slideshow_timeout = 0;
     }
-    XClearWindow( xdisplay, xroot );
+    g_strfreev(slideshow_files);
+    slideshow_files = NULL;
+    n_slideshow_files = 0;
+}
 
-    XUngrabServer( xdisplay );
-    XFlush( xdisplay );
+/* get the images of the slideshow again, and go on from the image shown
+ * if it's still there. update_background() should be called after this. */
+void update_slideshow()
+{
+    char* current = n_slideshow_files > 0 ? g_strdup(slideshow_files[slideshow_pos]) : NULL;
 
-    g_object_unref(pixmap);
-    if(pix)
-        g_object_unref(pix);
+    stop_slideshow();
+    slideshow_pos = 0;
+    if(app_config->slideshow && app_config->slideshow_dir && *app_config->slideshow_dir)
+        slideshow_files = fm_wallpaper_list_dir(app_config->slideshow_dir);
+    if(slideshow_files)
+    {
+        n_slideshow_files = g_strv_length(slideshow_files);
+        while(current && slideshow_pos < n_slideshow_files
+              && strcmp(slideshow_files[slideshow_pos], current) != 0)
+            ++slideshow_pos;
+        if(slideshow_pos >= n_slideshow_files)
+            slideshow_pos = 0;
+        if(n_slideshow_files > 1)
+            slideshow_timeout = g_timeout_add_seconds(MAX(app_config->slideshow_interval, 1) * 60,
+                                                      on_slideshow_timeout, NULL);
+    }
+    g_free(current);
+}
 
-    gdk_window_clear(root);
-    gdk_window_clear(window);
-    gdk_window_invalidate_rect(window, NULL, TRUE);
+static gboolean on_working_area_timeout(FmDesktop* desktop)
+{
+    desktop->working_area_timeout = 0;
+    update_working_area(desktop);
+    return FALSE;
 }
 
 GdkFilterReturn on_root_event(GdkXEvent *xevent, GdkEvent *event, gpointer data)
@@ -1857,15 +4409,66 @@ GdkFilterReturn on_root_event(GdkXEvent *xevent, GdkEvent *event, gpointer data)
     if ( evt->type == PropertyNotify )
     {
         if(evt->atom == XA_NET_WORKAREA)
-            update_working_area(self);
+        {
+            /* panels being moved or hidden change the property many
+             * times in a row, so only handle the last change. */
+            if(self->working_area_timeout)
+                g_source_remove(self->working_area_timeout);
+            self->working_area_timeout = g_timeout_add(WORKING_AREA_DELAY,
+                                            (GSourceFunc)on_working_area_timeout, self);
+        }
     }
     return GDK_FILTER_CONTINUE;
 }
 
-void update_working_area(FmDesktop* desktop)
+/* get the working area of current desktop set by the window manager.
+ * returns FALSE if the properties are not set. */
+#ifdef HAVE_XCB
+static gboolean get_net_workarea(GdkWindow* root, GdkRectangle* rect)
+{
+    xcb_connection_t* c = XGetXCBConnection(GDK_WINDOW_XDISPLAY(root));
+    xcb_window_t xroot = GDK_WINDOW_XID(root);
+    xcb_get_property_cookie_t n_desktops_ck, cur_desktop_ck, working_area_ck;
+    xcb_get_property_reply_t *n_desktops_r, *cur_desktop_r, *working_area_r;
+    gboolean ret = FALSE;
+
+    /* send all the requests before waiting for any reply,
+     * so there is only one round trip to the X server. */
+    n_desktops_ck = xcb_get_property(c, 0, xroot, XA_NET_NUMBER_OF_DESKTOPS,
+                                     XCB_ATOM_CARDINAL, 0, 1);
+    cur_desktop_ck = xcb_get_property(c, 0, xroot, XA_NET_CURRENT_DESKTOP,
+                                      XCB_ATOM_CARDINAL, 0, 1);
+    working_area_ck = xcb_get_property(c, 0, xroot, XA_NET_WORKAREA,
+                                       XCB_GET_PROPERTY_TYPE_ANY, 0, 4 * 32);
+    n_desktops_r = xcb_get_property_reply(c, n_desktops_ck, NULL);
+    cur_desktop_r = xcb_get_property_reply(c, cur_desktop_ck, NULL);
+    working_area_r = xcb_get_property_reply(c, working_area_ck, NULL);
+
+    if(n_desktops_r && n_desktops_r->format == 32 && n_desktops_r->value_len == 1
+       && cur_desktop_r && cur_desktop_r->format == 32 && cur_desktop_r->value_len == 1
+       && working_area_r && working_area_r->format == 32)
+    {
+        guint32 n_desktops = *(guint32*)xcb_get_property_value(n_desktops_r);
+        guint32 cur_desktop = *(guint32*)xcb_get_property_value(cur_desktop_r);
+        guint32* working_area = (guint32*)xcb_get_property_value(working_area_r);
+        if(working_area_r->value_len == n_desktops * 4 && cur_desktop < n_desktops)
+        {
+            working_area += cur_desktop * 4;
+            rect->x = (gint)working_area[0];
+            rect->y = (gint)working_area[1];
+            rect->width = (gint)working_area[2];
+            rect->height = (gint)working_area[3];
+            ret = TRUE;
+        }
+    }
+    free(n_desktops_r);
+    free(cur_desktop_r);
+    free(working_area_r);
+    return ret;
+}
+#else
+static gboolean get_net_workarea(GdkWindow* root, GdkRectangle* rect)
 {
-    GdkScreen* screen = gtk_widget_get_screen((GtkWidget*)desktop);
-    GdkWindow* root = gdk_screen_get_root_window(screen);
     Atom ret_type;
     gulong len, after;
     int format;
@@ -1873,51 +4476,90 @@ void update_working_area(FmDesktop* desktop)
     guint32 n_desktops, cur_desktop;
     gulong* working_area;
 
-    /* default to screen size */
-    desktop->working_area.x = 0;
-    desktop->working_area.y = 0;
-    desktop->working_area.width = gdk_screen_get_width(screen);
-    desktop->working_area.height = gdk_screen_get_height(screen);
-
     if( XGetWindowProperty(GDK_WINDOW_XDISPLAY(root), GDK_WINDOW_XID(root),
                        XA_NET_NUMBER_OF_DESKTOPS, 0, 1, False, XA_CARDINAL, &ret_type,
                        &format, &len, &after, &prop) != Success)
-        goto _out;
+        return FALSE;
     if(!prop)
-        goto _out;
+        return FALSE;
     n_desktops = *(guint32*)prop;
     XFree(prop);
 
     if( XGetWindowProperty(GDK_WINDOW_XDISPLAY(root), GDK_WINDOW_XID(root),
                        XA_NET_CURRENT_DESKTOP, 0, 1, False, XA_CARDINAL, &ret_type,
                        &format, &len, &after, &prop) != Success)
-        goto _out;
+        return FALSE;
     if(!prop)
-        goto _out;
+        return FALSE;
     cur_desktop = *(guint32*)prop;
     XFree(prop);
 
     if( XGetWindowProperty(GDK_WINDOW_XDISPLAY(root), GDK_WINDOW_XID(root),
                        XA_NET_WORKAREA, 0, 4 * 32, False, AnyPropertyType, &ret_type,
                        &format, &len, &after, &prop) != Success)
-        goto _out;
-    if(ret_type == None || format == 0 || len != n_desktops*4 )
+        return FALSE;
+    if(ret_type == None || format == 0 || len != n_desktops*4 || cur_desktop >= n_desktops)
     {
         if(prop)
             XFree(prop);
-        goto _out;
+        return FALSE;
     }
     working_area = ((gulong*)prop) + cur_desktop * 4;
 
-    desktop->working_area.x = (gint)working_area[0];
-    desktop->working_area.y = (gint)working_area[1];
-    desktop->working_area.width = (gint)working_area[2];
-    desktop->working_area.height = (gint)working_area[3];
+    rect->x = (gint)working_area[0];
+    rect->y = (gint)working_area[1];
+    rect->width = (gint)working_area[2];
+    rect->height = (gint)working_area[3];
 
     XFree(prop);
-_out:
-    queue_layout_items(desktop);
-    return;
+    return TRUE;
+}
+#endif
+
+static inline gboolean rect_equal(const GdkRectangle* a, const GdkRectangle* b)
+{
+    return a->x == b->x && a->y == b->y && a->width == b->width && a->height == b->height;
+}
+
+/* returns TRUE if the working area of the screen or any monitor is changed */
+gboolean update_working_area(FmDesktop* desktop)
+{
+    GdkScreen* screen = gtk_widget_get_screen((GtkWidget*)desktop);
+    GdkWindow* root = gdk_screen_get_root_window(screen);
+    GdkRectangle rect;
+    gboolean changed;
+    guint i;
+
+    if(!get_net_workarea(root, &rect))
+    {
+        /* default to screen size */
+        rect.x = 0;
+        rect.y = 0;
+        rect.width = gdk_screen_get_width(screen);
+        rect.height = gdk_screen_get_height(screen);
+    }
+
+    changed = !rect_equal(&rect, &desktop->working_area);
+    desktop->working_area = rect;
+
+    /* _NET_WORKAREA is a single rectangle for all monitors, so the
+     * working area of a monitor is the part of it on the monitor. */
+    for(i = 0; i < desktop->monitors->len; ++i)
+    {
+        FmDesktopMonitor* mon = (FmDesktopMonitor*)g_ptr_array_index(desktop->monitors, i);
+        GdkRectangle wa;
+        if(!gdk_rectangle_intersect(&mon->geometry, &rect, &wa))
+            wa = mon->geometry;
+        if(!rect_equal(&wa, &mon->working_area))
+        {
+            mon->working_area = wa;
+            changed = TRUE;
+        }
+    }
+
+    if(changed)
+        queue_layout_items(desktop);
+    return changed;
 }
 
 void on_screen_size_changed(GdkScreen* screen, FmDesktop* desktop)
@@ -1925,6 +4567,147 @@ void on_screen_size_changed(GdkScreen* screen, FmDesktop* desktop)
     gtk_window_resize((GtkWindow*)desktop, gdk_screen_get_width(screen), gdk_screen_get_height(screen));
 }
 
+static void free_monitor(FmDesktopMonitor* mon)
+{
+    drop_preloaded_wallpaper(mon);
+    if(mon->wallpaper_req)
+        fm_wallpaper_cancel(mon->wallpaper_req);
+    if(mon->wallpaper_pix)
+        g_object_unref(mon->wallpaper_pix);
+    g_free(mon->wallpaper);
+    g_free(mon->name);
+    g_slice_free(FmDesktopMonitor, mon);
+}
+
+/* the primary monitor first, and then from the left (right for RTL) */
+static gint compare_monitors(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    FmDesktopMonitor* mon1 = *(FmDesktopMonitor**)a;
+    FmDesktopMonitor* mon2 = *(FmDesktopMonitor**)b;
+    int ret;
+    if(mon1->primary != mon2->primary)
+        return mon1->primary ? -1 : 1;
+    ret = mon1->geometry.x - mon2->geometry.x;
+    if(gtk_widget_get_direction(GTK_WIDGET(user_data)) == GTK_TEXT_DIR_RTL)
+        ret = -ret;
+    if(ret == 0)
+        ret = mon1->geometry.y - mon2->geometry.y;
+    return ret != 0 ? ret : mon1->num - mon2->num;
+}
+
+/* Get the monitors of the screen. The monitors not changed are kept
+ * with their wallpapers, and the area of the monitors removed is filled
+ * with the background color. Returns TRUE if any monitor is changed.
+ * The monitors are matched by the names of their outputs, since GDK
+ * numbers them again when one is plugged or unplugged. */
+static gboolean update_monitors(FmDesktop* desktop)
+{
+    GdkScreen* screen = gtk_widget_get_screen((GtkWidget*)desktop);
+    GPtrArray* old = desktop->monitors;
+    int i, n = gdk_screen_get_n_monitors(screen), primary = 0;
+    gboolean changed = FALSE;
+    guint k;
+
+#if GTK_CHECK_VERSION(2,20,0)
+    primary = gdk_screen_get_primary_monitor(screen);
+#endif
+    desktop->monitors = g_ptr_array_sized_new(n);
+    for(i = 0; i < n; ++i)
+    {
+        FmDesktopMonitor* mon = NULL;
+        GdkRectangle geometry;
+        char* name = gdk_screen_get_monitor_plug_name(screen, i);
+        gdk_screen_get_monitor_geometry(screen, i, &geometry);
+        for(k = 0; old && k < old->len; ++k)
+        {
+            FmDesktopMonitor* prev = (FmDesktopMonitor*)g_ptr_array_index(old, k);
+            /* the number is used only if the names are unknown */
+            if((name && prev->name) ? strcmp(name, prev->name) != 0 : prev->num != i)
+                continue;
+            if(rect_equal(&prev->geometry, &geometry))
+            {
+                mon = prev;
+                g_ptr_array_remove_index_fast(old, k);
+            }
+            break;
+        }
+        if(mon)
+        {
+            g_free(name);
+            /* the wallpaper of a monitor without a name is looked up by number */
+            if(mon->num != i)
+            {
+                mon->num = i;
+                if(!mon->name)
+                    changed = TRUE;
+            }
+        }
+        else
+        {
+            mon = g_slice_new0(FmDesktopMonitor);
+            mon->desktop = desktop;
+            mon->num = i;
+            mon->name = name;
+            mon->geometry = geometry;
+            mon->need_redraw = TRUE;
+            changed = TRUE;
+        }
+        if(mon->primary != (i == primary))
+        {
+            mon->primary = (i == primary);
+            changed = TRUE;
+        }
+        g_ptr_array_add(desktop->monitors, mon);
+    }
+    g_ptr_array_sort_with_data(desktop->monitors, compare_monitors, desktop);
+
+    if(old)
+    {
+        for(k = 0; k < old->len; ++k)
+        {
+            FmDesktopMonitor* mon = (FmDesktopMonitor*)g_ptr_array_index(old, k);
+            changed = TRUE;
+            /* draw the monitors which were covered by the removed one again */
+            if(desktop->wallpaper_pixmap)
+            {
+                GdkRectangle rect;
+                for(i = 0; i < n; ++i)
+                {
+                    FmDesktopMonitor* m = (FmDesktopMonitor*)g_ptr_array_index(desktop->monitors, i);
+                    if(gdk_rectangle_intersect(&m->geometry, &mon->geometry, &rect))
+                        m->need_redraw = TRUE;
+                }
+                fill_rects(desktop, desktop->wallpaper_pixmap, &mon->geometry, 1);
+                gdk_window_clear_area(gdk_screen_get_root_window(screen), mon->geometry.x,
+                                      mon->geometry.y, mon->geometry.width, mon->geometry.height);
+                queue_redraw(desktop, &mon->geometry);
+            }
+            free_monitor(mon);
+        }
+        g_ptr_array_free(old, TRUE);
+    }
+    return changed;
+}
+
+void on_monitors_changed(GdkScreen* screen, FmDesktop* desktop)
+{
+    /* the window is resized too if the size of the screen is changed,
+     * and this is done again in on_size_allocate(). */
+    if(!update_monitors(desktop))
+        return;
+    update_working_area(desktop);
+    queue_layout_items(desktop);
+    if(GTK_WIDGET_REALIZED(desktop))
+        update_background(desktop);
+}
+
+static GdkRectangle* get_primary_working_area(FmDesktop* desktop)
+{
+    if(desktop->monitors->len == 0)
+        return &desktop->working_area;
+    return &((FmDesktopMonitor*)g_ptr_array_index(desktop->monitors, 0))->working_area;
+}
+
 void on_dnd_src_data_get(FmDndSrc* ds, FmDesktop* desktop)
 {
     FmFileInfoList* files = fm_desktop_get_selected_files(desktop);
@@ -1947,7 +4730,10 @@ void on_desktop_text_changed(FmConfig* cfg, gpointer user_data)
     int i;
     /* FIXME: we only need to redraw text lables */
     for(i=0; i < n_screens; ++i)
-        gtk_widget_queue_draw(desktops[i]);
+    {
+        ++FM_DESKTOP(desktops[i])->surface_stamp;
+        queue_redraw(FM_DESKTOP(desktops[i]), NULL);
+    }
 }
 
 void on_desktop_font_changed(FmConfig* cfg, gpointer user_data)
@@ -1967,8 +4753,9 @@ void on_desktop_font_changed(FmConfig* cfg, gpointer user_data)
                 FmDesktop* desktop = desktops[i];
                 PangoContext* pc = gtk_widget_get_pango_context( (GtkWidget*)desktop );
                 pango_context_set_font_description(pc, font_desc);
-                pango_layout_context_changed(desktop->pl);
-                gtk_widget_queue_resize(GTK_WIDGET(desktop));
+                /* the labels are measured again by the next layout,
+                 * which is run in idle handler in small chunks. */
+                invalidate_text_layouts(desktop);
                 /* layout_items(desktop); */
                 /* gtk_widget_queue_draw(desktops[i]); */
             }
@@ -1978,23 +4765,229 @@ void on_desktop_font_changed(FmConfig* cfg, gpointer user_data)
         font_desc = NULL;
 }
 
+void on_desktop_stacks_changed(FmConfig* cfg, gpointer user_data)
+{
+    int i;
+    for(i = 0; i < n_screens; ++i)
+    {
+        FmDesktop* desktop = FM_DESKTOP(desktops[i]);
+        collapse_stack(desktop);
+        queue_layout_items(desktop);
+        queue_redraw(desktop, NULL);
+    }
+}
+
+/* Get the pixbuf of the icon at the current size. The model loads the
+ * icon of every row by itself, so the desktop keeps its own cache
+ * instead, and items with the same icon share one pixbuf. FmIcon objects
+ * are unique for each icon name, so they can be used as the key. */
+GdkPixbuf* get_icon_pixbuf(FmIcon* icon)
+{
+    GdkPixbuf* pix;
+    if(G_UNLIKELY(!icon_cache))
+        icon_cache = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                           (GDestroyNotify)fm_icon_unref, g_object_unref);
+    pix = (GdkPixbuf*)g_hash_table_lookup(icon_cache, icon);
+    if(!pix)
+    {
+        pix = fm_icon_get_pixbuf(icon, fm_config->big_icon_size);
+        if(!pix)
+            return NULL;
+        g_hash_table_insert(icon_cache, fm_icon_ref(icon), pix);
+    }
+    return pix;
+}
+
+static void set_item_icon(FmDesktop* desktop, FmDesktopItem* item, GdkPixbuf* icon)
+{
+    redraw_item(desktop, item);
+    if(item->icon)
+        g_object_unref(item->icon);
+    item->icon = icon ? (GdkPixbuf*)g_object_ref(icon) : NULL;
+    free_item_surfaces(item);
+    grid_remove_item(desktop, item);
+    calc_item_size(desktop, item);
+    grid_insert_item(desktop, item);
+    redraw_item(desktop, item);
+}
+
+/* the desktop the item is shown on */
+static FmDesktop* get_item_desktop(FmDesktopItem* item)
+{
+    int i;
+    for( i = 0; i < n_screens; i++ )
+    {
+        FmDesktop* desktop = FM_DESKTOP(desktops[i]);
+        if(g_hash_table_lookup(desktop->item_hash, item->it.user_data) == item)
+            return desktop;
+    }
+    return NULL;
+}
+
+static void on_thumbnail_ready(GdkPixbuf* pix, gpointer user_data)
+{
+    FmDesktopItem* item = (FmDesktopItem*)user_data;
+    FmDesktop* desktop = get_item_desktop(item);
+
+    item->thumb_req = NULL;
+    if(pix)
+    {
+        item->has_thumbnail = TRUE;
+        set_item_icon(desktop, item, pix);
+    }
+    else
+    {
+        /* show the icon instead of the outdated thumbnail, if any */
+        item->thumb_failed = TRUE;
+        update_item_icon(desktop, item);
+    }
+}
+
+/* Load the thumbnail of the item if it's not loaded for the current
+ * icon size and mtime of the file. Thumbnails are read or generated by
+ * the workers of thumb.c, the items not covered by panels first, and
+ * they replace the icons when done. Returns FALSE if the item should
+ * not have a thumbnail. */
+static gboolean update_item_thumbnail(FmDesktop* desktop, FmDesktopItem* item)
+{
+    time_t mtime;
+    GdkRectangle rect;
+
+    if(!item->materialized || !fm_config->show_thumbnail || !fm_thumb_is_supported(item->fi))
+    {
+        if(item->thumb_req)
+        {
+            fm_thumb_cancel(item->thumb_req);
+            item->thumb_req = NULL;
+        }
+        return FALSE;
+    }
+    mtime = fm_file_info_get_mtime(item->fi);
+    if(item->thumb_size == fm_config->big_icon_size && item->thumb_mtime == mtime
+       && (item->has_thumbnail || item->thumb_req || item->thumb_failed))
+        return TRUE; /* up to date or being loaded */
+
+    if(item->thumb_req)
+        fm_thumb_cancel(item->thumb_req);
+    item->thumb_size = fm_config->big_icon_size;
+    item->thumb_mtime = mtime;
+    item->thumb_failed = FALSE;
+    rect.x = item->x;
+    rect.y = item->y;
+    rect.width = desktop->cell_w;
+    rect.height = desktop->cell_h;
+    item->thumb_req = fm_thumb_load_async(item->fi, item->thumb_size,
+                                          gdk_rectangle_intersect(&rect, &desktop->working_area, NULL) ? 0 : 1,
+                                          on_thumbnail_ready, item);
+    return TRUE;
+}
+
+/* load the icon of the item again, and update its size */
+void update_item_icon(FmDesktop* desktop, FmDesktopItem* item)
+{
+    GdkPixbuf* icon = NULL;
+
+    if(item->icon_pending)
+    {
+        item->icon_pending = FALSE;
+        --desktop->n_icons_pending;
+    }
+    /* the icon is loaded when the item is shown */
+    if(!item->materialized)
+        return;
+    if(item->icon_src != item->fi->icon)
+    {
+        if(item->icon_src)
+            fm_icon_unref(item->icon_src);
+        item->icon_src = item->fi->icon ? fm_icon_ref(item->fi->icon) : NULL;
+    }
+    /* the thumbnail is kept, or shown until the new one is loaded */
+    if(update_item_thumbnail(desktop, item) && item->has_thumbnail
+       && (item->thumb_req || !item->thumb_failed))
+        return;
+    item->has_thumbnail = FALSE;
+    if(item->icon_src)
+        icon = get_icon_pixbuf(item->icon_src);
+    if(icon == item->icon)
+        return;
+    set_item_icon(desktop, item, icon);
+}
+
+/* load the icons marked by reload_icons() a few at a time, the ones on
+ * the screen first, so the desktop is drawn and stays responsive while
+ * the icons are being loaded. */
+static gboolean on_idle_load_icons(FmDesktop* desktop)
+{
+    GdkScreen* screen = gtk_widget_get_screen((GtkWidget*)desktop);
+    GdkRectangle screen_rect, rect;
+    GTimer* timer = g_timer_new();
+    guint n = 0;
+
+    screen_rect.x = screen_rect.y = 0;
+    screen_rect.width = gdk_screen_get_width(screen);
+    screen_rect.height = gdk_screen_get_height(screen);
+
+    while(desktop->n_icons_pending > 0)
+    {
+        FmDesktopItem* item;
+        if(++n % LAYOUT_CHECK_INTERVAL == 0 && g_timer_elapsed(timer, NULL) > LAYOUT_TIME_SLICE)
+            break;
+        if(desktop->icons_pos >= desktop->items->len)
+        {
+            /* the visible items are done and the rest are loaded next.
+             * the items may be moved in the array meanwhile, so the
+             * array is scanned again until all of them are done. */
+            desktop->icons_pos = 0;
+            desktop->icons_visible_only = FALSE;
+            continue;
+        }
+        item = get_item(desktop, desktop->icons_pos++);
+        if(!item->icon_pending)
+            continue;
+        if(desktop->icons_visible_only)
+        {
+            get_item_bounds(item, &rect);
+            if(!gdk_rectangle_intersect(&rect, &screen_rect, NULL))
+                continue;
+        }
+        update_item_icon(desktop, item);
+    }
+    g_timer_destroy(timer);
+
+    if(desktop->n_icons_pending > 0)
+        return TRUE;
+    desktop->idle_icons = 0;
+    return FALSE;
+}
+
+/* Load the icons of all items again, after the icon theme or the icon
+ * size is changed. The items keep their current icons until the new
+ * ones are loaded. If this is called again before it's done, the icons
+ * are loaded from the beginning with the newest theme and size. */
 static void reload_icons()
 {
     int i;
+    if(link_emblem)
+    {
+        g_object_unref(link_emblem);
+        link_emblem = NULL;
+    }
+    if(icon_cache)
+        g_hash_table_remove_all(icon_cache);
+
     for(i=0; i < n_screens; ++i)
     {
         FmDesktop* desktop = desktops[i];
-        GList* l;
-        for(l=desktop->items;l;l=l->next)
-        {
-            FmDesktopItem* item = (FmDesktopItem*)l->data;
-            if(item->icon)
-            {
-                g_object_unref(item->icon);
-                item->icon = NULL;
-                gtk_tree_model_get(GTK_TREE_MODEL(model), &item->it, COL_FILE_ICON, &item->icon, -1);
-            }
-        }
+        guint j;
+        ++desktop->surface_stamp;
+        for(j = 0; j < desktop->items->len; ++j)
+            get_item(desktop, j)->icon_pending = TRUE;
+        desktop->n_icons_pending = desktop->items->len;
+        desktop->icons_pos = 0;
+        desktop->icons_visible_only = TRUE;
+        if(!desktop->idle_icons)
+            desktop->idle_icons = g_idle_add((GSourceFunc)on_idle_load_icons, desktop);
+        /* the size of the cells may be changed */
         gtk_widget_queue_resize(GTK_WIDGET(desktop));
     }
 }
@@ -2010,6 +5003,12 @@ void on_icon_theme_changed(GtkIconTheme* theme, gpointer user_data)
     reload_icons();
 }
 
+/* the thumbnails are loaded or dropped by update_item_icon() */
+void on_show_thumbnail_changed(FmConfig* cfg, gpointer user_data)
+{
+    reload_icons();
+}
+
 void on_paste(GtkAction* act, gpointer user_data)
 {
     FmPath* path = fm_path_get_desktop();
@@ -2032,11 +5031,11 @@ void on_invert_select(GtkAction* act, gpointer user_data)
     for(i=0; i < n_screens; ++i)
     {
         FmDesktop* desktop = desktops[i];
-        GList* l;
-        for(l=desktop->items;l;l=l->next)
+        guint j;
+        for(j = 0; j < desktop->items->len; ++j)
         {
-            FmDesktopItem* item = (FmDesktopItem*)l->data;
-            item->is_selected = !item->is_selected;
+            FmDesktopItem* item = get_item(desktop, j);
+            set_item_selected(desktop, item, !item->is_selected);
             redraw_item(desktop, item);
         }
     }
@@ -2116,25 +5115,23 @@ static void on_fix_pos(GtkToggleAction* act, gpointer user_data)
         for(l = items; l; l=l->next)
         {
             FmDesktopItem* item = (FmDesktopItem*)l->data;
-            if(!item->fixed_pos)
-            {
-                item->fixed_pos = TRUE;
-                desktop->fixed_items = g_list_prepend(desktop->fixed_items, item);
-            }
+            set_item_fixed(desktop, item, TRUE);
+            save_item_pos(desktop, item);
         }
+        /* the cells of the items are occupied now */
+        queue_layout_items(desktop);
     }
     else
     {
         for(l = items; l; l=l->next)
         {
             FmDesktopItem* item = (FmDesktopItem*)l->data;
-            item->fixed_pos = FALSE;
-            desktop->fixed_items = g_list_remove(desktop->fixed_items, item);
+            set_item_fixed(desktop, item, FALSE);
+            save_item_pos(desktop, item);
         }
         layout_items(desktop);
     }
     g_list_free(items);
-    save_item_pos(desktop);
 }
 
 /* round() is only available in C99. Don't use it now for portability. */
@@ -2149,23 +5146,27 @@ static void on_snap_to_grid(GtkAction* act, gpointer user_data)
     FmDesktopItem* item;
     GList* items = get_selected_items(desktop, NULL);
     GList* l;
-    int x, y, bottom;
-    GtkTextDirection direction = gtk_widget_get_direction(GTK_WIDGET(desktop));
-
-    y = desktop->working_area.y + desktop->ymargin;
-    bottom = desktop->working_area.y + desktop->working_area.height - desktop->ymargin - desktop->cell_h;
-
-    if(direction != GTK_TEXT_DIR_RTL) /* LTR or NONE */
-        x = desktop->working_area.x + desktop->xmargin;
-    else /* RTL */
-        x = desktop->working_area.x + desktop->working_area.width - desktop->xmargin - desktop->cell_w;
+    int x, y;
+    guint i;
 
     for( l = items; l; l = l->next )
     {
         int new_x, new_y;
+        FmDesktopLayoutArea* area = NULL;
         item = (FmDesktopItem*)l->data;
-        if(!item->fixed_pos)
+        if(!item->fixed_pos || !desktop->layout_areas)
             continue;
+        /* snap to the cells of the monitor the item is on */
+        for(i = 0; i + 1 < desktop->n_layout_areas && !area; ++i)
+        {
+            if(is_point_in_rect(&desktop->layout_areas[i].rect,
+                                item->x + desktop->cell_w / 2, item->y + desktop->cell_h / 2))
+                area = &desktop->layout_areas[i];
+        }
+        if(!area)
+            area = &desktop->layout_areas[0];
+        x = area->x0;
+        y = area->y0;
         new_x = x + _round((double)(item->x - x) / desktop->cell_w) * desktop->cell_w;
         new_y = y + _round((double)(item->y - y) / desktop->cell_h) * desktop->cell_h;
         move_item(desktop, item, new_x, new_y, FALSE);
@@ -2176,47 +5177,44 @@ static void on_snap_to_grid(GtkAction* act, gpointer user_data)
 }
 
 
+static gint compare_item_index(FmDesktopItem* item1, FmDesktopItem* item2)
+{
+    return (gint)item1->index - (gint)item2->index;
+}
+
+/* get a list of the selected items in the order of the model */
+static GList* get_sorted_selection(FmDesktop* desktop)
+{
+    GList* items = g_list_copy(desktop->selected.head);
+    return g_list_sort(items, (GCompareFunc)compare_item_index);
+}
+
 GList* get_selected_items(FmDesktop* desktop, int* n_items)
 {
-    GList* items = NULL;
-    GList* l;
-    int n = 0;
-    FmDesktopItem* focus = NULL;
-    for(l=desktop->items; l; l=l->next)
-    {
-        FmDesktopItem* item = (FmDesktopItem*)l->data;
-        if(item->is_selected)
-        {
-            if(G_LIKELY(item != desktop->focus))
-            {
-                items = g_list_prepend(items, item);
-                ++n;
-            }
-            else
-                focus = item;
-        }
-    }
-    items = g_list_reverse(items);
-    if(focus)
+    GList* items = get_sorted_selection(desktop);
+    FmDesktopItem* focus = desktop->focus;
+    /* the focused item is always the first one */
+    if(focus && focus->is_selected && items->data != focus)
     {
+        items = g_list_remove(items, focus);
         items = g_list_prepend(items, focus);
-        ++n;
     }
     if(n_items)
-        *n_items = n;
+        *n_items = desktop->selected.length;
     return items;
 }
 
 FmFileInfoList* fm_desktop_get_selected_files(FmDesktop* desktop)
 {
+    GList* items = get_sorted_selection(desktop);
     GList* l;
     FmFileInfoList* files = fm_file_info_list_new();
-    for(l=desktop->items; l; l=l->next)
+    for(l=items; l; l=l->next)
     {
         FmDesktopItem* item = (FmDesktopItem*)l->data;
-        if(item->is_selected)
-            fm_list_push_tail(files, item->fi);
+        fm_list_push_tail(files, item->fi);
     }
+    g_list_free(items);
     if(fm_list_is_empty(files))
     {
         fm_list_unref(files);
@@ -2227,14 +5225,15 @@ FmFileInfoList* fm_desktop_get_selected_files(FmDesktop* desktop)
 
 FmPathList* fm_desktop_get_selected_paths(FmDesktop* desktop)
 {
+    GList* items = get_sorted_selection(desktop);
     GList* l;
     FmPathList* files = fm_path_list_new();
-    for(l=desktop->items; l; l=l->next)
+    for(l=items; l; l=l->next)
     {
         FmDesktopItem* item = (FmDesktopItem*)l->data;
-        if(item->is_selected)
-            fm_list_push_tail(files, item->fi->path);
+        fm_list_push_tail(files, item->fi->path);
     }
+    g_list_free(items);
     if(fm_list_is_empty(files))
     {
         fm_list_unref(files);
@@ -2433,7 +5432,7 @@ static gboolean on_drag_leave ( GtkWidget *dest_widget,
 
 static void move_item(FmDesktop* desktop, FmDesktopItem* item, int x, int y, gboolean redraw)
 {
-    GList* l;
+    guint i;
     int dx, dy;
     /* this call invalid the area occupied by the item and a redraw
      * is queued. */
@@ -2443,21 +5442,31 @@ static void move_item(FmDesktop* desktop, FmDesktopItem* item, int x, int y, gbo
     dx = x - item->x;
     dy = y - item->y;
 
+    grid_remove_item(desktop, item);
     item->x = x;
     item->y = y;
+    /* the item is taken out of its stack and placed on the desktop */
+    if(item->stack)
+    {
+        g_ptr_array_remove(item->stack->items, item);
+        item->stack = NULL;
+        item->in_overlay = FALSE;
+        queue_layout_items(desktop);
+    }
 
     /* calc_item_size(desktop, item); */
     item->icon_rect.x += dx;
     item->icon_rect.y += dy;
     item->text_rect.x += dx;
     item->text_rect.y += dy;
+    /* the item may be moved onto the screen */
+    if(!item->materialized)
+        calc_item_size(desktop, item);
+    grid_insert_item(desktop, item);
 
     /* make the item use customized fixed position. */
-    if(!item->fixed_pos)
-    {
-        item->fixed_pos = TRUE;
-        desktop->fixed_items = g_list_prepend(desktop->fixed_items, item);
-    }
+    set_item_fixed(desktop, item, TRUE);
+    save_item_pos(desktop, item);
 
     /* move the item to a new place, and queue a redraw for the new rect. */
     if(redraw)
@@ -2465,9 +5474,9 @@ static void move_item(FmDesktop* desktop, FmDesktopItem* item, int x, int y, gbo
 
 #if 0
     /* check if the item is overlapped with another item */
-    for(l = desktop->items; l; l=l->next)
+    for(i = 0; i < desktop->items->len; ++i)
     {
-        FmDesktopItem* item2 = (FmDesktopItem*)l->data;
+        FmDesktopItem* item2 = get_item(desktop, i);
     }
 #endif
 }
@@ -2523,10 +5532,6 @@ static gboolean on_drag_drop ( GtkWidget *dest_widget,
             ret = TRUE;
             gtk_drag_finish(drag_context, TRUE, FALSE, time);
 
-            /* FIXME: save position of desktop icons everytime is
-             * extremely inefficient, but currently inevitable. */
-            save_item_pos(desktop);
-
             queue_layout_items(desktop);
         }
     }
@@ -2605,7 +5610,7 @@ static void fm_desktop_class_init(FmDesktopClass *klass)
     wc->realize = on_realize;
     wc->focus_in_event = on_focus_in;
     wc->focus_out_event = on_focus_out;
-    /* wc->scroll_event = on_scroll; */
+    wc->scroll_event = on_scroll;
     wc->delete_event = (DeleteEvtHandler)gtk_true;
 
     wc->drag_motion = on_drag_motion;
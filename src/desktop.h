@@ -25,6 +25,8 @@
 
 #include <gtk/gtk.h>
 #include <libfm/fm-gtk.h>
+#include "wallpaper.h"
+#include "item-pos.h"
 
 G_BEGIN_DECLS
 
@@ -41,15 +43,22 @@ G_BEGIN_DECLS
 typedef struct _FmDesktop           FmDesktop;
 typedef struct _FmDesktopClass      FmDesktopClass;
 typedef struct _FmDesktopItem       FmDesktopItem;
+typedef struct _FmDesktopStack      FmDesktopStack;
+typedef struct _FmDesktopMonitor    FmDesktopMonitor;
+typedef struct _FmDesktopLayoutArea FmDesktopLayoutArea;
 
 struct _FmDesktop
 {
     GtkWindow parent;
     GdkGC* gc;
-    PangoLayout* pl;
-    GtkCellRendererPixbuf* icon_render;
-    GList* items;
-    GList* fixed_items;
+    GPtrArray* items; /* FmDesktopItem*, in the order of the model */
+    GHashTable* item_hash; /* iter user_data of an item -> FmDesktopItem* */
+    GPtrArray* name_index; /* FmDesktopItem* sorted by name, for type-ahead find */
+    GString* typeahead; /* text typed to find an item */
+    guint typeahead_timeout;
+    GQueue fixed_items; /* items with fixed position, linked by item->fixed_link */
+    FmItemPosDb* pos_db; /* positions of fixed_items, see get_pos_db() */
+    GQueue selected; /* selected items, linked by item->sel_link */
     guint xpad;
     guint ypad;
     guint spacing;
@@ -59,9 +68,14 @@ struct _FmDesktop
     guint text_w;
     guint pango_text_h;
     guint pango_text_w;
+    guint font_h; /* cached height of the font, 0 if it needs to be queried */
+    guint text_stamp; /* increased when all labels need to be shaped again */
+    guint surface_stamp; /* increased when all items need to be rendered again */
     guint cell_w;
     guint cell_h;
-    GdkRectangle working_area;
+    GdkRectangle working_area; /* of the whole screen */
+    GPtrArray* monitors; /* FmDesktopMonitor*, in the order items are laid out */
+    guint working_area_timeout; /* delayed update_working_area() */
     FmDesktopItem* focus;
     FmDesktopItem* drop_hilight;
     FmDesktopItem* hover_item;
@@ -74,9 +88,40 @@ struct _FmDesktop
     gboolean dragging : 1;
     gboolean dragging2 : 1;
     guint idle_layout;
+    guint idle_icons; /* icons being reloaded, see reload_icons() */
+    guint icons_pos;
+    guint n_icons_pending;
+    gboolean icons_visible_only;
+    guint layout_pos; /* index of the first item to be laid out */
+    FmDesktopLayoutArea* layout_areas; /* where the items are laid out */
+    guint n_layout_areas;
+    guint8* occupied; /* bitmap of layout slots occupied by fixed items */
+    guint occupied_slots;
+    /* stacks of the items which don't fit in the working area */
+    FmDesktopStack* stacks;
+    guint n_unstacked; /* number of auto-placed items not collapsed into stacks */
+    guint layout_n_auto; /* number of auto-placed items laid out so far */
+    FmDesktopStack* expanded_stack; /* the stack shown in the overlay */
+    GdkRectangle overlay_rect;
+    guint overlay_page;
     FmDndSrc* dnd_src;
     FmDndDest* dnd_dest;
     guint single_click_timeout_handler;
+    GdkPixmap* wallpaper_pixmap; /* the root window background, NULL if it's a color */
+    GSList* layers; /* FmDesktopLayer* of the painting modules, see desktop-module.h */
+    GdkPixmap* backbuffer; /* contents of the window, see on_expose() */
+    GdkRegion* damage; /* area of the backbuffer to repaint, NULL if none */
+    guint n_damage_rects;
+    guint repaint_idle;
+    /* spatial index of the items, see grid_*() in desktop.c */
+    GSList** grid;
+    int grid_x;
+    int grid_y;
+    guint grid_cell_w;
+    guint grid_cell_h;
+    guint grid_cols;
+    guint grid_rows;
+    guint grid_stamp;
 };
 
 struct _FmDesktopClass
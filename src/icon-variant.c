@@ -0,0 +1,149 @@
+/*
+ *      icon-variant.c
+ *
+ *      Copyright 2010 Hong Jen Yee (PCMan) <pcman.tw@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include "icon-variant.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * The variants are made the same way as GtkCellRendererPixbuf does, but
+ * with integer math and a kernel which is vectorized with SSE2 when it's
+ * available: scale_row() multiplies each channel by a factor.
+ */
+
+typedef struct _IconVariants IconVariants;
+struct _IconVariants
+{
+    GdkPixbuf* pix[N_FM_ICON_VARIANTS];
+    guint32 color[N_FM_ICON_VARIANTS]; /* the color the variant is made with */
+};
+
+G_LOCK_DEFINE_STATIC(variants);
+
+/* multiply the channels by mul / 256. mul holds the factors of the four
+ * channels of two pixels, the ones at even x first. */
+static void scale_row(guchar* p, int width, int n_channels, const guint16 mul[8])
+{
+    int x = 0;
+#ifdef __SSE2__
+    if(n_channels == 4)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i m = _mm_loadu_si128((const __m128i*)mul);
+        for(; x + 4 <= width; x += 4, p += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)p);
+            __m128i lo = _mm_unpacklo_epi8(v, zero);
+            __m128i hi = _mm_unpackhi_epi8(v, zero);
+            lo = _mm_srli_epi16(_mm_mullo_epi16(lo, m), 8);
+            hi = _mm_srli_epi16(_mm_mullo_epi16(hi, m), 8);
+            _mm_storeu_si128((__m128i*)p, _mm_packus_epi16(lo, hi));
+        }
+    }
+#endif
+    for(; x < width; ++x, p += n_channels)
+    {
+        const guint16* f = mul + (x & 1) * 4;
+        p[0] = (p[0] * f[0]) >> 8;
+        p[1] = (p[1] * f[1]) >> 8;
+        p[2] = (p[2] * f[2]) >> 8;
+        if(n_channels == 4)
+            p[3] = (p[3] * f[3]) >> 8;
+    }
+}
+
+static GdkPixbuf* make_variant(GdkPixbuf* icon, FmIconVariant variant, const GdkColor* color)
+{
+    GdkPixbuf* pix = gdk_pixbuf_copy(icon);
+    guchar* pixels = gdk_pixbuf_get_pixels(pix);
+    int width = gdk_pixbuf_get_width(pix);
+    int height = gdk_pixbuf_get_height(pix);
+    int rowstride = gdk_pixbuf_get_rowstride(pix);
+    int n_channels = gdk_pixbuf_get_n_channels(pix);
+    guint16 mul[8];
+    int y;
+
+    switch(variant)
+    {
+    case FM_ICON_VARIANT_SELECTED:
+        /* the same as create_colorized_pixbuf() of GtkCellRendererPixbuf */
+        mul[0] = mul[4] = color->red / 255;
+        mul[1] = mul[5] = color->green / 255;
+        mul[2] = mul[6] = color->blue / 255;
+        mul[3] = mul[7] = 256;
+        for(y = 0; y < height; ++y)
+            scale_row(pixels + y * rowstride, width, n_channels, mul);
+        break;
+    default:
+        break;
+    }
+    return pix;
+}
+
+static void icon_variants_free(IconVariants* variants)
+{
+    int i;
+    for(i = 0; i < N_FM_ICON_VARIANTS; ++i)
+        if(variants->pix[i])
+            g_object_unref(variants->pix[i]);
+    g_slice_free(IconVariants, variants);
+}
+
+GdkPixbuf* fm_icon_variant_get(GdkPixbuf* icon, FmIconVariant variant, const GdkColor* color)
+{
+    GQuark quark = g_quark_from_static_string("fm-icon-variants");
+    IconVariants* variants;
+    GdkPixbuf* pix = NULL;
+    guint32 key = 0;
+
+    g_return_val_if_fail(variant < N_FM_ICON_VARIANTS, NULL);
+
+    if(variant == FM_ICON_VARIANT_SELECTED)
+        key = ((guint32)(color->red >> 8) << 16) | ((color->green >> 8) << 8) | (color->blue >> 8);
+
+    G_LOCK(variants);
+    variants = (IconVariants*)g_object_get_qdata(G_OBJECT(icon), quark);
+    if(variants && variants->pix[variant] && variants->color[variant] == key)
+        pix = (GdkPixbuf*)g_object_ref(variants->pix[variant]);
+    G_UNLOCK(variants);
+    if(pix)
+        return pix;
+
+    /* made without holding the lock, so the threads don't wait for each
+     * other. if two of them make the same variant, the last one is kept. */
+    pix = make_variant(icon, variant, color);
+
+    G_LOCK(variants);
+    variants = (IconVariants*)g_object_get_qdata(G_OBJECT(icon), quark);
+    if(!variants)
+    {
+        variants = g_slice_new0(IconVariants);
+        g_object_set_qdata_full(G_OBJECT(icon), quark, variants, (GDestroyNotify)icon_variants_free);
+    }
+    if(variants->pix[variant])
+        g_object_unref(variants->pix[variant]);
+    variants->pix[variant] = (GdkPixbuf*)g_object_ref(pix);
+    variants->color[variant] = key;
+    G_UNLOCK(variants);
+    return pix;
+}
@@ -0,0 +1,45 @@
+/*
+ *      icon-variant.h
+ *
+ *      Copyright 2010 Hong Jen Yee (PCMan) <pcman.tw@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __ICON_VARIANT_H__
+#define __ICON_VARIANT_H__
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+    FM_ICON_VARIANT_SELECTED, /* colorized with the selection color */
+    N_FM_ICON_VARIANTS
+} FmIconVariant;
+
+/* Get a variant of the icon, like the ones drawn by GtkCellRendererPixbuf.
+ * The variants are made once and kept with the icon, so they are shared
+ * by all the items using the same pixbuf, and freed along with it.
+ * color is only used by FM_ICON_VARIANT_SELECTED.
+ * The returned pixbuf should be freed with g_object_unref().
+ * This can be called in any thread. */
+GdkPixbuf* fm_icon_variant_get(GdkPixbuf* icon, FmIconVariant variant, const GdkColor* color);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,292 @@
+/*
+ *      item-pos.c
+ *
+ *      Copyright 2010 Hong Jen Yee (PCMan) <pcman.tw@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include "item-pos.h"
+
+#include <glib/gstdio.h>
+#include <string.h>
+#include <stdio.h>
+
+/*
+ * The file is a journal of changes: a magic string followed by records
+ * of fixed-size headers and the file names. Changes are appended to it,
+ * so moving some items only writes the records of those items. When the
+ * journal gets much longer than the number of positions it holds, it's
+ * compacted by writing a new file with one record per item.
+ * The numbers are stored in little endian.
+ */
+
+#define JOURNAL_MAGIC       "PCMFMIP1"
+#define JOURNAL_MAGIC_LEN   8
+#define RECORD_HEADER_LEN   12 /* op, unused, name length, x, y */
+#define SAVE_DELAY          2 /* seconds */
+#define COMPACT_SLACK       64 /* records allowed in addition to twice the positions */
+
+enum
+{
+    OP_SET = 1,
+    OP_REMOVE
+};
+
+typedef struct _ItemPos ItemPos;
+struct _ItemPos
+{
+    int x;
+    int y;
+};
+
+struct _FmItemPosDb
+{
+    char* path;
+    GHashTable* items; /* file name => ItemPos */
+    GHashTable* dirty; /* names of the items changed since last save */
+    guint n_records; /* number of records in the file */
+    guint save_timeout;
+};
+
+static void append_record(GString* buf, int op, const char* name, int x, int y)
+{
+    guint8 header[RECORD_HEADER_LEN];
+    gsize len = strlen(name);
+    guint16 len16 = GUINT16_TO_LE((guint16)MIN(len, G_MAXUINT16));
+    gint32 x32 = GINT32_TO_LE(x), y32 = GINT32_TO_LE(y);
+
+    header[0] = (guint8)op;
+    header[1] = 0;
+    memcpy(header + 2, &len16, 2);
+    memcpy(header + 4, &x32, 4);
+    memcpy(header + 8, &y32, 4);
+    g_string_append_len(buf, (const char*)header, RECORD_HEADER_LEN);
+    g_string_append_len(buf, name, GUINT16_FROM_LE(len16));
+}
+
+static void set_pos(FmItemPosDb* db, const char* name, int x, int y)
+{
+    ItemPos* pos = g_slice_new(ItemPos);
+    pos->x = x;
+    pos->y = y;
+    g_hash_table_replace(db->items, g_strdup(name), pos);
+}
+
+static void item_pos_free(ItemPos* pos)
+{
+    g_slice_free(ItemPos, pos);
+}
+
+/* returns FALSE if the file is damaged, e.g. by a crash while writing */
+static gboolean load_journal(FmItemPosDb* db, const char* data, gsize len)
+{
+    const char* p = data + JOURNAL_MAGIC_LEN;
+    const char* end = data + len;
+
+    if(len < JOURNAL_MAGIC_LEN || memcmp(data, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN) != 0)
+        return FALSE;
+    while(p < end)
+    {
+        guint16 name_len;
+        gint32 x, y;
+        char* name;
+
+        if(end - p < RECORD_HEADER_LEN)
+            return FALSE;
+        memcpy(&name_len, p + 2, 2);
+        name_len = GUINT16_FROM_LE(name_len);
+        if(end - p - RECORD_HEADER_LEN < name_len)
+            return FALSE;
+        memcpy(&x, p + 4, 4);
+        memcpy(&y, p + 8, 4);
+        name = g_strndup(p + RECORD_HEADER_LEN, name_len);
+        if(p[0] == OP_SET)
+            set_pos(db, name, GINT32_FROM_LE(x), GINT32_FROM_LE(y));
+        else if(p[0] == OP_REMOVE)
+            g_hash_table_remove(db->items, name);
+        else
+        {
+            g_free(name);
+            return FALSE;
+        }
+        g_free(name);
+        ++db->n_records;
+        p += RECORD_HEADER_LEN + name_len;
+    }
+    return TRUE;
+}
+
+/* import desktop-items-N.conf of older versions */
+static gboolean import_key_file(FmItemPosDb* db, const char* path)
+{
+    GKeyFile* kf = g_key_file_new();
+    gboolean ret = g_key_file_load_from_file(kf, path, 0, NULL);
+    if(ret)
+    {
+        gsize i, n;
+        char** names = g_key_file_get_groups(kf, &n);
+        for(i = 0; i < n; ++i)
+            set_pos(db, names[i], g_key_file_get_integer(kf, names[i], "x", NULL),
+                    g_key_file_get_integer(kf, names[i], "y", NULL));
+        g_strfreev(names);
+    }
+    g_key_file_free(kf);
+    return ret;
+}
+
+static gboolean ensure_dir(FmItemPosDb* db)
+{
+    char* dir = g_path_get_dirname(db->path);
+    int ret = g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+    return ret == 0;
+}
+
+/* write a new file containing one record for each position */
+static void compact(FmItemPosDb* db)
+{
+    GString* buf = g_string_sized_new(4096);
+    GHashTableIter it;
+    gpointer key, val;
+
+    g_string_append_len(buf, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN);
+    g_hash_table_iter_init(&it, db->items);
+    while(g_hash_table_iter_next(&it, &key, &val))
+    {
+        ItemPos* pos = (ItemPos*)val;
+        append_record(buf, OP_SET, (const char*)key, pos->x, pos->y);
+    }
+    /* the file is replaced at once, so it's never left half written */
+    if(ensure_dir(db) && g_file_set_contents(db->path, buf->str, buf->len, NULL))
+        db->n_records = g_hash_table_size(db->items);
+    g_string_free(buf, TRUE);
+}
+
+FmItemPosDb* fm_item_pos_db_open(const char* path, const char* legacy_path)
+{
+    FmItemPosDb* db = g_slice_new0(FmItemPosDb);
+    char* data;
+    gsize len;
+
+    db->path = g_strdup(path);
+    db->items = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)item_pos_free);
+    db->dirty = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    if(g_file_get_contents(path, &data, &len, NULL))
+    {
+        /* drop the damaged part, or the records appended later get lost */
+        if(!load_journal(db, data, len))
+            compact(db);
+        g_free(data);
+    }
+    else if(legacy_path && import_key_file(db, legacy_path))
+        compact(db);
+    return db;
+}
+
+void fm_item_pos_db_flush(FmItemPosDb* db)
+{
+    guint n_dirty = g_hash_table_size(db->dirty);
+
+    if(db->save_timeout)
+    {
+        g_source_remove(db->save_timeout);
+        db->save_timeout = 0;
+    }
+    if(n_dirty == 0)
+        return;
+
+    if(db->n_records + n_dirty > 2 * g_hash_table_size(db->items) + COMPACT_SLACK
+       || !g_file_test(db->path, G_FILE_TEST_EXISTS))
+        compact(db);
+    else
+    {
+        GString* buf = g_string_sized_new(n_dirty * 32);
+        GHashTableIter it;
+        gpointer key;
+        FILE* f;
+
+        g_hash_table_iter_init(&it, db->dirty);
+        while(g_hash_table_iter_next(&it, &key, NULL))
+        {
+            ItemPos* pos = (ItemPos*)g_hash_table_lookup(db->items, key);
+            if(pos)
+                append_record(buf, OP_SET, (const char*)key, pos->x, pos->y);
+            else
+                append_record(buf, OP_REMOVE, (const char*)key, 0, 0);
+        }
+        f = g_fopen(db->path, "ab");
+        if(f)
+        {
+            if(fwrite(buf->str, 1, buf->len, f) == buf->len)
+                db->n_records += n_dirty;
+            fclose(f);
+        }
+        g_string_free(buf, TRUE);
+    }
+    g_hash_table_remove_all(db->dirty);
+}
+
+static gboolean on_save_timeout(gpointer user_data)
+{
+    FmItemPosDb* db = (FmItemPosDb*)user_data;
+    db->save_timeout = 0;
+    fm_item_pos_db_flush(db);
+    return FALSE;
+}
+
+/* the changes made in a short time, like moving many items, are saved at once */
+static void queue_save(FmItemPosDb* db, const char* name)
+{
+    g_hash_table_replace(db->dirty, g_strdup(name), NULL);
+    if(!db->save_timeout)
+        db->save_timeout = g_timeout_add_seconds(SAVE_DELAY, on_save_timeout, db);
+}
+
+void fm_item_pos_db_close(FmItemPosDb* db)
+{
+    fm_item_pos_db_flush(db);
+    g_hash_table_destroy(db->items);
+    g_hash_table_destroy(db->dirty);
+    g_free(db->path);
+    g_slice_free(FmItemPosDb, db);
+}
+
+gboolean fm_item_pos_db_lookup(FmItemPosDb* db, const char* name, int* x, int* y)
+{
+    ItemPos* pos = (ItemPos*)g_hash_table_lookup(db->items, name);
+    if(!pos)
+        return FALSE;
+    *x = pos->x;
+    *y = pos->y;
+    return TRUE;
+}
+
+void fm_item_pos_db_set(FmItemPosDb* db, const char* name, int x, int y)
+{
+    ItemPos* pos = (ItemPos*)g_hash_table_lookup(db->items, name);
+    if(pos && pos->x == x && pos->y == y)
+        return;
+    set_pos(db, name, x, y);
+    queue_save(db, name);
+}
+
+void fm_item_pos_db_remove(FmItemPosDb* db, const char* name)
+{
+    if(g_hash_table_remove(db->items, name))
+        queue_save(db, name);
+}
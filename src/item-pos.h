@@ -0,0 +1,51 @@
+/*
+ *      item-pos.h
+ *
+ *      Copyright 2010 Hong Jen Yee (PCMan) <pcman.tw@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __ITEM_POS_H__
+#define __ITEM_POS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* positions of the desktop items placed by the user, indexed by the file
+ * names of the items. the changes are saved to the file in the background. */
+typedef struct _FmItemPosDb FmItemPosDb;
+
+/* If the file doesn't exist yet, the positions are imported from the key
+ * file legacy_path used by older versions, which is left untouched. */
+FmItemPosDb* fm_item_pos_db_open(const char* path, const char* legacy_path);
+
+/* save the pending changes and free the db */
+void fm_item_pos_db_close(FmItemPosDb* db);
+
+gboolean fm_item_pos_db_lookup(FmItemPosDb* db, const char* name, int* x, int* y);
+
+void fm_item_pos_db_set(FmItemPosDb* db, const char* name, int x, int y);
+
+void fm_item_pos_db_remove(FmItemPosDb* db, const char* name);
+
+/* write the pending changes now */
+void fm_item_pos_db_flush(FmItemPosDb* db);
+
+G_END_DECLS
+
+#endif
@@ -152,6 +152,13 @@ int main(int argc, char** argv)
     textdomain ( GETTEXT_PACKAGE );
 #endif
 
+    /* wallpapers are decoded in a worker thread, see wallpaper.c.
+     * threads are always initialized since GLib 2.32. */
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    if(!g_thread_supported())
+        g_thread_init(NULL);
+#endif
+
     /* initialize GTK+ and parse the command line arguments */
     if(G_UNLIKELY(!gtk_init_with_args(&argc, &argv, "", opt_entries, GETTEXT_PACKAGE, &err)))
     {
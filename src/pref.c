@@ -30,6 +30,7 @@
 #include "pref.h"
 #include "app-config.h"
 #include "desktop.h"
+#include "wallpaper.h"
 
 #define INIT_BOOL(b, st, name, changed_notify)  init_bool(b, #name, G_STRUCT_OFFSET(st, name), changed_notify)
 #define INIT_COMBO(b, st, name, changed_notify) init_combo(b, #name, G_STRUCT_OFFSET(st, name), changed_notify)
@@ -47,6 +48,8 @@ static GtkWidget* use_trash;
 */
 
 static GtkWidget* desktop_pref_dlg = NULL;
+static int wallpaper_monitor = -1; /* the monitor shown in the desktop preferences */
+static char* wallpaper_monitor_name = NULL; /* the name of its output */
 
 static void on_response(GtkDialog* dlg, int res, GtkWidget** pdlg)
 {
@@ -318,18 +321,93 @@ void fm_edit_preference( GtkWindow* parent, int page )
 static void on_wallpaper_set(GtkFileChooserButton* btn, gpointer user_data)
 {
     char* file = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(btn));
-    g_free(app_config->wallpaper);
-    app_config->wallpaper = file;
+    const char* old_file;
+    FmWallpaperMode mode;
+    fm_app_config_get_monitor_wallpaper(app_config, wallpaper_monitor, wallpaper_monitor_name, &old_file, &mode);
+    fm_app_config_set_monitor_wallpaper(app_config, wallpaper_monitor, wallpaper_monitor_name, file, mode);
+    g_free(file);
     fm_config_emit_changed(fm_config, "wallpaper");
 }
 
+static void on_wallpaper_mode_changed(GtkComboBox* combo, gpointer user_data)
+{
+    const char* file;
+    FmWallpaperMode mode;
+    fm_app_config_get_monitor_wallpaper(app_config, wallpaper_monitor, wallpaper_monitor_name, &file, &mode);
+    if(gtk_combo_box_get_active(combo) != (int)mode)
+    {
+        /* file is freed when it's set */
+        char* tmp = g_strdup(file);
+        fm_app_config_set_monitor_wallpaper(app_config, wallpaper_monitor, wallpaper_monitor_name,
+                                            tmp, gtk_combo_box_get_active(combo));
+        g_free(tmp);
+        fm_config_emit_changed(fm_config, "wallpaper");
+    }
+}
+
+/* show the wallpaper of the monitor selected */
+static void on_wallpaper_monitor_changed(GtkComboBox* combo, GtkBuilder* builder)
+{
+    GtkWidget* item;
+    const char* file;
+    FmWallpaperMode mode;
+
+    /* the first one is for all monitors */
+    wallpaper_monitor = gtk_combo_box_get_active(combo) - 1;
+    g_free(wallpaper_monitor_name);
+    wallpaper_monitor_name = wallpaper_monitor >= 0
+        ? gdk_screen_get_monitor_plug_name(gtk_widget_get_screen((GtkWidget*)combo), wallpaper_monitor)
+        : NULL;
+    fm_app_config_get_monitor_wallpaper(app_config, wallpaper_monitor, wallpaper_monitor_name, &file, &mode);
+    item = (GtkWidget*)gtk_builder_get_object(builder, "wallpaper");
+    if(file && *file)
+        gtk_file_chooser_set_filename(GTK_FILE_CHOOSER(item), file);
+    else
+        gtk_file_chooser_unselect_all(GTK_FILE_CHOOSER(item));
+    item = (GtkWidget*)gtk_builder_get_object(builder, "wallpaper_mode");
+    gtk_combo_box_set_active(GTK_COMBO_BOX(item), mode);
+}
+
+static void init_wallpaper_monitor(GtkBuilder* builder)
+{
+    GtkComboBox* combo = (GtkComboBox*)gtk_builder_get_object(builder, "wallpaper_monitor");
+    GtkListStore* store = GTK_LIST_STORE(gtk_combo_box_get_model(combo));
+    GdkScreen* screen = gtk_widget_get_screen(desktop_pref_dlg);
+    int i, n = gdk_screen_get_n_monitors(screen);
+    GtkTreeIter it;
+
+    gtk_list_store_insert_with_values(store, &it, -1, 0, _("All monitors"), -1);
+    for(i = 0; i < n; ++i)
+    {
+        GdkRectangle geometry;
+        char* name = gdk_screen_get_monitor_plug_name(screen, i);
+        char* title;
+        gdk_screen_get_monitor_geometry(screen, i, &geometry);
+        if(name)
+            title = g_strdup_printf(_("Monitor %d: %s (%dx%d)"), i + 1, name, geometry.width, geometry.height);
+        else
+            title = g_strdup_printf(_("Monitor %d (%dx%d)"), i + 1, geometry.width, geometry.height);
+        gtk_list_store_insert_with_values(store, &it, -1, 0, title, -1);
+        g_free(title);
+        g_free(name);
+    }
+    wallpaper_monitor = -1;
+    g_free(wallpaper_monitor_name);
+    wallpaper_monitor_name = NULL;
+    gtk_combo_box_set_active(combo, 0);
+    gtk_widget_set_sensitive((GtkWidget*)combo, n > 1);
+    /* the builder is kept for the handler while the dialog exists */
+    g_signal_connect_data(combo, "changed", G_CALLBACK(on_wallpaper_monitor_changed),
+                          g_object_ref(builder), (GClosureNotify)g_object_unref, 0);
+}
+
 static void on_update_img_preview( GtkFileChooser *chooser, GtkImage* img )
 {
     char* file = gtk_file_chooser_get_preview_filename( chooser );
     GdkPixbuf* pix = NULL;
     if( file )
     {
-        pix = gdk_pixbuf_new_from_file_at_scale( file, 128, 128, TRUE, NULL );
+        pix = fm_wallpaper_load_preview( file, 128, 128 );
         g_free( file );
     }
     if( pix )
@@ -345,6 +423,13 @@ static void on_update_img_preview( GtkFileChooser *chooser, GtkImage* img )
     }
 }
 
+static void on_slideshow_dir_set(GtkFileChooserButton* btn, gpointer user_data)
+{
+    g_free(app_config->slideshow_dir);
+    app_config->slideshow_dir = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(btn));
+    fm_config_emit_changed(fm_config, "slideshow");
+}
+
 static void on_desktop_font_set(GtkFontButton* btn, gpointer user_data)
 {
     const char* font = gtk_font_button_get_font_name(btn);
@@ -375,13 +460,24 @@ void fm_desktop_preference()
         if(app_config->wallpaper)
             gtk_file_chooser_set_filename(GTK_FILE_CHOOSER(item), app_config->wallpaper);
 
-        INIT_COMBO(builder, FmAppConfig, wallpaper_mode, "wallpaper");
+        item = gtk_builder_get_object(builder, "wallpaper_mode");
+        gtk_combo_box_set_active(GTK_COMBO_BOX(item), app_config->wallpaper_mode);
+        g_signal_connect(item, "changed", G_CALLBACK(on_wallpaper_mode_changed), NULL);
+        init_wallpaper_monitor(builder);
         INIT_COLOR(builder, FmAppConfig, desktop_bg, "wallpaper");
 
+        INIT_BOOL(builder, FmAppConfig, slideshow, "slideshow");
+        INIT_SPIN(builder, FmAppConfig, slideshow_interval, "slideshow");
+        item = gtk_builder_get_object(builder, "slideshow_dir");
+        if(app_config->slideshow_dir)
+            gtk_file_chooser_set_filename(GTK_FILE_CHOOSER(item), app_config->slideshow_dir);
+        g_signal_connect(item, "file-set", G_CALLBACK(on_slideshow_dir_set), NULL);
+
         INIT_COLOR(builder, FmAppConfig, desktop_fg, "desktop_text");
         INIT_COLOR(builder, FmAppConfig, desktop_shadow, "desktop_text");
 
         INIT_BOOL(builder, FmAppConfig, show_wm_menu, NULL);
+        INIT_COMBO(builder, FmAppConfig, desktop_stacks, "desktop_stacks");
 
         item = gtk_builder_get_object(builder, "desktop_font");
         if(app_config->desktop_font)
@@ -0,0 +1,267 @@
+/*
+ *      resample-bench.c
+ *
+ *      Copyright 2010 Hong Jen Yee (PCMan) <pcman.tw@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+/* Benchmark of fm_resample(), compared with the bilinear filter of
+ * gdk-pixbuf used for the wallpapers before.
+ *
+ * The source image is a zone plate, a pattern of rings getting finer from
+ * the center to the corners. After scaling, the rings finer than the
+ * pixels of the result should become flat gray, and anything else there
+ * is aliasing. The coarse rings near the center should be kept as they
+ * are. So two numbers are printed for the quality:
+ *   passband: PSNR of the coarse rings compared with the exact pattern,
+ *             higher is sharper
+ *   aliasing: RMS error where the result should be flat gray, lower is
+ *             better
+ *
+ *   ./resample-bench --src=7680x4320 --dest=1920x1080 */
+
+#include "resample.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+typedef struct _Method Method;
+struct _Method
+{
+    const char* name;
+    FmResampleFilter filter;
+    FmResampleImpl impl;
+    gboolean bilinear; /* gdk_pixbuf_scale_simple() instead */
+};
+
+static const Method methods[] =
+{
+    { "gdk bilinear", 0, 0, TRUE },
+    { "box scalar", FM_RESAMPLE_BOX, FM_RESAMPLE_SCALAR, FALSE },
+    { "box sse2", FM_RESAMPLE_BOX, FM_RESAMPLE_SSE2, FALSE },
+    { "box avx2", FM_RESAMPLE_BOX, FM_RESAMPLE_AVX2, FALSE },
+    { "lanczos scalar", FM_RESAMPLE_LANCZOS, FM_RESAMPLE_SCALAR, FALSE },
+    { "lanczos sse2", FM_RESAMPLE_LANCZOS, FM_RESAMPLE_SSE2, FALSE },
+    { "lanczos avx2", FM_RESAMPLE_LANCZOS, FM_RESAMPLE_AVX2, FALSE }
+};
+
+static char* src_arg = NULL;
+static char* dest_arg = NULL;
+static int n_rounds = 10;
+static char* dump_dir = NULL;
+
+static GOptionEntry opt_entries[] =
+{
+    { "src", 0, 0, G_OPTION_ARG_STRING, &src_arg, "Size of the source image (default: 7680x4320)", "WxH" },
+    { "dest", 0, 0, G_OPTION_ARG_STRING, &dest_arg, "Size of the result (default: 1920x1080)", "WxH" },
+    { "rounds", 0, 0, G_OPTION_ARG_INT, &n_rounds, "Number of times each method is run (default: 10)", "N" },
+    { "dump", 0, 0, G_OPTION_ARG_FILENAME, &dump_dir, "Save the result of each method as PNG in DIR", "DIR" },
+    { NULL }
+};
+
+/* the rings reach 0.45 cycles per pixel in the corners of the source */
+#define MAX_FREQ    0.45
+
+static gboolean parse_size(const char* str, int* w, int* h)
+{
+    return str == NULL || (sscanf(str, "%dx%d", w, h) == 2 && *w > 0 && *h > 0);
+}
+
+/* the phase of the pattern at the distance r from the center is k * r^2,
+ * so the frequency there is k * r / pi cycles per pixel. */
+static double get_k(int w, int h)
+{
+    return G_PI * MAX_FREQ / hypot(w / 2.0, h / 2.0);
+}
+
+static GdkPixbuf* create_zone_plate(int w, int h)
+{
+    GdkPixbuf* pix = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, w, h);
+    guchar* pixels = gdk_pixbuf_get_pixels(pix);
+    int rowstride = gdk_pixbuf_get_rowstride(pix);
+    double k = get_k(w, h);
+    int x, y;
+
+    for(y = 0; y < h; ++y)
+    {
+        guchar* p = pixels + (gsize)y * rowstride;
+        double dy = y + 0.5 - h / 2.0;
+        for(x = 0; x < w; ++x, p += 3)
+        {
+            double dx = x + 0.5 - w / 2.0;
+            p[0] = p[1] = p[2] = (guchar)(127.5 + 127.5 * cos(k * (dx * dx + dy * dy)));
+        }
+    }
+    return pix;
+}
+
+static void measure_quality(GdkPixbuf* pix, int src_w, int src_h, double* psnr, double* alias_rms)
+{
+    int w = gdk_pixbuf_get_width(pix), h = gdk_pixbuf_get_height(pix);
+    int rowstride = gdk_pixbuf_get_rowstride(pix);
+    int n_channels = gdk_pixbuf_get_n_channels(pix);
+    const guchar* pixels = gdk_pixbuf_get_pixels(pix);
+    double sx = (double)src_w / w, sy = (double)src_h / h;
+    /* the frequency the result can show, in cycles per source pixel */
+    double nyquist = 0.5 / MAX(MAX(sx, sy), 1.0);
+    double k = get_k(src_w, src_h);
+    double pass_err = 0.0, stop_err = 0.0;
+    long n_pass = 0, n_stop = 0;
+    int x, y;
+
+    for(y = 0; y < h; ++y)
+    {
+        const guchar* p = pixels + (gsize)y * rowstride;
+        double dy = (y + 0.5) * sy - src_h / 2.0;
+        for(x = 0; x < w; ++x, p += n_channels)
+        {
+            double dx = (x + 0.5) * sx - src_w / 2.0;
+            double r2 = dx * dx + dy * dy;
+            double freq = k * sqrt(r2) / G_PI;
+            double d;
+            if(freq < nyquist * 0.5)
+            {
+                d = p[0] - (127.5 + 127.5 * cos(k * r2));
+                pass_err += d * d;
+                ++n_pass;
+            }
+            else if(freq > nyquist * 1.25)
+            {
+                d = p[0] - 127.5;
+                stop_err += d * d;
+                ++n_stop;
+            }
+        }
+    }
+    *psnr = n_pass && pass_err > 0.0 ? 10.0 * log10(255.0 * 255.0 / (pass_err / n_pass)) : 99.0;
+    *alias_rms = n_stop ? sqrt(stop_err / n_stop) : 0.0;
+}
+
+static GdkPixbuf* run_method(const Method* method, GdkPixbuf* src, int dest_w, int dest_h)
+{
+    if(method->bilinear)
+        return gdk_pixbuf_scale_simple(src, dest_w, dest_h, GDK_INTERP_BILINEAR);
+    return fm_resample(src, dest_w, dest_h, method->filter);
+}
+
+static int compare_doubles(gconstpointer a, gconstpointer b)
+{
+    gdouble x = *(const gdouble*)a, y = *(const gdouble*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void dump_result(GdkPixbuf* pix, const char* name, int n_threads)
+{
+    char* base = g_strdup_printf("%s-%d.png", name, n_threads);
+    char* file;
+    GError* err = NULL;
+    g_strdelimit(base, " ", '-');
+    file = g_build_filename(dump_dir, base, NULL);
+    if(!gdk_pixbuf_save(pix, file, "png", &err, NULL))
+    {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+    }
+    g_free(file);
+    g_free(base);
+}
+
+int main(int argc, char** argv)
+{
+    GOptionContext* ctx;
+    GError* err = NULL;
+    GdkPixbuf* src;
+    gdouble* samples;
+    int src_w = 7680, src_h = 4320, dest_w = 1920, dest_h = 1080;
+    int n_cpus = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    guint i;
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    if(!g_thread_supported())
+        g_thread_init(NULL);
+#endif
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+    g_type_init();
+#endif
+    ctx = g_option_context_new("- benchmark of the wallpaper scaling");
+    g_option_context_add_main_entries(ctx, opt_entries, NULL);
+    if(!g_option_context_parse(ctx, &argc, &argv, &err))
+    {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        return 1;
+    }
+    g_option_context_free(ctx);
+    if(!parse_size(src_arg, &src_w, &src_h) || !parse_size(dest_arg, &dest_w, &dest_h))
+    {
+        g_printerr("invalid size, it should be like 1920x1080\n");
+        return 1;
+    }
+    if(n_rounds < 1)
+        n_rounds = 1;
+    if(dump_dir)
+        g_mkdir_with_parents(dump_dir, 0755);
+
+    src = create_zone_plate(src_w, src_h);
+    samples = g_new(gdouble, n_rounds);
+    g_print("%dx%d -> %dx%d, %d CPUs\n", src_w, src_h, dest_w, dest_h, n_cpus);
+    g_print("method           threads          p50  passband  aliasing\n");
+    for(i = 0; i < G_N_ELEMENTS(methods); ++i)
+    {
+        const Method* method = &methods[i];
+        int n_threads;
+        if(!method->bilinear && !fm_resample_set_impl(method->impl))
+        {
+            g_print("%-16s  not supported\n", method->name);
+            continue;
+        }
+        /* gdk-pixbuf only uses one thread */
+        for(n_threads = 1; n_threads <= n_cpus; n_threads = method->bilinear ? n_cpus + 1 : n_threads * 2)
+        {
+            GdkPixbuf* result = NULL;
+            double psnr, alias_rms;
+            int round;
+            fm_resample_set_max_threads(n_threads);
+            for(round = 0; round < n_rounds; ++round)
+            {
+                GTimer* timer = g_timer_new();
+                if(result)
+                    g_object_unref(result);
+                result = run_method(method, src, dest_w, dest_h);
+                samples[round] = g_timer_elapsed(timer, NULL);
+                g_timer_destroy(timer);
+            }
+            qsort(samples, n_rounds, sizeof(gdouble), compare_doubles);
+            measure_quality(result, src_w, src_h, &psnr, &alias_rms);
+            g_print("%-16s %7d %9.2f ms %6.2f dB %9.2f\n", method->name, n_threads,
+                    samples[(n_rounds - 1) / 2] * 1e3, psnr, alias_rms);
+            if(dump_dir)
+                dump_result(result, method->name, n_threads);
+            g_object_unref(result);
+        }
+    }
+    fm_resample_set_impl(FM_RESAMPLE_AUTO);
+    fm_resample_set_max_threads(0);
+
+    g_free(samples);
+    g_object_unref(src);
+    return 0;
+}
@@ -0,0 +1,634 @@
+/*
+ *      resample.c
+ *
+ *      Copyright 2010 Hong Jen Yee (PCMan) <pcman.tw@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include "resample.h"
+
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+/*
+ * The image is scaled in two passes like the resampler of Pillow: each
+ * row is first scaled horizontally, and then the rows are combined into
+ * the rows of the result. The filter is stretched when the image is made
+ * smaller, so every source pixel contributes to the result.
+ *
+ * The weights are 16 bit integers with PRECISION_BITS fractional bits,
+ * and the pixels are handled as 4 bytes, so one pixel fits in the lanes
+ * of a SIMD register. Pixels with alpha are premultiplied while they are
+ * scaled, so the color of transparent pixels doesn't bleed into their
+ * neighbors.
+ *
+ * The rows of the result are split into bands run by several threads.
+ * Each thread does the horizontal pass of the source rows its band needs,
+ * a few rows at the edges of the bands are scaled twice.
+ */
+
+#define PRECISION_BITS  14
+#define ROUNDING        (1 << (PRECISION_BITS - 1))
+
+/* the weights of each output pixel are padded with zeros to a multiple
+ * of this, so the SIMD code can use several taps at once. */
+#define TAPS_ALIGN      8
+
+/* output rows scaled at once by a thread, it bounds the memory used
+ * for the result of the horizontal pass. */
+#define CHUNK_ROWS      64
+
+#define MAX_THREADS     8
+
+#if (defined(__x86_64__) || defined(__i386__)) \
+    && (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+/* the SIMD functions are compiled for their instruction set only, and
+ * called after checking the CPU at runtime. */
+#define HAVE_X86_SIMD   1
+#include <immintrin.h>
+#endif
+
+typedef struct _Coeffs Coeffs;
+struct _Coeffs
+{
+    int n_taps; /* weights of each output pixel, a multiple of TAPS_ALIGN */
+    int* bounds; /* first input pixel of each output pixel */
+    int* counts; /* number of input pixels of each output pixel */
+    gint16* weights;
+};
+
+/* scale one row of 4 byte pixels, in is padded with n_taps zero pixels */
+typedef void (*HorizFunc)(guint8* out, int out_w, const guint8* in, const Coeffs* c);
+/* combine n rows of len bytes which are stride bytes apart with weights k */
+typedef void (*VertFunc)(guint8* out, int len, const guint8* in, int stride,
+                         const gint16* k, int n);
+
+typedef struct _Impl Impl;
+struct _Impl
+{
+    const char* name;
+    HorizFunc horiz;
+    VertFunc vert;
+};
+
+static inline guint8 clip8(int v)
+{
+    v >>= PRECISION_BITS;
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static double box_filter(double x)
+{
+    return (x > -0.5 && x <= 0.5) ? 1.0 : 0.0;
+}
+
+static inline double sinc(double x)
+{
+    if(x == 0.0)
+        return 1.0;
+    x *= G_PI;
+    return sin(x) / x;
+}
+
+static double lanczos_filter(double x)
+{
+    return (x > -3.0 && x < 3.0) ? sinc(x) * sinc(x / 3.0) : 0.0;
+}
+
+static void init_coeffs(Coeffs* c, int in_size, int out_size, FmResampleFilter filter)
+{
+    double (*func)(double) = (filter == FM_RESAMPLE_BOX) ? box_filter : lanczos_filter;
+    double support = (filter == FM_RESAMPLE_BOX) ? 0.5 : 3.0;
+    double scale = (double)in_size / out_size;
+    double filter_scale = MAX(scale, 1.0);
+    double* k;
+    int ksize, i, x;
+
+    support *= filter_scale;
+    ksize = (int)ceil(support) * 2 + 1;
+    if(in_size == out_size) /* only copy the pixels */
+        ksize = 1;
+    c->n_taps = (ksize + TAPS_ALIGN - 1) & ~(TAPS_ALIGN - 1);
+    c->bounds = g_new(int, out_size);
+    c->counts = g_new(int, out_size);
+    c->weights = g_new0(gint16, (gsize)out_size * c->n_taps);
+    k = g_new(double, ksize);
+
+    for(i = 0; i < out_size; ++i)
+    {
+        gint16* w = c->weights + (gsize)i * c->n_taps;
+        double center = (i + 0.5) * scale, sum = 0.0;
+        int x_min, x_max, total = 0, max_x = 0;
+
+        if(in_size == out_size)
+        {
+            c->bounds[i] = i;
+            c->counts[i] = 1;
+            w[0] = 1 << PRECISION_BITS;
+            continue;
+        }
+        x_min = MAX((int)floor(center - support + 0.5), 0);
+        x_max = MIN((int)floor(center + support + 0.5), in_size);
+        x_max = MIN(x_max, x_min + ksize);
+        for(x = x_min; x < x_max; ++x)
+        {
+            k[x - x_min] = func((x - center + 0.5) / filter_scale);
+            sum += k[x - x_min];
+        }
+        if(sum == 0.0) /* can't happen, but use the nearest pixel then */
+        {
+            x_min = MIN((int)center, in_size - 1);
+            x_max = x_min + 1;
+            k[0] = sum = 1.0;
+        }
+        for(x = 0; x < x_max - x_min; ++x)
+        {
+            w[x] = (gint16)floor(k[x] / sum * (1 << PRECISION_BITS) + 0.5);
+            total += w[x];
+            if(w[x] > w[max_x])
+                max_x = x;
+        }
+        /* the weights should add up to exactly 1.0, or flat areas change */
+        w[max_x] += (1 << PRECISION_BITS) - total;
+        c->bounds[i] = x_min;
+        c->counts[i] = x_max - x_min;
+    }
+    g_free(k);
+}
+
+static void free_coeffs(Coeffs* c)
+{
+    g_free(c->bounds);
+    g_free(c->counts);
+    g_free(c->weights);
+}
+
+static void horiz_scalar(guint8* out, int out_w, const guint8* in, const Coeffs* c)
+{
+    int i, x;
+    for(i = 0; i < out_w; ++i, out += 4)
+    {
+        const guint8* p = in + c->bounds[i] * 4;
+        const gint16* k = c->weights + (gsize)i * c->n_taps;
+        int r = ROUNDING, g = ROUNDING, b = ROUNDING, a = ROUNDING;
+        for(x = 0; x < c->counts[i]; ++x, p += 4)
+        {
+            r += p[0] * k[x];
+            g += p[1] * k[x];
+            b += p[2] * k[x];
+            a += p[3] * k[x];
+        }
+        out[0] = clip8(r);
+        out[1] = clip8(g);
+        out[2] = clip8(b);
+        out[3] = clip8(a);
+    }
+}
+
+static void vert_scalar(guint8* out, int len, const guint8* in, int stride,
+                        const gint16* k, int n)
+{
+    int i, y;
+    for(i = 0; i < len; ++i)
+    {
+        const guint8* p = in + i;
+        int v = ROUNDING;
+        for(y = 0; y < n; ++y, p += stride)
+            v += *p * k[y];
+        out[i] = clip8(v);
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+/* two weights in the 16 bit halves of a 32 bit lane, for _mm_madd_epi16() */
+static inline int pair_weights(const gint16* k, int y, int n)
+{
+    return (guint16)k[y] | ((y + 1 < n ? (int)(guint16)k[y + 1] : 0) << 16);
+}
+
+__attribute__((target("sse2")))
+static void horiz_sse2(guint8* out, int out_w, const guint8* in, const Coeffs* c)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i, x;
+    for(i = 0; i < out_w; ++i, out += 4)
+    {
+        const guint8* p = in + c->bounds[i] * 4;
+        const gint16* k = c->weights + (gsize)i * c->n_taps;
+        int n = (c->counts[i] + 3) & ~3; /* the padding weights are 0 */
+        __m128i sum = _mm_set1_epi32(ROUNDING);
+        for(x = 0; x < n; x += 4, p += 16)
+        {
+            /* 4 pixels, and the weights for 2 pixels in each 32 bit lane */
+            __m128i pix = _mm_loadu_si128((const __m128i*)p);
+            __m128i kk = _mm_loadl_epi64((const __m128i*)(k + x));
+            __m128i lo = _mm_unpacklo_epi8(pix, zero);
+            __m128i hi = _mm_unpackhi_epi8(pix, zero);
+            /* r0 r1 g0 g1 b0 b1 a0 a1, so madd gives r g b a of 2 pixels */
+            lo = _mm_unpacklo_epi16(lo, _mm_srli_si128(lo, 8));
+            hi = _mm_unpacklo_epi16(hi, _mm_srli_si128(hi, 8));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(lo, _mm_shuffle_epi32(kk, 0x00)));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(hi, _mm_shuffle_epi32(kk, 0x55)));
+        }
+        sum = _mm_srai_epi32(sum, PRECISION_BITS);
+        sum = _mm_packs_epi32(sum, sum);
+        sum = _mm_packus_epi16(sum, sum);
+        *(guint32*)out = (guint32)_mm_cvtsi128_si32(sum);
+    }
+}
+
+/* weights y and y + 1 applied to the bytes of rows a and b, added to
+ * the sums of 16 bytes */
+#define VERT_MADD_SSE2(a, b, w) \
+    { \
+        __m128i a_lo = _mm_unpacklo_epi8(a, zero), a_hi = _mm_unpackhi_epi8(a, zero); \
+        __m128i b_lo = _mm_unpacklo_epi8(b, zero), b_hi = _mm_unpackhi_epi8(b, zero); \
+        s0 = _mm_add_epi32(s0, _mm_madd_epi16(_mm_unpacklo_epi16(a_lo, b_lo), w)); \
+        s1 = _mm_add_epi32(s1, _mm_madd_epi16(_mm_unpackhi_epi16(a_lo, b_lo), w)); \
+        s2 = _mm_add_epi32(s2, _mm_madd_epi16(_mm_unpacklo_epi16(a_hi, b_hi), w)); \
+        s3 = _mm_add_epi32(s3, _mm_madd_epi16(_mm_unpackhi_epi16(a_hi, b_hi), w)); \
+    }
+
+__attribute__((target("sse2")))
+static void vert_sse2(guint8* out, int len, const guint8* in, int stride,
+                      const gint16* k, int n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0, y;
+    for(; i + 16 <= len; i += 16)
+    {
+        __m128i s0 = _mm_set1_epi32(ROUNDING), s1 = s0, s2 = s0, s3 = s0;
+        const guint8* p = in + i;
+        for(y = 0; y < n; y += 2, p += 2 * stride)
+        {
+            __m128i w = _mm_set1_epi32(pair_weights(k, y, n));
+            __m128i a = _mm_loadu_si128((const __m128i*)p);
+            __m128i b = (y + 1 < n) ? _mm_loadu_si128((const __m128i*)(p + stride)) : zero;
+            VERT_MADD_SSE2(a, b, w);
+        }
+        s0 = _mm_packs_epi32(_mm_srai_epi32(s0, PRECISION_BITS), _mm_srai_epi32(s1, PRECISION_BITS));
+        s2 = _mm_packs_epi32(_mm_srai_epi32(s2, PRECISION_BITS), _mm_srai_epi32(s3, PRECISION_BITS));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(s0, s2));
+    }
+    if(i < len)
+        vert_scalar(out + i, len - i, in + i, stride, k, n);
+}
+
+__attribute__((target("avx2")))
+static void horiz_avx2(guint8* out, int out_w, const guint8* in, const Coeffs* c)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    /* the weights of pixels 0, 1 and 4, 5 in the lanes, then 2, 3 and 6, 7 */
+    const __m256i idx_lo = _mm256_setr_epi32(0, 0, 0, 0, 2, 2, 2, 2);
+    const __m256i idx_hi = _mm256_setr_epi32(1, 1, 1, 1, 3, 3, 3, 3);
+    int i, x;
+    for(i = 0; i < out_w; ++i, out += 4)
+    {
+        const guint8* p = in + c->bounds[i] * 4;
+        const gint16* k = c->weights + (gsize)i * c->n_taps;
+        int n = (c->counts[i] + 7) & ~7;
+        __m256i sum = _mm256_setzero_si256();
+        __m128i s;
+        for(x = 0; x < n; x += 8, p += 32)
+        {
+            /* the same as horiz_sse2(), with pixels 4 to 7 in the upper lane */
+            __m256i pix = _mm256_loadu_si256((const __m256i*)p);
+            __m256i kk = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(k + x)));
+            __m256i lo = _mm256_unpacklo_epi8(pix, zero);
+            __m256i hi = _mm256_unpackhi_epi8(pix, zero);
+            lo = _mm256_unpacklo_epi16(lo, _mm256_srli_si256(lo, 8));
+            hi = _mm256_unpacklo_epi16(hi, _mm256_srli_si256(hi, 8));
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(lo, _mm256_permutevar8x32_epi32(kk, idx_lo)));
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(hi, _mm256_permutevar8x32_epi32(kk, idx_hi)));
+        }
+        s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        s = _mm_srai_epi32(_mm_add_epi32(s, _mm_set1_epi32(ROUNDING)), PRECISION_BITS);
+        s = _mm_packs_epi32(s, s);
+        s = _mm_packus_epi16(s, s);
+        *(guint32*)out = (guint32)_mm_cvtsi128_si32(s);
+    }
+}
+
+__attribute__((target("avx2")))
+static void vert_avx2(guint8* out, int len, const guint8* in, int stride,
+                      const gint16* k, int n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    int i = 0, y;
+    for(; i + 32 <= len; i += 32)
+    {
+        /* the unpacks and the packs work within 128 bit lanes, so the
+         * bytes come back in the same order. */
+        __m256i s0 = _mm256_set1_epi32(ROUNDING), s1 = s0, s2 = s0, s3 = s0;
+        const guint8* p = in + i;
+        for(y = 0; y < n; y += 2, p += 2 * stride)
+        {
+            __m256i w = _mm256_set1_epi32(pair_weights(k, y, n));
+            __m256i a = _mm256_loadu_si256((const __m256i*)p);
+            __m256i b = (y + 1 < n) ? _mm256_loadu_si256((const __m256i*)(p + stride)) : zero;
+            __m256i a_lo = _mm256_unpacklo_epi8(a, zero), a_hi = _mm256_unpackhi_epi8(a, zero);
+            __m256i b_lo = _mm256_unpacklo_epi8(b, zero), b_hi = _mm256_unpackhi_epi8(b, zero);
+            s0 = _mm256_add_epi32(s0, _mm256_madd_epi16(_mm256_unpacklo_epi16(a_lo, b_lo), w));
+            s1 = _mm256_add_epi32(s1, _mm256_madd_epi16(_mm256_unpackhi_epi16(a_lo, b_lo), w));
+            s2 = _mm256_add_epi32(s2, _mm256_madd_epi16(_mm256_unpacklo_epi16(a_hi, b_hi), w));
+            s3 = _mm256_add_epi32(s3, _mm256_madd_epi16(_mm256_unpackhi_epi16(a_hi, b_hi), w));
+        }
+        s0 = _mm256_packs_epi32(_mm256_srai_epi32(s0, PRECISION_BITS), _mm256_srai_epi32(s1, PRECISION_BITS));
+        s2 = _mm256_packs_epi32(_mm256_srai_epi32(s2, PRECISION_BITS), _mm256_srai_epi32(s3, PRECISION_BITS));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_packus_epi16(s0, s2));
+    }
+    if(i < len)
+        vert_sse2(out + i, len - i, in + i, stride, k, n);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+static const Impl impls[] =
+{
+    { "scalar", horiz_scalar, vert_scalar },
+#ifdef HAVE_X86_SIMD
+    { "sse2", horiz_sse2, vert_sse2 },
+    { "avx2", horiz_avx2, vert_avx2 },
+#endif
+};
+
+static const Impl* impl = NULL;
+static int max_threads = 0;
+
+static gboolean is_supported(FmResampleImpl id)
+{
+    switch(id)
+    {
+    case FM_RESAMPLE_SCALAR:
+        return TRUE;
+#ifdef HAVE_X86_SIMD
+    case FM_RESAMPLE_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case FM_RESAMPLE_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return FALSE;
+    }
+}
+
+static void init_impl()
+{
+    static gsize inited = 0;
+    if(g_once_init_enter(&inited))
+    {
+        FmResampleImpl id = FM_RESAMPLE_AVX2;
+#ifdef HAVE_X86_SIMD
+        __builtin_cpu_init();
+#endif
+        while(!is_supported(id))
+            --id;
+        impl = &impls[id - FM_RESAMPLE_SCALAR];
+        g_once_init_leave(&inited, 1);
+    }
+}
+
+gboolean fm_resample_set_impl(FmResampleImpl id)
+{
+    init_impl();
+    if(id == FM_RESAMPLE_AUTO)
+        id = FM_RESAMPLE_AVX2;
+    else if(!is_supported(id))
+        return FALSE;
+    while(!is_supported(id))
+        --id;
+    impl = &impls[id - FM_RESAMPLE_SCALAR];
+    return TRUE;
+}
+
+void fm_resample_set_max_threads(int n)
+{
+    max_threads = MAX(n, 0);
+}
+
+/* copy a row of RGB or RGBA pixels to 4 byte pixels, premultiplied */
+static void load_row(guint8* out, const guint8* in, int w, gboolean has_alpha)
+{
+    int x;
+    if(has_alpha)
+    {
+        for(x = 0; x < w; ++x, in += 4, out += 4)
+        {
+            guint a = in[3], t;
+            t = in[0] * a + 128;
+            out[0] = (t + (t >> 8)) >> 8;
+            t = in[1] * a + 128;
+            out[1] = (t + (t >> 8)) >> 8;
+            t = in[2] * a + 128;
+            out[2] = (t + (t >> 8)) >> 8;
+            out[3] = a;
+        }
+    }
+    else
+    {
+        for(x = 0; x < w; ++x, in += 3, out += 4)
+        {
+            out[0] = in[0];
+            out[1] = in[1];
+            out[2] = in[2];
+            out[3] = 255;
+        }
+    }
+}
+
+static void store_row(guint8* out, const guint8* in, int w, gboolean has_alpha)
+{
+    int x;
+    if(has_alpha)
+    {
+        for(x = 0; x < w; ++x, in += 4, out += 4)
+        {
+            guint a = in[3];
+            if(a == 0)
+                out[0] = out[1] = out[2] = 0;
+            else
+            {
+                out[0] = MIN((in[0] * 255 + a / 2) / a, 255);
+                out[1] = MIN((in[1] * 255 + a / 2) / a, 255);
+                out[2] = MIN((in[2] * 255 + a / 2) / a, 255);
+            }
+            out[3] = a;
+        }
+    }
+    else
+    {
+        for(x = 0; x < w; ++x, in += 4, out += 3)
+        {
+            out[0] = in[0];
+            out[1] = in[1];
+            out[2] = in[2];
+        }
+    }
+}
+
+typedef struct _Band Band;
+struct _Band
+{
+    GdkPixbuf* src;
+    GdkPixbuf* dest;
+    const Coeffs* horiz;
+    const Coeffs* vert;
+    const Impl* impl;
+    int y0, y1; /* output rows of this band */
+};
+
+/* get the source rows needed by output rows y0 to y1 - 1 */
+static inline void get_input_rows(const Coeffs* vert, int y0, int y1, int* in_y0, int* in_y1)
+{
+    int y;
+    *in_y0 = vert->bounds[y0];
+    *in_y1 = 0;
+    for(y = y0; y < y1; ++y)
+        *in_y1 = MAX(*in_y1, vert->bounds[y] + vert->counts[y]);
+}
+
+static gpointer resample_band(Band* band)
+{
+    const Coeffs* horiz = band->horiz, *vert = band->vert;
+    int src_w = gdk_pixbuf_get_width(band->src);
+    int src_stride = gdk_pixbuf_get_rowstride(band->src);
+    const guint8* src_pixels = gdk_pixbuf_get_pixels(band->src);
+    int dest_w = gdk_pixbuf_get_width(band->dest);
+    int dest_stride = gdk_pixbuf_get_rowstride(band->dest);
+    guint8* dest_pixels = gdk_pixbuf_get_pixels(band->dest);
+    gboolean has_alpha = gdk_pixbuf_get_has_alpha(band->src);
+    int row_len = dest_w * 4;
+    int y, y0, in_y0, in_y1, max_rows = 0;
+    int tmp_y0 = 0, tmp_y1 = 0; /* source rows already in tmp */
+    guint8 *in_row, *tmp, *out_row;
+
+    for(y0 = band->y0; y0 < band->y1; y0 += CHUNK_ROWS)
+    {
+        get_input_rows(vert, y0, MIN(y0 + CHUNK_ROWS, band->y1), &in_y0, &in_y1);
+        max_rows = MAX(max_rows, in_y1 - in_y0);
+    }
+    /* zero padding after the row, read by the taps with zero weights */
+    in_row = g_malloc0((gsize)(src_w + horiz->n_taps) * 4);
+    tmp = g_malloc((gsize)max_rows * row_len);
+    out_row = g_malloc(row_len);
+
+    for(y0 = band->y0; y0 < band->y1; y0 += CHUNK_ROWS)
+    {
+        int y1 = MIN(y0 + CHUNK_ROWS, band->y1);
+        get_input_rows(vert, y0, y1, &in_y0, &in_y1);
+        /* keep the rows shared with the previous chunk */
+        if(in_y0 >= tmp_y0 && in_y0 < tmp_y1)
+        {
+            memmove(tmp, tmp + (gsize)(in_y0 - tmp_y0) * row_len,
+                    (gsize)(tmp_y1 - in_y0) * row_len);
+            tmp_y0 = in_y0;
+        }
+        else
+            tmp_y0 = tmp_y1 = in_y0;
+        for(y = tmp_y1; y < in_y1; ++y)
+        {
+            load_row(in_row, src_pixels + (gsize)y * src_stride, src_w, has_alpha);
+            band->impl->horiz(tmp + (gsize)(y - tmp_y0) * row_len, dest_w, in_row, horiz);
+        }
+        tmp_y1 = MAX(tmp_y1, in_y1);
+
+        for(y = y0; y < y1; ++y)
+        {
+            band->impl->vert(out_row, row_len, tmp + (gsize)(vert->bounds[y] - tmp_y0) * row_len,
+                             row_len, vert->weights + (gsize)y * vert->n_taps, vert->counts[y]);
+            store_row(dest_pixels + (gsize)y * dest_stride, out_row, dest_w, has_alpha);
+        }
+    }
+    g_free(in_row);
+    g_free(tmp);
+    g_free(out_row);
+    return NULL;
+}
+
+static int get_n_threads(int src_w, int src_h, int dest_h)
+{
+    long n = max_threads;
+    if(n == 0)
+        n = MIN(sysconf(_SC_NPROCESSORS_ONLN), MAX_THREADS);
+    /* starting a thread is not worth it for small images */
+    if((gint64)src_w * src_h < 512 * 512)
+        return 1;
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    if(!g_thread_supported())
+        return 1;
+#endif
+    return (int)CLAMP(n, 1, MAX(dest_h / CHUNK_ROWS, 1));
+}
+
+GdkPixbuf* fm_resample(GdkPixbuf* src, int dest_w, int dest_h, FmResampleFilter filter)
+{
+    int src_w, src_h, n_threads, i;
+    GdkPixbuf* dest;
+    Coeffs horiz, vert;
+    Band* bands;
+    GThread** threads;
+
+    g_return_val_if_fail(gdk_pixbuf_get_bits_per_sample(src) == 8, NULL);
+    g_return_val_if_fail(gdk_pixbuf_get_n_channels(src) == (gdk_pixbuf_get_has_alpha(src) ? 4 : 3), NULL);
+    g_return_val_if_fail(dest_w > 0 && dest_h > 0, NULL);
+
+    dest = gdk_pixbuf_new(GDK_COLORSPACE_RGB, gdk_pixbuf_get_has_alpha(src), 8, dest_w, dest_h);
+    if(!dest)
+        return NULL;
+    init_impl();
+    src_w = gdk_pixbuf_get_width(src);
+    src_h = gdk_pixbuf_get_height(src);
+    init_coeffs(&horiz, src_w, dest_w, filter);
+    init_coeffs(&vert, src_h, dest_h, filter);
+
+    n_threads = get_n_threads(src_w, src_h, dest_h);
+    bands = g_new(Band, n_threads);
+    threads = g_new0(GThread*, n_threads);
+    for(i = 0; i < n_threads; ++i)
+    {
+        bands[i].src = src;
+        bands[i].dest = dest;
+        bands[i].horiz = &horiz;
+        bands[i].vert = &vert;
+        bands[i].impl = impl;
+        bands[i].y0 = (gint64)dest_h * i / n_threads;
+        bands[i].y1 = (gint64)dest_h * (i + 1) / n_threads;
+    }
+    /* the first band is done in this thread while the others run. if a
+     * thread cannot be created, its band is done here too. */
+    for(i = 1; i < n_threads; ++i)
+#if GLIB_CHECK_VERSION(2, 32, 0)
+        threads[i] = g_thread_try_new("resample", (GThreadFunc)resample_band, &bands[i], NULL);
+#else
+        threads[i] = g_thread_create((GThreadFunc)resample_band, &bands[i], TRUE, NULL);
+#endif
+    resample_band(&bands[0]);
+    for(i = 1; i < n_threads; ++i)
+    {
+        if(threads[i])
+            g_thread_join(threads[i]);
+        else
+            resample_band(&bands[i]);
+    }
+    g_free(threads);
+    g_free(bands);
+    free_coeffs(&horiz);
+    free_coeffs(&vert);
+    return dest;
+}
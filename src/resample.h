@@ -0,0 +1,59 @@
+/*
+ *      resample.h
+ *
+ *      Copyright 2010 Hong Jen Yee (PCMan) <pcman.tw@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __RESAMPLE_H__
+#define __RESAMPLE_H__
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+    FM_RESAMPLE_BOX, /* average of the pixels covered, soft but fast */
+    FM_RESAMPLE_LANCZOS /* Lanczos with 3 lobes, sharp and without aliasing */
+} FmResampleFilter;
+
+/* Scale src to dest_w x dest_h with a separable filter. Unlike the
+ * bilinear filter of gdk-pixbuf, all the source pixels are used when the
+ * image is made smaller, so fine details don't turn into moire patterns.
+ * Big images are split into bands of rows scaled by several threads.
+ * The result has an alpha channel if src has one. */
+GdkPixbuf* fm_resample(GdkPixbuf* src, int dest_w, int dest_h, FmResampleFilter filter);
+
+typedef enum
+{
+    FM_RESAMPLE_AUTO, /* the fastest one supported by the CPU */
+    FM_RESAMPLE_SCALAR,
+    FM_RESAMPLE_SSE2,
+    FM_RESAMPLE_AVX2
+} FmResampleImpl;
+
+/* Force an implementation, used to compare them. Returns FALSE if it's
+ * not supported by the CPU or the compiler, the current one is kept then. */
+gboolean fm_resample_set_impl(FmResampleImpl impl);
+
+/* Limit the number of threads, 0 to use one per CPU. */
+void fm_resample_set_max_threads(int n);
+
+G_END_DECLS
+
+#endif
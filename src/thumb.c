@@ -0,0 +1,505 @@
+/*
+ *      thumb.c
+ *
+ *      Copyright 2010 Hong Jen Yee (PCMan) <pcman.tw@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include "thumb.h"
+
+#include <glib/gstdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*
+ * Thumbnails are stored as described by the Thumbnail Managing Standard
+ * of freedesktop.org, so they are shared with other applications. The
+ * thumbnail of a file is a PNG image named after the MD5 of its URI, and
+ * it's only valid if the URI and the mtime in its text chunks match the
+ * file. Files no thumbnail can be made for are recorded in the "fail"
+ * folder, so they are not tried again until they are changed.
+ *
+ * The cache is read by a single worker, and the missing thumbnails are
+ * generated by a small number of other workers, so a folder full of big
+ * images doesn't take all of the CPUs, and cached thumbnails are not held
+ * up by the ones being generated.
+ */
+
+#define NORMAL_SIZE             128
+#define LARGE_SIZE              256
+#define MAX_GENERATE_THREADS    2
+
+struct _FmThumbRequest
+{
+    char* path; /* the file, in the file system encoding */
+    char* uri;
+    char* name; /* file name of the thumbnail */
+    char* command; /* command line of the thumbnailer, NULL if GdkPixbuf is used */
+    time_t mtime;
+    goffset file_size;
+    int size; /* size of the thumbnail wanted */
+    int priority;
+    guint seq; /* requests of the same priority are handled in order */
+    volatile gint cancelled;
+    GdkPixbuf* result;
+    FmThumbReadyFunc func;
+    gpointer user_data;
+};
+
+static GThreadPool* load_pool = NULL;
+static GThreadPool* generate_pool = NULL;
+static guint next_seq = 0;
+
+/* MIME type => TRUE for the types GdkPixbuf can load */
+static GHashTable* pixbuf_types = NULL;
+/* MIME type => command line of the thumbnailer */
+static GHashTable* thumbnailers = NULL;
+
+static void free_request(FmThumbRequest* req)
+{
+    if(req->result)
+        g_object_unref(req->result);
+    g_free(req->path);
+    g_free(req->uri);
+    g_free(req->name);
+    g_free(req->command);
+    g_slice_free(FmThumbRequest, req);
+}
+
+/* called in main thread when the request is done */
+static gboolean on_request_done(FmThumbRequest* req)
+{
+    if(!g_atomic_int_get(&req->cancelled))
+        req->func(req->result, req->user_data);
+    free_request(req);
+    return FALSE;
+}
+
+static inline const char* get_flavor(int size)
+{
+    return size > NORMAL_SIZE ? "large" : "normal";
+}
+
+/* the folder of the cache, and the one of older versions of the spec */
+static char* get_cache_dir(gboolean legacy)
+{
+    if(legacy)
+        return g_build_filename(g_get_home_dir(), ".thumbnails", NULL);
+    return g_build_filename(g_get_user_cache_dir(), "thumbnails", NULL);
+}
+
+/* the thumbnail at path, or NULL if it's not there or outdated */
+static GdkPixbuf* load_thumbnail_file(FmThumbRequest* req, const char* path)
+{
+    GdkPixbuf* pix = gdk_pixbuf_new_from_file(path, NULL);
+    const char* uri, *mtime;
+    if(!pix)
+        return NULL;
+    uri = gdk_pixbuf_get_option(pix, "tEXt::Thumb::URI");
+    mtime = gdk_pixbuf_get_option(pix, "tEXt::Thumb::MTime");
+    if(uri && mtime && strcmp(uri, req->uri) == 0 && strtol(mtime, NULL, 10) == (long)req->mtime)
+        return pix;
+    g_object_unref(pix);
+    return NULL;
+}
+
+static void save_thumbnail_file(FmThumbRequest* req, const char* path, GdkPixbuf* pix)
+{
+    char* dir = g_path_get_dirname(path);
+    char* tmp_path = g_strdup_printf("%s.%u.tmp", path, req->seq);
+    char mtime[32];
+
+    g_mkdir_with_parents(dir, 0700);
+    g_snprintf(mtime, sizeof(mtime), "%ld", (long)req->mtime);
+    if(gdk_pixbuf_save(pix, tmp_path, "png", NULL,
+                       "tEXt::Thumb::URI", req->uri,
+                       "tEXt::Thumb::MTime", mtime,
+                       "tEXt::Software", "PCManFM", NULL))
+    {
+        g_chmod(tmp_path, 0600);
+        g_rename(tmp_path, path);
+    }
+    else
+        g_unlink(tmp_path);
+    g_free(tmp_path);
+    g_free(dir);
+}
+
+/* scale the thumbnail down to fit in size x size */
+static GdkPixbuf* scale_thumbnail(GdkPixbuf* pix, int size)
+{
+    int w = gdk_pixbuf_get_width(pix);
+    int h = gdk_pixbuf_get_height(pix);
+    if(w <= size && h <= size)
+        return (GdkPixbuf*)g_object_ref(pix);
+    if(w > h)
+    {
+        h = MAX(h * size / w, 1);
+        w = size;
+    }
+    else
+    {
+        w = MAX(w * size / h, 1);
+        h = size;
+    }
+    return gdk_pixbuf_scale_simple(pix, w, h, GDK_INTERP_BILINEAR);
+}
+
+static void on_size_prepared(GdkPixbufLoader* loader, int w, int h, gpointer size_ptr)
+{
+    int size = GPOINTER_TO_INT(size_ptr);
+    /* images smaller than the thumbnail are not scaled up */
+    if(w <= size && h <= size)
+        return;
+    if(w > h)
+        gdk_pixbuf_loader_set_size(loader, size, MAX((gint64)h * size / w, 1));
+    else
+        gdk_pixbuf_loader_set_size(loader, MAX((gint64)w * size / h, 1), size);
+}
+
+#define READ_BUF_SIZE   65536
+
+/* decode the image directly at the size of the thumbnail */
+static GdkPixbuf* generate_with_pixbuf(FmThumbRequest* req, int size)
+{
+    GdkPixbufLoader* loader;
+    GdkPixbuf* pix = NULL;
+    guchar* buf;
+    gsize n;
+    gboolean ok = TRUE;
+    FILE* f = fopen(req->path, "rb");
+
+    if(!f)
+        return NULL;
+    loader = gdk_pixbuf_loader_new();
+    g_signal_connect(loader, "size-prepared", G_CALLBACK(on_size_prepared), GINT_TO_POINTER(size));
+    buf = g_malloc(READ_BUF_SIZE);
+    while(ok && (n = fread(buf, 1, READ_BUF_SIZE, f)) > 0)
+    {
+        if(g_atomic_int_get(&req->cancelled))
+            ok = FALSE;
+        else
+            ok = gdk_pixbuf_loader_write(loader, buf, n, NULL);
+    }
+    g_free(buf);
+    fclose(f);
+    if(gdk_pixbuf_loader_close(loader, NULL) && ok)
+    {
+        pix = gdk_pixbuf_loader_get_pixbuf(loader);
+        /* photos are shown the way they are taken */
+        if(pix)
+            pix = gdk_pixbuf_apply_embedded_orientation(pix);
+    }
+    g_object_unref(loader);
+    return pix;
+}
+
+/* run the thumbnailer, see the thumbnailer spec of freedesktop.org */
+static GdkPixbuf* generate_with_thumbnailer(FmThumbRequest* req, int size)
+{
+    GString* cmd;
+    GdkPixbuf* pix = NULL;
+    char* out_path;
+    char** argv;
+    const char* p;
+    int fd, status;
+
+    fd = g_file_open_tmp("pcmanfm-thumb-XXXXXX.png", &out_path, NULL);
+    if(fd < 0)
+        return NULL;
+    close(fd);
+
+    cmd = g_string_sized_new(256);
+    for(p = req->command; *p; ++p)
+    {
+        char* quoted = NULL;
+        if(*p != '%' || !p[1])
+        {
+            g_string_append_c(cmd, *p);
+            continue;
+        }
+        switch(*++p)
+        {
+        case 's':
+            g_string_append_printf(cmd, "%d", size);
+            break;
+        case 'i':
+            quoted = g_shell_quote(req->path);
+            break;
+        case 'u':
+            quoted = g_shell_quote(req->uri);
+            break;
+        case 'o':
+            quoted = g_shell_quote(out_path);
+            break;
+        case '%':
+            g_string_append_c(cmd, '%');
+            break;
+        }
+        if(quoted)
+        {
+            g_string_append(cmd, quoted);
+            g_free(quoted);
+        }
+    }
+
+    if(g_shell_parse_argv(cmd->str, NULL, &argv, NULL))
+    {
+        if(g_spawn_sync(NULL, argv, NULL, G_SPAWN_SEARCH_PATH|G_SPAWN_STDOUT_TO_DEV_NULL|G_SPAWN_STDERR_TO_DEV_NULL,
+                        NULL, NULL, NULL, NULL, &status, NULL)
+           && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+            pix = gdk_pixbuf_new_from_file(out_path, NULL);
+        g_strfreev(argv);
+    }
+    g_string_free(cmd, TRUE);
+    g_unlink(out_path);
+    g_free(out_path);
+    return pix;
+}
+
+static void generate_thread(FmThumbRequest* req, gpointer user_data)
+{
+    int size = req->size > NORMAL_SIZE ? LARGE_SIZE : NORMAL_SIZE;
+    GdkPixbuf* pix = NULL;
+    char *dir, *path;
+
+    if(g_atomic_int_get(&req->cancelled))
+        goto done;
+    if(fm_config->thumbnail_max > 0 && req->file_size > (goffset)fm_config->thumbnail_max * 1024)
+        goto done;
+
+    if(req->command)
+        pix = generate_with_thumbnailer(req, size);
+    else
+        pix = generate_with_pixbuf(req, size);
+
+    dir = get_cache_dir(FALSE);
+    if(pix)
+    {
+        path = g_build_filename(dir, get_flavor(req->size), req->name, NULL);
+        save_thumbnail_file(req, path, pix);
+        req->result = scale_thumbnail(pix, req->size);
+        g_object_unref(pix);
+    }
+    else if(!g_atomic_int_get(&req->cancelled))
+    {
+        /* remember it, so it's not tried again until the file is changed */
+        pix = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, 1, 1);
+        gdk_pixbuf_fill(pix, 0);
+        path = g_build_filename(dir, "fail", "pcmanfm", req->name, NULL);
+        save_thumbnail_file(req, path, pix);
+        g_object_unref(pix);
+    }
+    else
+        path = NULL;
+    g_free(path);
+    g_free(dir);
+done:
+    g_idle_add((GSourceFunc)on_request_done, req);
+}
+
+static void load_thread(FmThumbRequest* req, gpointer user_data)
+{
+    GdkPixbuf* pix = NULL;
+    char *dir, *path;
+    int legacy;
+
+    if(!g_atomic_int_get(&req->cancelled))
+    {
+        for(legacy = 0; !pix && legacy < 2; ++legacy)
+        {
+            dir = get_cache_dir(legacy);
+            path = g_build_filename(dir, get_flavor(req->size), req->name, NULL);
+            pix = load_thumbnail_file(req, path);
+            g_free(path);
+            g_free(dir);
+        }
+        if(pix)
+        {
+            req->result = scale_thumbnail(pix, req->size);
+            g_object_unref(pix);
+        }
+        else
+        {
+            /* generate it unless it failed the last time */
+            dir = get_cache_dir(FALSE);
+            path = g_build_filename(dir, "fail", "pcmanfm", req->name, NULL);
+            pix = load_thumbnail_file(req, path);
+            g_free(path);
+            g_free(dir);
+            if(!pix)
+            {
+                g_thread_pool_push(generate_pool, req, NULL);
+                return;
+            }
+            g_object_unref(pix);
+        }
+    }
+    g_idle_add((GSourceFunc)on_request_done, req);
+}
+
+static void load_thumbnailers_in_dir(const char* data_dir)
+{
+    char* dir_path = g_build_filename(data_dir, "thumbnailers", NULL);
+    GDir* dir = g_dir_open(dir_path, 0, NULL);
+    const char* name;
+
+    if(dir)
+    {
+        while((name = g_dir_read_name(dir)))
+        {
+            GKeyFile* kf;
+            char* path;
+            char *try_exec, *exec, **types;
+            if(!g_str_has_suffix(name, ".thumbnailer"))
+                continue;
+            kf = g_key_file_new();
+            path = g_build_filename(dir_path, name, NULL);
+            if(g_key_file_load_from_file(kf, path, 0, NULL))
+            {
+                try_exec = g_key_file_get_string(kf, "Thumbnailer Entry", "TryExec", NULL);
+                exec = g_key_file_get_string(kf, "Thumbnailer Entry", "Exec", NULL);
+                types = g_key_file_get_string_list(kf, "Thumbnailer Entry", "MimeType", NULL, NULL);
+                if(try_exec)
+                {
+                    char* prog = g_find_program_in_path(try_exec);
+                    if(!prog) /* not installed */
+                    {
+                        g_free(exec);
+                        exec = NULL;
+                    }
+                    g_free(prog);
+                    g_free(try_exec);
+                }
+                if(exec && types)
+                {
+                    char** type;
+                    /* the first thumbnailer found for a type is used */
+                    for(type = types; *type; ++type)
+                        if(**type && !g_hash_table_lookup(thumbnailers, *type))
+                            g_hash_table_insert(thumbnailers, g_strdup(*type), g_strdup(exec));
+                }
+                g_free(exec);
+                g_strfreev(types);
+            }
+            g_free(path);
+            g_key_file_free(kf);
+        }
+        g_dir_close(dir);
+    }
+    g_free(dir_path);
+}
+
+/* find out what types thumbnails can be made for */
+static void init_types()
+{
+    const char* const* data_dirs;
+    GSList* formats, *l;
+
+    pixbuf_types = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    formats = gdk_pixbuf_get_formats();
+    for(l = formats; l; l = l->next)
+    {
+        GdkPixbufFormat* format = (GdkPixbufFormat*)l->data;
+        char** types, **type;
+        if(gdk_pixbuf_format_is_disabled(format))
+            continue;
+        types = gdk_pixbuf_format_get_mime_types(format);
+        for(type = types; *type; ++type)
+            g_hash_table_replace(pixbuf_types, g_strdup(*type), GINT_TO_POINTER(TRUE));
+        g_strfreev(types);
+    }
+    g_slist_free(formats);
+
+    thumbnailers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    load_thumbnailers_in_dir(g_get_user_data_dir());
+    for(data_dirs = g_get_system_data_dirs(); *data_dirs; ++data_dirs)
+        load_thumbnailers_in_dir(*data_dirs);
+}
+
+gboolean fm_thumb_is_supported(FmFileInfo* fi)
+{
+    FmMimeType* mime_type;
+    const char* type;
+
+    if(fm_file_info_is_dir(fi) || !fm_path_is_native(fm_file_info_get_path(fi)))
+        return FALSE;
+    mime_type = fm_file_info_get_mime_type(fi);
+    type = mime_type ? fm_mime_type_get_type(mime_type) : NULL;
+    if(!type)
+        return FALSE;
+    if(G_UNLIKELY(!pixbuf_types))
+        init_types();
+    return g_hash_table_lookup(pixbuf_types, type) || g_hash_table_lookup(thumbnailers, type);
+}
+
+static gint compare_requests(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    const FmThumbRequest* ra = (const FmThumbRequest*)a;
+    const FmThumbRequest* rb = (const FmThumbRequest*)b;
+    if(ra->priority != rb->priority)
+        return ra->priority < rb->priority ? -1 : 1;
+    /* the sequence numbers may wrap around */
+    return (gint)(ra->seq - rb->seq);
+}
+
+FmThumbRequest* fm_thumb_load_async(FmFileInfo* fi, int size, int priority,
+                                    FmThumbReadyFunc func, gpointer user_data)
+{
+    FmThumbRequest* req = g_slice_new0(FmThumbRequest);
+    FmPath* path = fm_file_info_get_path(fi);
+    FmMimeType* mime_type = fm_file_info_get_mime_type(fi);
+    const char* type = mime_type ? fm_mime_type_get_type(mime_type) : NULL;
+    char* md5;
+
+    if(G_UNLIKELY(!pixbuf_types))
+        init_types();
+    /* the file info is not used in the workers */
+    req->path = fm_path_to_str(path);
+    req->uri = fm_path_to_uri(path);
+    md5 = g_compute_checksum_for_string(G_CHECKSUM_MD5, req->uri, -1);
+    req->name = g_strconcat(md5, ".png", NULL);
+    g_free(md5);
+    /* GdkPixbuf is preferred, it doesn't start a new process */
+    if(type && !g_hash_table_lookup(pixbuf_types, type))
+        req->command = g_strdup((const char*)g_hash_table_lookup(thumbnailers, type));
+    req->mtime = fm_file_info_get_mtime(fi);
+    req->file_size = fm_file_info_get_size(fi);
+    req->size = size;
+    req->priority = priority;
+    req->seq = next_seq++;
+    req->func = func;
+    req->user_data = user_data;
+
+    if(G_UNLIKELY(!load_pool))
+    {
+        load_pool = g_thread_pool_new((GFunc)load_thread, NULL, 1, FALSE, NULL);
+        g_thread_pool_set_sort_function(load_pool, compare_requests, NULL);
+        generate_pool = g_thread_pool_new((GFunc)generate_thread, NULL, MAX_GENERATE_THREADS, FALSE, NULL);
+        g_thread_pool_set_sort_function(generate_pool, compare_requests, NULL);
+    }
+    g_thread_pool_push(load_pool, req, NULL);
+    return req;
+}
+
+void fm_thumb_cancel(FmThumbRequest* req)
+{
+    /* the request is freed when the worker is done with it */
+    g_atomic_int_set(&req->cancelled, TRUE);
+}
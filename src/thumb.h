@@ -0,0 +1,53 @@
+/*
+ *      thumb.h
+ *
+ *      Copyright 2010 Hong Jen Yee (PCMan) <pcman.tw@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __THUMB_H__
+#define __THUMB_H__
+
+#include <gtk/gtk.h>
+#include <libfm/fm-gtk.h>
+
+G_BEGIN_DECLS
+
+typedef struct _FmThumbRequest FmThumbRequest;
+
+/* pix is NULL if the file has no thumbnail */
+typedef void (*FmThumbReadyFunc)(GdkPixbuf* pix, gpointer user_data);
+
+/* TRUE if a thumbnail can be made for the file. Only local files are
+ * supported, of the types GdkPixbuf or a thumbnailer can handle. */
+gboolean fm_thumb_is_supported(FmFileInfo* fi);
+
+/* Get the thumbnail of the file scaled to fit in size x size.
+ * It's read from the thumbnail cache of freedesktop.org if it's there,
+ * or generated in a worker thread and saved to the cache otherwise.
+ * Requests with lower priority values are handled first.
+ * func is called in the main thread when it's done, never before this
+ * function returns. */
+FmThumbRequest* fm_thumb_load_async(FmFileInfo* fi, int size, int priority,
+                                    FmThumbReadyFunc func, gpointer user_data);
+
+/* func of the request will not be called after this. */
+void fm_thumb_cancel(FmThumbRequest* req);
+
+G_END_DECLS
+
+#endif
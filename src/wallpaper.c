@@ -0,0 +1,697 @@
+/*
+ *      wallpaper.c
+ *
+ *      Copyright 2010 Hong Jen Yee (PCMan) <pcman.tw@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include "wallpaper.h"
+#include "pcmanfm.h"
+#include "resample.h"
+
+#include <glib/gstdio.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+/*
+ * The disk cache stores the final image drawn on the root window, one
+ * file per combination of wallpaper file, mtime, mode, screen size and
+ * background color. The file is a small header followed by the key and
+ * the raw pixels of the image, so it can be mapped into memory and used
+ * as the pixel buffer of a GdkPixbuf without any copying.
+ */
+
+/* changed when the images are scaled differently, so they are made again */
+#define CACHE_MAGIC         "PCMFMWP2"
+#define MAX_CACHE_FILES     8
+
+typedef struct _CacheHeader CacheHeader;
+struct _CacheHeader
+{
+    char magic[8];
+    guint32 key_len; /* length of the key following the header */
+    guint32 width;
+    guint32 height;
+    guint32 rowstride;
+};
+
+/* the pixels are aligned to 4 bytes after the header and the key */
+#define PIXELS_OFFSET(key_len)  ((sizeof(CacheHeader) + (key_len) + 3) & ~3)
+
+static char* get_cache_dir(gboolean create)
+{
+    char* profile_dir = pcmanfm_get_profile_dir(create);
+    char* dir = g_build_filename(profile_dir, "wallpaper-cache", NULL);
+    g_free(profile_dir);
+    if(create)
+        g_mkdir_with_parents(dir, 0700);
+    return dir;
+}
+
+static void free_mapped_file(guchar* pixels, gpointer mf)
+{
+    g_mapped_file_free((GMappedFile*)mf);
+}
+
+/* the pixels of the returned pixbuf are the mapped file. it's mapped
+ * writable and private, so the pixbuf can be changed like any other one
+ * and the changes are copied on write, never written to the file. */
+static GdkPixbuf* load_cache(const char* path, const char* key)
+{
+    GMappedFile* mf = g_mapped_file_new(path, TRUE, NULL);
+    const CacheHeader* hdr;
+    gsize len, key_len;
+    const char* data;
+
+    if(!mf)
+        return NULL;
+    len = g_mapped_file_get_length(mf);
+    data = g_mapped_file_get_contents(mf);
+    hdr = (const CacheHeader*)data;
+    key_len = strlen(key);
+    /* check if this is really the image we want */
+    if(len >= PIXELS_OFFSET(key_len)
+       && memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic)) == 0
+       && hdr->key_len == key_len
+       && memcmp(data + sizeof(CacheHeader), key, key_len) == 0
+       && hdr->width > 0 && hdr->height > 0 && hdr->rowstride >= hdr->width * 3
+       && len >= PIXELS_OFFSET(key_len) + (gsize)hdr->rowstride * hdr->height)
+    {
+        /* update mtime so the recently used files are kept */
+        utime(path, NULL);
+        return gdk_pixbuf_new_from_data((guchar*)data + PIXELS_OFFSET(key_len),
+                                        GDK_COLORSPACE_RGB, FALSE, 8,
+                                        hdr->width, hdr->height, hdr->rowstride,
+                                        free_mapped_file, mf);
+    }
+    g_mapped_file_free(mf);
+    return NULL;
+}
+
+typedef struct _CacheFile CacheFile;
+struct _CacheFile
+{
+    char* path;
+    time_t mtime;
+};
+
+static gint compare_mtime(gconstpointer a, gconstpointer b)
+{
+    time_t ta = ((const CacheFile*)a)->mtime, tb = ((const CacheFile*)b)->mtime;
+    return ta < tb ? -1 : (ta > tb ? 1 : 0);
+}
+
+/* remove the least recently used files if there are too many */
+static void expire_cache(const char* dir_path)
+{
+    GDir* dir = g_dir_open(dir_path, 0, NULL);
+    GArray* files;
+    const char* name;
+    guint i;
+
+    if(!dir)
+        return;
+    files = g_array_new(FALSE, FALSE, sizeof(CacheFile));
+    while((name = g_dir_read_name(dir)))
+    {
+        struct stat st;
+        CacheFile file;
+        if(!g_str_has_suffix(name, ".raw"))
+            continue;
+        file.path = g_build_filename(dir_path, name, NULL);
+        if(g_stat(file.path, &st) == 0)
+        {
+            file.mtime = st.st_mtime;
+            g_array_append_val(files, file);
+        }
+        else
+            g_free(file.path);
+    }
+    g_dir_close(dir);
+
+    if(files->len > MAX_CACHE_FILES)
+    {
+        g_array_sort(files, compare_mtime);
+        for(i = 0; i < files->len - MAX_CACHE_FILES; ++i)
+            g_unlink(g_array_index(files, CacheFile, i).path);
+    }
+    for(i = 0; i < files->len; ++i)
+        g_free(g_array_index(files, CacheFile, i).path);
+    g_array_free(files, TRUE);
+}
+
+static void save_cache(const char* path, const char* key, GdkPixbuf* pix)
+{
+    CacheHeader hdr;
+    char* tmp_path = g_strconcat(path, ".tmp", NULL);
+    FILE* f = fopen(tmp_path, "wb");
+    gsize key_len = strlen(key);
+    const guchar* pixels = gdk_pixbuf_get_pixels(pix);
+    int y, row_len, pad;
+    gboolean ok;
+    static const char zeros[4] = {0};
+
+    if(!f)
+    {
+        g_free(tmp_path);
+        return;
+    }
+    memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.key_len = key_len;
+    hdr.width = gdk_pixbuf_get_width(pix);
+    hdr.height = gdk_pixbuf_get_height(pix);
+    /* the last row of a GdkPixbuf is not padded, so write rows one by one */
+    row_len = hdr.width * 3;
+    hdr.rowstride = (row_len + 3) & ~3;
+    pad = PIXELS_OFFSET(key_len) - sizeof(hdr) - key_len;
+
+    ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1
+         && fwrite(key, 1, key_len, f) == key_len
+         && fwrite(zeros, 1, pad, f) == pad;
+    for(y = 0; ok && y < (int)hdr.height; ++y)
+    {
+        ok = fwrite(pixels, 1, row_len, f) == row_len
+             && fwrite(zeros, 1, hdr.rowstride - row_len, f) == hdr.rowstride - row_len;
+        pixels += gdk_pixbuf_get_rowstride(pix);
+    }
+    if(fclose(f) == 0 && ok)
+        g_rename(tmp_path, path);
+    else
+        g_unlink(tmp_path);
+    g_free(tmp_path);
+}
+
+/* create an opaque image of w x h filled with bg */
+static GdkPixbuf* new_background(int w, int h, const GdkColor* bg)
+{
+    GdkPixbuf* dest = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, w, h);
+    gdk_pixbuf_fill(dest, ((guint32)(bg->red >> 8) << 24)
+                          | ((guint32)(bg->green >> 8) << 16)
+                          | ((guint32)(bg->blue >> 8) << 8) | 0xff);
+    return dest;
+}
+
+/* draw pix at (x, y) of dest without scaling it, clipped to dest */
+static void draw_unscaled(GdkPixbuf* pix, GdkPixbuf* dest, int x, int y)
+{
+    int x1 = MAX(x, 0), y1 = MAX(y, 0);
+    int x2 = MIN(x + gdk_pixbuf_get_width(pix), gdk_pixbuf_get_width(dest));
+    int y2 = MIN(y + gdk_pixbuf_get_height(pix), gdk_pixbuf_get_height(dest));
+
+    if(x2 <= x1 || y2 <= y1)
+        return;
+    if(gdk_pixbuf_get_has_alpha(pix))
+        gdk_pixbuf_composite(pix, dest, x1, y1, x2 - x1, y2 - y1,
+                             x, y, 1.0, 1.0, GDK_INTERP_NEAREST, 255);
+    else
+        gdk_pixbuf_copy_area(pix, x1 - x, y1 - y, x2 - x1, y2 - y1, dest, x1, y1);
+}
+
+/* get the size of the image in FM_WP_FIT mode. integer math here, so the
+ * size asked to the jpeg loader is the same as the one computed later. */
+static void get_fit_size(int w, int h, int dest_w, int dest_h, int* fit_w, int* fit_h)
+{
+    if((gint64)w * dest_h > (gint64)h * dest_w)
+    {
+        *fit_w = dest_w;
+        *fit_h = MAX((gint64)h * dest_w / w, 1);
+    }
+    else
+    {
+        *fit_w = MAX((gint64)w * dest_h / h, 1);
+        *fit_h = dest_h;
+    }
+}
+
+/* scale the image and blend it with bg like it's shown on the screen */
+static GdkPixbuf* compose_wallpaper(GdkPixbuf* pix, FmWallpaperMode mode,
+                                    int dest_w, int dest_h, const GdkColor* bg)
+{
+    int src_w = gdk_pixbuf_get_width(pix);
+    int src_h = gdk_pixbuf_get_height(pix);
+    int w, h;
+    GdkPixbuf* dest;
+
+    switch(mode)
+    {
+    case FM_WP_TILE:
+        dest_w = src_w;
+        dest_h = src_h;
+        break;
+    case FM_WP_STRETCH:
+        break;
+    case FM_WP_FIT:
+        get_fit_size(src_w, src_h, dest_w, dest_h, &dest_w, &dest_h);
+        break;
+    case FM_WP_CENTER:
+    default:
+        /* only the part of the image shown on the screen is kept. the
+         * rest of the screen is filled with bg when the image is drawn. */
+        w = MIN(src_w, dest_w);
+        h = MIN(src_h, dest_h);
+        if(!gdk_pixbuf_get_has_alpha(pix) && w == src_w && h == src_h)
+            return (GdkPixbuf*)g_object_ref(pix);
+        if(gdk_pixbuf_get_has_alpha(pix))
+            dest = new_background(w, h, bg);
+        else
+            dest = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, w, h);
+        draw_unscaled(pix, dest, MIN((dest_w - src_w)/2, 0), MIN((dest_h - src_h)/2, 0));
+        return dest;
+    }
+
+    /* the whole image is shown at dest_w x dest_h. it's blended with bg
+     * before it's scaled, so only opaque pixels are scaled. */
+    if(gdk_pixbuf_get_has_alpha(pix))
+    {
+        dest = new_background(src_w, src_h, bg);
+        draw_unscaled(pix, dest, 0, 0);
+        pix = dest;
+    }
+    else
+        g_object_ref(pix);
+    if(dest_w == src_w && dest_h == src_h)
+        return pix;
+    dest = fm_resample(pix, dest_w, dest_h, FM_RESAMPLE_LANCZOS);
+    g_object_unref(pix);
+    return dest;
+}
+
+/*
+ * Wallpapers are shared by all screens in the process. A request for an
+ * image that is being decoded is attached to the job decoding it, and an
+ * image still in use by any screen is reused without even reading the
+ * disk cache. The key of an image is the same as the key of its cache file.
+ */
+
+typedef struct _WallpaperJob WallpaperJob;
+struct _WallpaperJob
+{
+    char* key;
+    char* file;
+    FmWallpaperMode mode;
+    int dest_w;
+    int dest_h;
+    GdkColor bg;
+    GSList* requests; /* FmWallpaperRequest waiting for the result */
+    gboolean preload; /* decoded after the other jobs */
+    guint seq; /* jobs of the same priority are run in this order */
+    volatile gint cancelled;
+    GdkPixbuf* result;
+};
+
+struct _FmWallpaperRequest
+{
+    WallpaperJob* job; /* NULL if the result is already known */
+    GdkPixbuf* result; /* used if job is NULL */
+    guint idle;
+    FmWallpaperReadyFunc func;
+    gpointer user_data;
+};
+
+/* the images are decoded one by one, so there are not several huge
+ * images in memory at the same time. */
+static GThreadPool* decode_pool = NULL;
+static guint job_seq = 0;
+
+/* key => WallpaperJob being run */
+static GHashTable* jobs = NULL;
+/* key => GdkPixbuf, the entry is removed when the pixbuf is freed */
+static GHashTable* loaded = NULL;
+
+#define READ_BUF_SIZE   65536
+
+static void on_size_prepared(GdkPixbufLoader* loader, int w, int h, WallpaperJob* job)
+{
+    GdkPixbufFormat* format;
+    char* name;
+    int want_w, want_h, scale;
+
+    switch(job->mode)
+    {
+    case FM_WP_STRETCH:
+        want_w = job->dest_w;
+        want_h = job->dest_h;
+        break;
+    case FM_WP_FIT:
+        get_fit_size(w, h, job->dest_w, job->dest_h, &want_w, &want_h);
+        break;
+    default: /* FM_WP_CENTER and FM_WP_TILE use the original size */
+        return;
+    }
+    /* the jpeg loader can decode the image at 1/2, 1/4 or 1/8 of its size
+     * much faster. the smallest of them still not smaller than the image
+     * shown is used, and compose_wallpaper() does the rest. the other
+     * loaders decode the whole image and only scale it afterwards with a
+     * bilinear filter, which saves no memory and blurs or aliases large
+     * reductions, so they are left alone and fm_resample() does it all. */
+    format = gdk_pixbuf_loader_get_format(loader);
+    name = format ? gdk_pixbuf_format_get_name(format) : NULL;
+    if(name && strcmp(name, "jpeg") == 0)
+    {
+        for(scale = 8; scale > 1; scale /= 2)
+        {
+            if(w / scale >= want_w && h / scale >= want_h)
+            {
+                /* the size of the image decoded by libjpeg, rounded up */
+                gdk_pixbuf_loader_set_size(loader, (w + scale - 1) / scale, (h + scale - 1) / scale);
+                break;
+            }
+        }
+    }
+    g_free(name);
+}
+
+/* decode the file, reduced by the jpeg loader if it's shown smaller.
+ * returns NULL if cancelled. */
+static GdkPixbuf* decode_wallpaper(WallpaperJob* job)
+{
+    GdkPixbufLoader* loader;
+    GdkPixbuf* pix = NULL;
+    guchar* buf;
+    gsize n;
+    gboolean ok = TRUE;
+    FILE* f = fopen(job->file, "rb");
+
+    if(!f)
+        return NULL;
+    loader = gdk_pixbuf_loader_new();
+    g_signal_connect(loader, "size-prepared", G_CALLBACK(on_size_prepared), job);
+    buf = g_malloc(READ_BUF_SIZE);
+    while(ok && (n = fread(buf, 1, READ_BUF_SIZE, f)) > 0)
+    {
+        if(g_atomic_int_get(&job->cancelled))
+            ok = FALSE;
+        else
+            ok = gdk_pixbuf_loader_write(loader, buf, n, NULL);
+    }
+    g_free(buf);
+    fclose(f);
+    if(gdk_pixbuf_loader_close(loader, NULL) && ok)
+    {
+        pix = gdk_pixbuf_loader_get_pixbuf(loader);
+        if(pix)
+            g_object_ref(pix);
+    }
+    g_object_unref(loader);
+    return pix;
+}
+
+static GdkPixbuf* load_wallpaper(WallpaperJob* job)
+{
+    GdkPixbuf* pix, *composed;
+    char *name, *dir, *path;
+
+    name = g_compute_checksum_for_string(G_CHECKSUM_MD5, job->key, -1);
+    dir = get_cache_dir(FALSE);
+    path = g_strconcat(dir, G_DIR_SEPARATOR_S, name, ".raw", NULL);
+    g_free(name);
+
+    composed = load_cache(path, job->key);
+    if(!composed && (pix = decode_wallpaper(job)))
+    {
+        if(!g_atomic_int_get(&job->cancelled))
+        {
+            composed = compose_wallpaper(pix, job->mode, job->dest_w, job->dest_h, &job->bg);
+
+            g_free(dir);
+            dir = get_cache_dir(TRUE);
+            save_cache(path, job->key, composed);
+            expire_cache(dir);
+        }
+        g_object_unref(pix);
+    }
+    g_free(path);
+    g_free(dir);
+    return composed;
+}
+
+/* get the key of the image, or NULL if the file doesn't exist */
+static char* make_key(const char* file, FmWallpaperMode mode,
+                      int dest_w, int dest_h, const GdkColor* bg)
+{
+    struct stat st;
+    if(g_stat(file, &st) != 0)
+        return NULL;
+    return g_strdup_printf("%s\n%ld\n%ld\n%d\n%dx%d\n%04x%04x%04x", file,
+                           (long)st.st_mtime, (long)st.st_size, mode,
+                           dest_w, dest_h, bg->red, bg->green, bg->blue);
+}
+
+static void on_pixbuf_finalized(gpointer key, GObject* pix)
+{
+    /* the key may be used by a newer image already */
+    if(g_hash_table_lookup(loaded, key) == (gpointer)pix)
+        g_hash_table_remove(loaded, key);
+    g_free(key);
+}
+
+static void free_request(FmWallpaperRequest* req)
+{
+    if(req->result)
+        g_object_unref(req->result);
+    g_slice_free(FmWallpaperRequest, req);
+}
+
+/* called in main thread when the job is done */
+static gboolean on_job_done(WallpaperJob* job)
+{
+    /* a cancelled job is already replaced by a newer one */
+    if(g_hash_table_lookup(jobs, job->key) == job)
+        g_hash_table_remove(jobs, job->key);
+    if(job->result)
+    {
+        g_hash_table_insert(loaded, g_strdup(job->key), job->result);
+        g_object_weak_ref(G_OBJECT(job->result), (GWeakNotify)on_pixbuf_finalized, g_strdup(job->key));
+    }
+    while(job->requests)
+    {
+        FmWallpaperRequest* req = (FmWallpaperRequest*)job->requests->data;
+        job->requests = g_slist_delete_link(job->requests, job->requests);
+        req->func(job->result, req->user_data);
+        free_request(req);
+    }
+    if(job->result)
+        g_object_unref(job->result);
+    g_free(job->key);
+    g_free(job->file);
+    g_slice_free(WallpaperJob, job);
+    return FALSE;
+}
+
+static void decode_thread(WallpaperJob* job, gpointer user_data)
+{
+    if(!g_atomic_int_get(&job->cancelled))
+        job->result = load_wallpaper(job);
+    g_idle_add((GSourceFunc)on_job_done, job);
+}
+
+/* the images preloaded are decoded after the ones wanted now */
+static gint compare_jobs(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    const WallpaperJob* job1 = (const WallpaperJob*)a;
+    const WallpaperJob* job2 = (const WallpaperJob*)b;
+    if(job1->preload != job2->preload)
+        return job1->preload ? 1 : -1;
+    return job1->seq < job2->seq ? -1 : (job1->seq > job2->seq);
+}
+
+static gboolean on_request_idle(FmWallpaperRequest* req)
+{
+    req->func(req->result, req->user_data);
+    free_request(req);
+    return FALSE;
+}
+
+static FmWallpaperRequest* load_async(const char* file, FmWallpaperMode mode,
+                                      int dest_w, int dest_h, const GdkColor* bg, gboolean preload,
+                                      FmWallpaperReadyFunc func, gpointer user_data)
+{
+    FmWallpaperRequest* req = g_slice_new0(FmWallpaperRequest);
+    char* key = make_key(file, mode, dest_w, dest_h, bg);
+    GdkPixbuf* pix;
+    WallpaperJob* job;
+
+    req->func = func;
+    req->user_data = user_data;
+
+    if(G_UNLIKELY(!jobs))
+    {
+        jobs = g_hash_table_new(g_str_hash, g_str_equal);
+        loaded = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+
+    if(!key || (pix = (GdkPixbuf*)g_hash_table_lookup(loaded, key)))
+    {
+        /* the result is known, but func should not be called before
+         * this function returns. */
+        req->result = key ? (GdkPixbuf*)g_object_ref(pix) : NULL;
+        req->idle = g_idle_add((GSourceFunc)on_request_idle, req);
+        g_free(key);
+        return req;
+    }
+
+    job = (WallpaperJob*)g_hash_table_lookup(jobs, key);
+    if(job) /* the same image is being loaded for another screen */
+    {
+        g_free(key);
+        /* a job already queued is not moved, so this only matters to
+         * the jobs queued later. */
+        if(!preload)
+            job->preload = FALSE;
+    }
+    else
+    {
+        job = g_slice_new0(WallpaperJob);
+        job->key = key;
+        job->file = g_strdup(file);
+        job->mode = mode;
+        job->dest_w = dest_w;
+        job->dest_h = dest_h;
+        job->bg = *bg;
+        job->preload = preload;
+        job->seq = job_seq++;
+        g_hash_table_insert(jobs, job->key, job);
+
+        if(G_UNLIKELY(!decode_pool))
+        {
+            decode_pool = g_thread_pool_new((GFunc)decode_thread, NULL, 1, FALSE, NULL);
+            g_thread_pool_set_sort_function(decode_pool, compare_jobs, NULL);
+        }
+        g_thread_pool_push(decode_pool, job, NULL);
+    }
+    req->job = job;
+    job->requests = g_slist_append(job->requests, req);
+    return req;
+}
+
+FmWallpaperRequest* fm_wallpaper_load_async(const char* file, FmWallpaperMode mode,
+                                            int dest_w, int dest_h, const GdkColor* bg,
+                                            FmWallpaperReadyFunc func, gpointer user_data)
+{
+    return load_async(file, mode, dest_w, dest_h, bg, FALSE, func, user_data);
+}
+
+FmWallpaperRequest* fm_wallpaper_preload_async(const char* file, FmWallpaperMode mode,
+                                               int dest_w, int dest_h, const GdkColor* bg,
+                                               FmWallpaperReadyFunc func, gpointer user_data)
+{
+    return load_async(file, mode, dest_w, dest_h, bg, TRUE, func, user_data);
+}
+
+void fm_wallpaper_cancel(FmWallpaperRequest* req)
+{
+    WallpaperJob* job = req->job;
+    if(job)
+    {
+        job->requests = g_slist_remove(job->requests, req);
+        /* stop decoding if nobody needs the image now */
+        if(!job->requests)
+        {
+            g_atomic_int_set(&job->cancelled, TRUE);
+            g_hash_table_remove(jobs, job->key);
+        }
+    }
+    else
+        g_source_remove(req->idle);
+    free_request(req);
+}
+
+GdkPixbuf* fm_wallpaper_load_preview(const char* file, int max_w, int max_h)
+{
+    WallpaperJob job;
+    GdkPixbuf* pix, *scaled;
+    int w, h;
+
+    memset(&job, 0, sizeof(job));
+    job.file = (char*)file;
+    job.mode = FM_WP_FIT;
+    job.dest_w = max_w;
+    job.dest_h = max_h;
+    pix = decode_wallpaper(&job);
+    if(!pix)
+        return NULL;
+    get_fit_size(gdk_pixbuf_get_width(pix), gdk_pixbuf_get_height(pix), max_w, max_h, &w, &h);
+    if(w == gdk_pixbuf_get_width(pix) && h == gdk_pixbuf_get_height(pix))
+        return pix;
+    scaled = fm_resample(pix, w, h, FM_RESAMPLE_LANCZOS);
+    g_object_unref(pix);
+    return scaled;
+}
+
+/* lower case extensions of the image formats supported */
+static GHashTable* image_exts = NULL;
+
+static void init_image_exts()
+{
+    GSList* formats = gdk_pixbuf_get_formats(), *l;
+    image_exts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    for(l = formats; l; l = l->next)
+    {
+        GdkPixbufFormat* format = (GdkPixbufFormat*)l->data;
+        char** exts, **ext;
+        if(gdk_pixbuf_format_is_disabled(format))
+            continue;
+        exts = gdk_pixbuf_format_get_extensions(format);
+        for(ext = exts; *ext; ++ext)
+            g_hash_table_replace(image_exts, g_ascii_strdown(*ext, -1), GINT_TO_POINTER(TRUE));
+        g_strfreev(exts);
+    }
+    g_slist_free(formats);
+}
+
+static gint compare_names(gconstpointer a, gconstpointer b)
+{
+    return strcmp(*(const char**)a, *(const char**)b);
+}
+
+char** fm_wallpaper_list_dir(const char* dir_path)
+{
+    GDir* dir = g_dir_open(dir_path, 0, NULL);
+    GPtrArray* files;
+    const char* name;
+
+    if(!dir)
+        return NULL;
+    if(G_UNLIKELY(!image_exts))
+        init_image_exts();
+    files = g_ptr_array_new();
+    while((name = g_dir_read_name(dir)))
+    {
+        /* only the names are checked, the files are not read here */
+        const char* dot = strrchr(name, '.');
+        char* ext;
+        if(!dot || name[0] == '.')
+            continue;
+        ext = g_ascii_strdown(dot + 1, -1);
+        if(g_hash_table_lookup(image_exts, ext))
+            g_ptr_array_add(files, g_build_filename(dir_path, name, NULL));
+        g_free(ext);
+    }
+    g_dir_close(dir);
+
+    if(files->len == 0)
+    {
+        g_ptr_array_free(files, TRUE);
+        return NULL;
+    }
+    g_ptr_array_sort(files, compare_names);
+    g_ptr_array_add(files, NULL);
+    return (char**)g_ptr_array_free(files, FALSE);
+}
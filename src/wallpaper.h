@@ -0,0 +1,71 @@
+/*
+ *      wallpaper.h
+ *
+ *      Copyright 2010 Hong Jen Yee (PCMan) <pcman.tw@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __WALLPAPER_H__
+#define __WALLPAPER_H__
+
+#include <gtk/gtk.h>
+#include "app-config.h"
+
+G_BEGIN_DECLS
+
+typedef struct _FmWallpaperRequest FmWallpaperRequest;
+
+/* pix is NULL if the file cannot be loaded */
+typedef void (*FmWallpaperReadyFunc)(GdkPixbuf* pix, gpointer user_data);
+
+/* Get the wallpaper image ready to be drawn on a screen of dest_w x dest_h.
+ * The image is scaled according to mode, and blended with bg if it has an
+ * alpha channel. For FM_WP_TILE the returned image is the tile, and for
+ * FM_WP_STRETCH it has the size of the screen. For FM_WP_CENTER and
+ * FM_WP_FIT it's the part of the image visible on the screen, which
+ * should be drawn in the center of the screen filled with bg.
+ * The file is decoded in a worker thread and scaled with fm_resample(),
+ * and func is called in the main thread when it's done. Jpeg images are
+ * reduced by the decoder first when they are shown much smaller.
+ * The result is cached on disk, so the image file is only decoded and
+ * scaled again when the file or any of the parameters is changed. */
+FmWallpaperRequest* fm_wallpaper_load_async(const char* file, FmWallpaperMode mode,
+                                            int dest_w, int dest_h, const GdkColor* bg,
+                                            FmWallpaperReadyFunc func, gpointer user_data);
+
+/* Same as fm_wallpaper_load_async(), but the image is only decoded when
+ * no other wallpaper is waiting to be decoded. It's used to get an image
+ * ready before it's shown. */
+FmWallpaperRequest* fm_wallpaper_preload_async(const char* file, FmWallpaperMode mode,
+                                               int dest_w, int dest_h, const GdkColor* bg,
+                                               FmWallpaperReadyFunc func, gpointer user_data);
+
+/* func of the request will not be called after this. */
+void fm_wallpaper_cancel(FmWallpaperRequest* req);
+
+/* Load the image scaled to fit in max_w x max_h with the same filter as
+ * the wallpapers, for previews. It's done in the calling thread.
+ * Returns NULL if the file cannot be loaded. */
+GdkPixbuf* fm_wallpaper_load_preview(const char* file, int max_w, int max_h);
+
+/* Get the images in the directory which can be used as wallpapers,
+ * sorted by their names. Returns NULL if there are none. */
+char** fm_wallpaper_list_dir(const char* dir_path);
+
+G_END_DECLS
+
+#endif